@@ -316,8 +316,14 @@ void*
 pal_reserve_addr_space(void *addr, size_t size)
 {
     size = PAGE_ALIGN(size);
-    void *result = mmap(addr, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS,
+    /* `MAP_NORESERVE`: reserving a huge range must not be accounted
+       against the overcommit limits, only committed pages are */
+    void *result = mmap(addr, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
                         Invalid_FileHandle, 0);
+    if (result == MAP_FAILED)
+    {
+        result = NULL;
+    }
     return result;
 }
 
@@ -342,6 +348,18 @@ pal_release_addr_space(void *addr, size_t size)
     return pal_munmap(addr, PAGE_ALIGN(size));
 }
 
+bool
+pal_advise_huge_pages(void *addr, size_t size)
+{
+#ifdef MADV_HUGEPAGE
+    int advise_result = madvise(addr, PAGE_ALIGN(size), MADV_HUGEPAGE);
+    return (advise_result == 0);
+#else
+    (void) addr; (void) size;
+    return false;
+#endif
+}
+
 
 void*
 pal_mmap_memory( void* addr, size_t size, enum page_prot_flags prot, enum page_type_flags type )
@@ -377,9 +395,9 @@ pal_mremap( void* old_addr, size_t old_size, void *new_addr, size_t new_size,
     }
     else {
         result = mremap(old_addr, old_size, new_size, linux_flags );
-        if ( result == MAP_FAILED) {
-            result = 0;
-        }
+    }
+    if ( result == MAP_FAILED) {
+        result = 0;
     }
     assert(result);
     return result;
@@ -0,0 +1,695 @@
+/*
+ * Copyright (C) 2019  Davide Paro
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* Allocator benchmarks: runs a handful of standard workloads against
+   MPool, MPoolShared, MFList, MArena and the libc malloc, reporting
+   throughput, latency percentiles, RSS growth and fragmentation.
+
+   Build and run it with `make bench`, or `./bench_allocators [ops]`
+   where `ops` scales the number of operations of every workload. */
+
+#include "dpcrt_allocators.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <malloc.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+
+#define BENCH_DEFAULT_OPS       (2000000)
+/* Every `BENCH_SAMPLE_PERIOD`th operation is timed on its own to build the
+   latency distribution, timing all of them would mostly measure the clock */
+#define BENCH_SAMPLE_PERIOD     (16)
+#define BENCH_MAX_SAMPLES       (1 << 20)
+#define BENCH_SLOTS             (16384)
+#define BENCH_RING_SIZE         (1024)
+
+
+/* ##########################################################################
+   Utilities
+   ########################################################################## */
+
+static inline U64
+bench_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (U64) ts.tv_sec * 1000000000ull + (U64) ts.tv_nsec;
+}
+
+static inline U64
+bench_rand(U64 *state)
+{
+    /* xorshift64* */
+    U64 x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1Dull;
+}
+
+/* Log uniform size in [min, max], small sizes are far more common as in real programs */
+static inline U32
+bench_rand_size(U64 *state, U32 min, U32 max)
+{
+    const U32 min_log = bit_scan_reverse_u32(min);
+    const U32 max_log = bit_scan_reverse_u32(max);
+    const U32 log = min_log + (U32) (bench_rand(state) % (max_log - min_log + 1));
+    const U32 size = (1u << log) + (U32) (bench_rand(state) % (1u << log));
+    return CLAMP_MAX(CLAMP_MIN(size, min), max);
+}
+
+static size_t
+bench_rss_bytes(void)
+{
+    size_t result = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (f)
+    {
+        /* "<total pages> <resident pages> ..." */
+        char buf[128] = {0};
+        if (fread(buf, 1, sizeof(buf) - 1, f))
+        {
+            char *resident = NULL;
+            strtoul(buf, &resident, 10);
+            result = (size_t) strtoul(resident, NULL, 10) * (size_t) sysconf(_SC_PAGESIZE);
+        }
+        fclose(f);
+    }
+    return result;
+}
+
+typedef struct LatencySamples
+{
+    U32  count;
+    U32 *ns;
+} LatencySamples;
+
+static inline void
+latency_push(LatencySamples *s, U64 ns)
+{
+    if (s->count < BENCH_MAX_SAMPLES)
+    {
+        s->ns[s->count++] = (U32) CLAMP_MAX(ns, (U64) 0xffffffffU);
+    }
+}
+
+static int
+latency_cmp(const void *a, const void *b)
+{
+    const U32 x = *(const U32*) a, y = *(const U32*) b;
+    return (x > y) - (x < y);
+}
+
+static U32
+latency_percentile(LatencySamples *s, U32 percentile)
+{
+    if (s->count == 0)
+    {
+        return 0;
+    }
+    return s->ns[((size_t) s->count - 1) * percentile / 100];
+}
+
+
+/* ##########################################################################
+   Allocators under test
+   ########################################################################## */
+
+typedef union BenchContext
+{
+    MPool       mpool;
+    MPoolShared mpool_shared;
+    MFList      mflist;
+    MArena      marena;
+} BenchContext;
+
+typedef struct BenchAllocator
+{
+    const char *name;
+    /* Biggest allocation it can serve, the fixed size ones are initialized with it */
+    void  (*init)      (BenchContext *ctx, U32 max_size);
+    void  (*del)       (BenchContext *ctx);
+    void* (*alloc)     (BenchContext *ctx, U32 size);
+    /* NULL when single blocks cannot be given back (arenas) */
+    void  (*free)      (BenchContext *ctx, void *ptr);
+    /* NULL when not supported */
+    void* (*realloc)   (BenchContext *ctx, void *ptr, U32 old_size, U32 new_size);
+    /* Releases every allocation at once, NULL when not supported */
+    void  (*reset)     (BenchContext *ctx);
+    /* Bytes the allocator is holding from the OS */
+    size_t (*footprint)(BenchContext *ctx);
+    bool8 fixed_size;
+    bool8 thread_safe;
+} BenchAllocator;
+
+
+static void   libc_del       (BenchContext *ctx) { (void) ctx; malloc_trim(0); }
+static void*  libc_alloc     (BenchContext *ctx, U32 size) { (void) ctx; return malloc(size); }
+static void   libc_free      (BenchContext *ctx, void *ptr) { (void) ctx; free(ptr); }
+static void*  libc_realloc   (BenchContext *ctx, void *ptr, U32 old_size, U32 new_size) { (void) ctx, (void) old_size; return realloc(ptr, new_size); }
+/* The heap also holds the benchmark own buffers, only the growth from `libc_init` is counted */
+static size_t S_libc_baseline;
+
+static size_t
+libc_heap_size(void)
+{
+#if defined(__GLIBC__) && ((__GLIBC__ > 2) || (__GLIBC_MINOR__ >= 33))
+    struct mallinfo2 mi = mallinfo2();
+    return mi.arena + mi.hblkhd;
+#else
+    return 0;
+#endif
+}
+
+static void   libc_init      (BenchContext *ctx, U32 max_size) { (void) ctx, (void) max_size; S_libc_baseline = libc_heap_size(); }
+static size_t libc_footprint (BenchContext *ctx) { (void) ctx; size_t size = libc_heap_size(); return size > S_libc_baseline ? size - S_libc_baseline : 0; }
+
+static void   mpool_b_init      (BenchContext *ctx, U32 max_size) { mpool_init_aux(&ctx->mpool, (U32) KILOBYTES(256), (U16) max_size, true); }
+static void   mpool_b_del       (BenchContext *ctx) { mpool_del(&ctx->mpool); }
+static void*  mpool_b_alloc     (BenchContext *ctx, U32 size) { return mpool_alloc(&ctx->mpool, (U16) size); }
+static void   mpool_b_free      (BenchContext *ctx, void *ptr) { mpool_free(&ctx->mpool, ptr); }
+static void   mpool_b_reset     (BenchContext *ctx) { mpool_clear(&ctx->mpool); }
+static size_t mpool_b_footprint (BenchContext *ctx) { return ctx->mpool.total_allocator_memory_usage; }
+
+static void   mpool_shared_b_init      (BenchContext *ctx, U32 max_size) { mpool_shared_init_aux(&ctx->mpool_shared, (U32) KILOBYTES(256), (U16) max_size); }
+static void   mpool_shared_b_del       (BenchContext *ctx) { mpool_shared_flush_thread_cache(&ctx->mpool_shared); mpool_shared_del(&ctx->mpool_shared); }
+static void*  mpool_shared_b_alloc     (BenchContext *ctx, U32 size) { return mpool_shared_alloc(&ctx->mpool_shared, (U16) size); }
+static void   mpool_shared_b_free      (BenchContext *ctx, void *ptr) { mpool_shared_free(&ctx->mpool_shared, ptr); }
+static size_t mpool_shared_b_footprint (BenchContext *ctx) { return ctx->mpool_shared.depot.total_allocator_memory_usage; }
+
+static void   mflist_b_init      (BenchContext *ctx, U32 max_size) { (void) max_size; mflist_init_aux(&ctx->mflist, false, false); }
+static void   mflist_seg_b_init  (BenchContext *ctx, U32 max_size) { (void) max_size; mflist_init_aux(&ctx->mflist, true, false); }
+static void   mflist_cmp_b_init  (BenchContext *ctx, U32 max_size) { (void) max_size; mflist_init_compact(&ctx->mflist, true, false); }
+static void   mflist_b_del       (BenchContext *ctx) { mflist_del(&ctx->mflist); }
+static void*  mflist_b_alloc     (BenchContext *ctx, U32 size) { return mflist_alloc1(&ctx->mflist, size, false); }
+static void   mflist_b_free      (BenchContext *ctx, void *ptr) { mflist_free(&ctx->mflist, ptr); }
+static void*  mflist_b_realloc   (BenchContext *ctx, void *ptr, U32 old_size, U32 new_size) { (void) old_size; return mflist_realloc1(&ctx->mflist, ptr, new_size, false); }
+static void   mflist_b_reset     (BenchContext *ctx) { mflist_clear(&ctx->mflist); }
+static size_t mflist_b_footprint (BenchContext *ctx) { return ctx->mflist.total_allocator_memory_usage; }
+
+static void   marena_b_init      (BenchContext *ctx, U32 max_size) { (void) max_size; ctx->marena = marena_new_reserved((U32) GIGABYTES(1), (U32) MEGABYTES(1)); }
+static void   marena_b_del       (BenchContext *ctx) { marena_del(&ctx->marena); }
+static void   marena_b_reset     (BenchContext *ctx) { marena_clear(&ctx->marena); }
+static size_t marena_b_footprint (BenchContext *ctx) { return ctx->marena.data_max_size; }
+static void*
+marena_b_alloc(BenchContext *ctx, U32 size)
+{
+    MRef ref = marena_push(&ctx->marena, size, false);
+    /* Reserved arenas never move, the pointer stays valid until the next clear */
+    return ref ? ctx->marena.buffer + ref : NULL;
+}
+
+
+static const BenchAllocator G_bench_allocators[] = {
+    { "malloc",       libc_init,          libc_del,          libc_alloc,          libc_free,          libc_realloc,     NULL,             libc_footprint,          false, true  },
+    { "MPool",        mpool_b_init,       mpool_b_del,       mpool_b_alloc,       mpool_b_free,       NULL,             mpool_b_reset,    mpool_b_footprint,       true,  false },
+    { "MPoolShared",  mpool_shared_b_init, mpool_shared_b_del, mpool_shared_b_alloc, mpool_shared_b_free, NULL,          NULL,             mpool_shared_b_footprint, true, true  },
+    { "MFList",       mflist_b_init,      mflist_b_del,      mflist_b_alloc,      mflist_b_free,      mflist_b_realloc, mflist_b_reset,   mflist_b_footprint,      false, false },
+    { "MFList(seg)",  mflist_seg_b_init,  mflist_b_del,      mflist_b_alloc,      mflist_b_free,      mflist_b_realloc, mflist_b_reset,   mflist_b_footprint,      false, false },
+    { "MFList(cmp)",  mflist_cmp_b_init,  mflist_b_del,      mflist_b_alloc,      mflist_b_free,      mflist_b_realloc, mflist_b_reset,   mflist_b_footprint,      false, false },
+    { "MArena",       marena_b_init,      marena_b_del,      marena_b_alloc,      NULL,               NULL,             marena_b_reset,   marena_b_footprint,      false, false },
+};
+
+
+/* ##########################################################################
+   Workloads
+   ########################################################################## */
+
+typedef struct BenchResult
+{
+    U64    ops;
+    U64    elapsed_ns;
+    size_t rss_growth;
+    /* Allocator footprint over the live user bytes, measured at the peak */
+    double fragmentation;
+    LatencySamples latency;
+} BenchResult;
+
+typedef struct BenchSlot
+{
+    void *ptr;
+    U32   size;
+} BenchSlot;
+
+typedef struct BenchRun
+{
+    const BenchAllocator *a;
+    BenchContext         *ctx;
+    U64                   ops;
+    U64                   rng;
+    BenchSlot            *slots;
+    size_t                live_bytes;
+    BenchResult          *result;
+} BenchRun;
+
+typedef struct BenchWorkload
+{
+    const char *name;
+    U32   max_size;
+    bool8 needs_free;
+    bool8 needs_realloc;
+    bool8 needs_reset;
+    bool8 threaded;
+    void (*run)(BenchRun *run);
+} BenchWorkload;
+
+
+static inline void
+bench_touch(void *ptr, U32 size)
+{
+    /* Write the first and the last byte, like a caller initializing a header and a tail */
+    ((volatile U8*) ptr)[0] = 1;
+    ((volatile U8*) ptr)[size - 1] = 1;
+}
+
+static void
+bench_measure_peak(BenchRun *run, size_t rss_start)
+{
+    size_t footprint = run->a->footprint(run->ctx);
+    size_t rss = bench_rss_bytes();
+    run->result->rss_growth = rss > rss_start ? rss - rss_start : 0;
+    if (footprint && run->live_bytes)
+    {
+        run->result->fragmentation = (double) footprint / (double) run->live_bytes;
+    }
+}
+
+static void
+bench_release_slots(BenchRun *run, U32 slot_count)
+{
+    if (run->a->free)
+    {
+        for (U32 i = 0; i < slot_count; i++)
+        {
+            if (run->slots[i].ptr)
+            {
+                run->a->free(run->ctx, run->slots[i].ptr);
+            }
+        }
+    }
+    else
+    {
+        run->a->reset(run->ctx);
+    }
+    memclr(run->slots, sizeof(BenchSlot) * slot_count);
+    run->live_bytes = 0;
+}
+
+/* Random alloc/free on a fixed number of slots, sizes drawn from [min_size, max_size] */
+static void
+bench_slot_churn(BenchRun *run, U32 min_size, U32 max_size)
+{
+    const size_t rss_start = bench_rss_bytes();
+    const U64 start = bench_now_ns();
+
+    for (U64 op = 0; op < run->ops; op++)
+    {
+        const bool timed = (op % BENCH_SAMPLE_PERIOD) == 0;
+        BenchSlot *slot = &run->slots[bench_rand(&run->rng) % BENCH_SLOTS];
+        const U32 size = (min_size == max_size) ? min_size : bench_rand_size(&run->rng, min_size, max_size);
+
+        if (op == run->ops / 2)
+        {
+            bench_measure_peak(run, rss_start);
+        }
+
+        const U64 t0 = timed ? bench_now_ns() : 0;
+        if (slot->ptr)
+        {
+            run->a->free(run->ctx, slot->ptr);
+            run->live_bytes -= slot->size;
+            slot->ptr = NULL;
+        }
+        else
+        {
+            slot->ptr = run->a->alloc(run->ctx, size);
+            slot->size = size;
+            run->live_bytes += size;
+            bench_touch(slot->ptr, size);
+        }
+        if (timed)
+        {
+            latency_push(&run->result->latency, bench_now_ns() - t0);
+        }
+    }
+
+    run->result->elapsed_ns = bench_now_ns() - start;
+    run->result->ops = run->ops;
+    bench_release_slots(run, BENCH_SLOTS);
+}
+
+static void bench_fixed_churn(BenchRun *run) { bench_slot_churn(run, 64, 64); }
+static void bench_mixed_random(BenchRun *run) { bench_slot_churn(run, 16, 4096); }
+
+/* Buffers growing by 1.5x (eg dynamic arrays and string builders) until they
+   get past 64K, then they are freed and start over */
+static void
+bench_realloc_grow(BenchRun *run)
+{
+    enum { BUFFERS = 1024, MAX_SIZE = 65536 };
+    const size_t rss_start = bench_rss_bytes();
+    const U64 start = bench_now_ns();
+
+    for (U64 op = 0; op < run->ops; op++)
+    {
+        const bool timed = (op % BENCH_SAMPLE_PERIOD) == 0;
+        BenchSlot *slot = &run->slots[bench_rand(&run->rng) % BUFFERS];
+
+        if (op == run->ops / 2)
+        {
+            bench_measure_peak(run, rss_start);
+        }
+
+        const U64 t0 = timed ? bench_now_ns() : 0;
+        if (!slot->ptr)
+        {
+            slot->size = 16;
+            slot->ptr = run->a->alloc(run->ctx, slot->size);
+            run->live_bytes += slot->size;
+        }
+        else if (slot->size >= MAX_SIZE)
+        {
+            run->a->free(run->ctx, slot->ptr);
+            run->live_bytes -= slot->size;
+            slot->ptr = NULL;
+        }
+        else
+        {
+            const U32 new_size = slot->size + slot->size / 2;
+            slot->ptr = run->a->realloc(run->ctx, slot->ptr, slot->size, new_size);
+            run->live_bytes += new_size - slot->size;
+            slot->size = new_size;
+        }
+        if (slot->ptr)
+        {
+            bench_touch(slot->ptr, slot->size);
+        }
+        if (timed)
+        {
+            latency_push(&run->result->latency, bench_now_ns() - t0);
+        }
+    }
+
+    run->result->elapsed_ns = bench_now_ns() - start;
+    run->result->ops = run->ops;
+    bench_release_slots(run, BUFFERS);
+}
+
+/* Frame / request style: many small allocations all released together */
+static void
+bench_phase_reset(BenchRun *run)
+{
+    enum { PHASE_ALLOCS = BENCH_SLOTS };
+    const size_t rss_start = bench_rss_bytes();
+    const U64 phases = MAX(run->ops / PHASE_ALLOCS, 1);
+    U64 ops = 0;
+    const U64 start = bench_now_ns();
+
+    for (U64 phase = 0; phase < phases; phase++)
+    {
+        for (U32 i = 0; i < PHASE_ALLOCS; i++, ops++)
+        {
+            const bool timed = (ops % BENCH_SAMPLE_PERIOD) == 0;
+            const U32 size = bench_rand_size(&run->rng, 16, 256);
+            const U64 t0 = timed ? bench_now_ns() : 0;
+            run->slots[i].ptr = run->a->alloc(run->ctx, size);
+            run->slots[i].size = size;
+            run->live_bytes += size;
+            bench_touch(run->slots[i].ptr, size);
+            if (timed)
+            {
+                latency_push(&run->result->latency, bench_now_ns() - t0);
+            }
+        }
+        if (phase == phases / 2)
+        {
+            bench_measure_peak(run, rss_start);
+        }
+        if (run->a->reset)
+        {
+            run->a->reset(run->ctx);
+            memclr(run->slots, sizeof(BenchSlot) * PHASE_ALLOCS);
+            run->live_bytes = 0;
+        }
+        else
+        {
+            bench_release_slots(run, PHASE_ALLOCS);
+        }
+    }
+
+    run->result->elapsed_ns = bench_now_ns() - start;
+    run->result->ops = ops;
+}
+
+/* Larson style server workload: a fifth of the objects live for the whole run
+   while the others are continuously replaced, so the long lived ones end up
+   scattered among the short lived ones */
+static void
+bench_long_short_mix(BenchRun *run)
+{
+    enum { LONG_LIVED = BENCH_SLOTS / 5 };
+    const size_t rss_start = bench_rss_bytes();
+
+    for (U32 i = 0; i < BENCH_SLOTS; i++)
+    {
+        const U32 size = bench_rand_size(&run->rng, 16, 1024);
+        run->slots[i].ptr = run->a->alloc(run->ctx, size);
+        run->slots[i].size = size;
+        run->live_bytes += size;
+    }
+
+    const U64 start = bench_now_ns();
+    for (U64 op = 0; op < run->ops; op++)
+    {
+        const bool timed = (op % BENCH_SAMPLE_PERIOD) == 0;
+        BenchSlot *slot = &run->slots[LONG_LIVED + bench_rand(&run->rng) % (BENCH_SLOTS - LONG_LIVED)];
+        const U32 size = bench_rand_size(&run->rng, 16, 1024);
+
+        if (op == run->ops / 2)
+        {
+            bench_measure_peak(run, rss_start);
+        }
+
+        const U64 t0 = timed ? bench_now_ns() : 0;
+        run->a->free(run->ctx, slot->ptr);
+        slot->ptr = run->a->alloc(run->ctx, size);
+        bench_touch(slot->ptr, size);
+        if (timed)
+        {
+            latency_push(&run->result->latency, bench_now_ns() - t0);
+        }
+        run->live_bytes += (size_t) size - slot->size;
+        slot->size = size;
+    }
+
+    run->result->elapsed_ns = bench_now_ns() - start;
+    run->result->ops = run->ops;
+    bench_release_slots(run, BENCH_SLOTS);
+}
+
+
+/* Single producer single consumer ring: one thread allocates 64 bytes
+   objects, the other one frees them */
+typedef struct BenchRing
+{
+    BenchRun *run;
+    void     *items[BENCH_RING_SIZE];
+    /* Keep the two indices on their own cache lines */
+    U8        pad0[CACHE_LINE_SIZE];
+    U64       head;
+    U8        pad1[CACHE_LINE_SIZE];
+    U64       tail;
+    U8        pad2[CACHE_LINE_SIZE];
+    LatencySamples consumer_latency;
+} BenchRing;
+
+static void *
+bench_consumer_thread(void *arg)
+{
+    BenchRing *ring = arg;
+    BenchRun *run = ring->run;
+
+    for (U64 op = 0; op < run->ops; op++)
+    {
+        U64 tail = atomic_load(&ring->tail);
+        while (atomic_load(&ring->head) == tail)
+        {
+            cpu_relax();
+        }
+        void *ptr = ring->items[tail % BENCH_RING_SIZE];
+        atomic_store(&ring->tail, tail + 1);
+
+        const bool timed = (op % BENCH_SAMPLE_PERIOD) == 0;
+        const U64 t0 = timed ? bench_now_ns() : 0;
+        run->a->free(run->ctx, ptr);
+        if (timed)
+        {
+            latency_push(&ring->consumer_latency, bench_now_ns() - t0);
+        }
+    }
+    if (run->a->free == mpool_shared_b_free)
+    {
+        mpool_shared_flush_thread_cache(&run->ctx->mpool_shared);
+    }
+    return NULL;
+}
+
+static void
+bench_producer_consumer(BenchRun *run)
+{
+    static BenchRing ring;
+    const size_t rss_start = bench_rss_bytes();
+    pthread_t consumer;
+
+    zero_struct(&ring);
+    ring.run = run;
+    ring.consumer_latency.ns = malloc(sizeof(U32) * BENCH_MAX_SAMPLES);
+
+    const U64 start = bench_now_ns();
+    pthread_create(&consumer, NULL, bench_consumer_thread, &ring);
+
+    for (U64 op = 0; op < run->ops; op++)
+    {
+        const bool timed = (op % BENCH_SAMPLE_PERIOD) == 0;
+        const U64 t0 = timed ? bench_now_ns() : 0;
+        void *ptr = run->a->alloc(run->ctx, 64);
+        bench_touch(ptr, 64);
+        if (timed)
+        {
+            latency_push(&run->result->latency, bench_now_ns() - t0);
+        }
+
+        U64 head = atomic_load(&ring.head);
+        while (head - atomic_load(&ring.tail) >= BENCH_RING_SIZE)
+        {
+            cpu_relax();
+        }
+        ring.items[head % BENCH_RING_SIZE] = ptr;
+        atomic_store(&ring.head, head + 1);
+
+        if (op == run->ops / 2)
+        {
+            run->live_bytes = (size_t) (head - atomic_load(&ring.tail)) * 64;
+            bench_measure_peak(run, rss_start);
+        }
+    }
+
+    pthread_join(consumer, NULL);
+    run->result->elapsed_ns = bench_now_ns() - start;
+    run->result->ops = run->ops * 2;
+
+    for (U32 i = 0; i < ring.consumer_latency.count; i++)
+    {
+        latency_push(&run->result->latency, ring.consumer_latency.ns[i]);
+    }
+    free(ring.consumer_latency.ns);
+}
+
+
+static const BenchWorkload G_bench_workloads[] = {
+    /* name               max_size  free   realloc reset  threaded */
+    { "fixed_churn",       64,      true,  false,  false, false, bench_fixed_churn },
+    { "mixed_random",      4096,    true,  false,  false, false, bench_mixed_random },
+    { "realloc_grow",      65536,   true,  true,   false, false, bench_realloc_grow },
+    { "phase_reset",       256,     false, false,  false, false, bench_phase_reset },
+    { "long_short_mix",    1024,    true,  false,  false, false, bench_long_short_mix },
+    { "producer_consumer", 64,      true,  false,  false, true,  bench_producer_consumer },
+};
+
+
+static bool
+bench_workload_supported(const BenchWorkload *w, const BenchAllocator *a)
+{
+    if (w->needs_free && !a->free)                 return false;
+    if (w->needs_realloc && !a->realloc)           return false;
+    if (!a->free && !a->reset)                     return false;
+    if (w->threaded && !a->thread_safe)            return false;
+    /* MPool blocks are capped to 64K, and very big blocks would only measure the waste */
+    if (a->fixed_size && w->max_size > 4096)       return false;
+    return true;
+}
+
+
+int
+main(int argc, char **argv)
+{
+    U64 ops = BENCH_DEFAULT_OPS;
+    if (argc > 1)
+    {
+        ops = strtoull(argv[1], NULL, 10);
+        ops = MAX(ops, (U64) BENCH_SLOTS);
+    }
+
+    static BenchContext ctx;
+    BenchSlot *slots = calloc(BENCH_SLOTS, sizeof(BenchSlot));
+    U32 *samples = malloc(sizeof(U32) * BENCH_MAX_SAMPLES);
+
+    printf("%-18s %-12s %12s %10s %10s %12s %8s\n",
+           "workload", "allocator", "Mops/sec", "p50 ns", "p99 ns", "RSS+ KB", "frag");
+
+    for (size_t wi = 0; wi < ARRAY_LEN(G_bench_workloads); wi++)
+    {
+        const BenchWorkload *w = &G_bench_workloads[wi];
+
+        for (size_t ai = 0; ai < ARRAY_LEN(G_bench_allocators); ai++)
+        {
+            const BenchAllocator *a = &G_bench_allocators[ai];
+            if (!bench_workload_supported(w, a))
+            {
+                continue;
+            }
+
+            BenchResult result = {0};
+            result.latency.ns = samples;
+
+            BenchRun run = {
+                .a      = a,
+                .ctx    = &ctx,
+                .ops    = ops,
+                .rng    = 0x9E3779B97F4A7C15ull + wi,
+                .slots  = slots,
+                .result = &result,
+            };
+
+            memclr(slots, sizeof(BenchSlot) * BENCH_SLOTS);
+            a->init(&ctx, w->max_size);
+            w->run(&run);
+            a->del(&ctx);
+
+            qsort(result.latency.ns, result.latency.count, sizeof(U32), latency_cmp);
+            printf("%-18s %-12s %12.2f %10u %10u %12zu %8.2f\n",
+                   w->name, a->name,
+                   (double) result.ops * 1e3 / (double) MAX(result.elapsed_ns, 1),
+                   latency_percentile(&result.latency, 50),
+                   latency_percentile(&result.latency, 99),
+                   result.rss_growth / 1024,
+                   result.fragmentation);
+        }
+    }
+
+    free(samples);
+    free(slots);
+    return 0;
+}
@@ -4,54 +4,214 @@
 
 
 
-size_t
-LevenshteinDistance(char *s, char *t)
+/* ##########################################################################
+   Levenshtein distance, bit parallel (Myers 1999, Hyyro 2003)
+   ##########################################################################
+
+   For the pattern `p` (the shortest string, m rows) and the text `t` (n columns),
+   column `j` of the DP matrix is encoded by the bit vectors of its vertical deltas
+   (`VP` bit i set: D[i+1][j] - D[i][j] == +1, `VN`: == -1). Each char of `t` advances the
+   whole column with a handful of word operations, given `Peq[c]`: the bits of the rows of `p`
+   equal to `c`. Only the score of the last row is tracked explicitly. */
+
+#define LEVENSHTEIN_WORD_BITS 64
+
+/* Advances one 64 rows block of the column by the text char whose match mask is `eq`.
+   `hin` is the horizontal delta entering the top of the block (-1, 0, +1),
+   returns the one leaving the row marked by `out_mask`. */
+static inline int
+levenshtein__advance_block(U64 *vp, U64 *vn, U64 eq, int hin, U64 out_mask)
 {
-       
-    const size_t n = strlen(t);
-    const size_t m = strlen(s);
+    const U64 pv = *vp, nv = *vn;
+    const U64 xv = eq | nv;
+    if (hin < 0)
+    {
+        eq |= 1;
+    }
+    const U64 xh = (((eq & pv) + pv) ^ pv) | eq;
+    U64 ph = nv | ~(xh | pv);
+    U64 mh = pv & xh;
+
+    /* Branch free, the sign of the deltas is unpredictable */
+    const int hout = (int) ((ph & out_mask) != 0) - (int) ((mh & out_mask) != 0);
+
+    ph <<= 1;
+    mh <<= 1;
+    if (hin < 0)      { mh |= 1; }
+    else if (hin > 0) { ph |= 1; }
+
+    *vp = mh | ~(xv | ph);
+    *vn = ph & xv;
+    return hout;
+}
+
+/* Each remaining column lowers the score by one at most */
+#define LEVENSHTEIN__CANNOT_END_WITHIN(score, remaining, k) \
+    ((score) > (remaining) && (score) - (remaining) > (k))
+
+/* Pattern up to 64 chars, everything lives in registers and on the stack */
+static size_t
+levenshtein__single_word(const U8 *p, size_t m, const U8 *t, size_t n, size_t k)
+{
+    U64 peq[256];
+    /* Only the entries of the chars of `t` are ever read */
+    for (size_t j = 0; j < n; j++)
+    {
+        peq[t[j]] = 0;
+    }
+    for (size_t i = 0; i < m; i++)
+    {
+        peq[p[i]] |= (U64) 1 << i;
+    }
 
-    size_t *v0 = BUF_NEW(size_t, n);
-    size_t *v1 = BUF_NEW(size_t, n);
-  
+    const U64 last = (U64) 1 << (m - 1);
+    U64 vp = ~(U64) 0, vn = 0;
+    size_t score = m;
+    for (size_t j = 0; j < n; j++)
+    {
+        score += (size_t) levenshtein__advance_block(&vp, &vn, peq[t[j]], 1, last);
+        if (LEVENSHTEIN__CANNOT_END_WITHIN(score, n - j - 1, k))
+        {
+            return k + 1;
+        }
+    }
+    return score;
+}
+
+static size_t
+levenshtein__multi_word(const U8 *p, size_t m, const U8 *t, size_t n, size_t k)
+{
+    const size_t block_count = (m + LEVENSHTEIN_WORD_BITS - 1) / LEVENSHTEIN_WORD_BITS;
+    const U64 last_row_mask = (U64) 1 << ((m - 1) % LEVENSHTEIN_WORD_BITS);
+    const U64 block_row_mask = (U64) 1 << (LEVENSHTEIN_WORD_BITS - 1);
 
-    for (size_t i = 0; i < n; i ++)
+    ScratchArena scratch = scratch_begin(NULL, 0);
+    U64    *peq   = SCRATCH_PUSH_ARRAY(&scratch, U64, 256 * block_count);
+    U64    *vp    = SCRATCH_PUSH_ARRAY(&scratch, U64, block_count);
+    U64    *vn    = SCRATCH_PUSH_ARRAY(&scratch, U64, block_count);
+    size_t *score = SCRATCH_PUSH_ARRAY(&scratch, size_t, block_count);
+    if (!peq || !vp || !vn || !score)
     {
-        v0[i] = i; 
+        perror("levenshtein_distance: Failed to allocate the bit vectors");
+        pal_abort();
     }
 
+    for (size_t j = 0; j < n; j++)
+    {
+        memset(peq + (size_t) t[j] * block_count, 0, sizeof(U64) * block_count);
+    }
     for (size_t i = 0; i < m; i++)
     {
-        v1[0] = i + 1;
+        peq[(size_t) p[i] * block_count + i / LEVENSHTEIN_WORD_BITS] |= (U64) 1 << (i % LEVENSHTEIN_WORD_BITS);
+    }
 
+    /* Band: in column j only the rows up to j + k can hold a distance within `k`.
+       The blocks below it are added as the band moves down, initialized as if every row
+       was one more than the one above: it overestimates rows whose distance exceeds `k` anyway. */
+    size_t last_block = (k >= m) ? block_count - 1 : k / LEVENSHTEIN_WORD_BITS;
+    for (size_t b = 0; b <= last_block; b++)
+    {
+        vp[b] = ~(U64) 0;
+        vn[b] = 0;
+        score[b] = MIN(m, (b + 1) * LEVENSHTEIN_WORD_BITS);
+    }
 
-        for (size_t j = 0; j < n; j++)
+    size_t result = SIZE_MAX;
+    for (size_t j = 0; j < n; j++)
+    {
+        if (last_block < block_count - 1 && (j + k) / LEVENSHTEIN_WORD_BITS > last_block)
         {
-            size_t deletion_cost     = v0[j + 1] + 1;
-            size_t insertion_cost    = v1[j] + 1;
-            size_t substitution_cost = v0[j];
-            
-            if (s[i] != t[j])
-                substitution_cost += 1;
-
-            v1[j + 1] = MIN(deletion_cost, MIN(insertion_cost, substitution_cost));
+            last_block++;
+            vp[last_block] = ~(U64) 0;
+            vn[last_block] = 0;
+            score[last_block] = score[last_block - 1]
+                + (MIN(m, (last_block + 1) * LEVENSHTEIN_WORD_BITS) - last_block * LEVENSHTEIN_WORD_BITS);
         }
 
-        SWAP(size_t*, v0, v1);
+        const U64 *eq = peq + (size_t) t[j] * block_count;
+        int hout = 1;   /* The first row of the matrix grows by one each column */
+        for (size_t b = 0; b <= last_block; b++)
+        {
+            const U64 out_mask = (b == block_count - 1) ? last_row_mask : block_row_mask;
+            hout = levenshtein__advance_block(&vp[b], &vn[b], eq[b], hout, out_mask);
+            score[b] += (size_t) hout;
+        }
+
+        if (last_block == block_count - 1
+            && LEVENSHTEIN__CANNOT_END_WITHIN(score[last_block], n - j - 1, k))
+        {
+            result = k + 1;
+            break;
+        }
+    }
+    if (result == SIZE_MAX)
+    {
+        result = score[block_count - 1];
     }
-    
 
-    size_t result = v0[n];
-    BUF_FREE(v0);
-    BUF_FREE(v1);
+    scratch_end(scratch);
     return result;
 }
 
+size_t
+levenshtein_distance(const char *s, size_t s_len,
+                     const char *t, size_t t_len,
+                     size_t max_distance)
+{
+    const U8 *p = (const U8 *) s;
+    const U8 *q = (const U8 *) t;
+    size_t m = s_len, n = t_len;
+
+    /* The common prefix and suffix never cost an edit */
+    while (m && n && *p == *q)
+    {
+        p++; q++; m--; n--;
+    }
+    while (m && n && p[m - 1] == q[n - 1])
+    {
+        m--; n--;
+    }
+
+    /* The shortest string is the pattern, encoded in the bit vectors */
+    if (m > n)
+    {
+        const U8 *tmp_s = p; p = q; q = tmp_s;
+        size_t tmp_len = m; m = n; n = tmp_len;
+    }
+
+    size_t result;
+    if (n - m > max_distance)
+    {
+        result = max_distance + 1;
+    }
+    else if (m == 0)
+    {
+        result = n;
+    }
+    else if (m <= LEVENSHTEIN_WORD_BITS)
+    {
+        result = levenshtein__single_word(p, m, q, n, max_distance);
+    }
+    else
+    {
+        result = levenshtein__multi_word(p, m, q, n, max_distance);
+    }
+    return (result > max_distance) ? max_distance + 1 : result;
+}
+
+
+size_t
+LevenshteinDistance(char *s, char *t)
+{
+    return levenshtein_distance(s, strlen(s), t, strlen(t), SIZE_MAX);
+}
+
 
 size_t
 LongestCommonSubSequence(char *s, char *t)
 {
     // TODO IMPLEMENT ME
+    (void) s;
+    (void) t;
     return 0;
 }
-
@@ -3,6 +3,9 @@
 
 #include "dpcrt_utils.h"
 
+__BEGIN_DECLS
+
+/* Reference of the classic dynamic programming algorithm:
 
 function LevenshteinDistance(char s[0..m-1], char t[0..n-1]):
     // create two work vectors of integer distances
@@ -38,5 +41,32 @@ function LevenshteinDistance(char s[0..m-1], char t[0..n-1]):
         swap v0 with v1
     // after the last swap, the results of v1 are now in v0
     return v0[n]
+*/
+
+/* Levenshtein (edit) distance between the null terminated strings `s` and `t` */
+size_t LevenshteinDistance(char *s, char *t);
+
+/* Levenshtein distance with the bit parallel algorithm of Myers / Hyyro: the DP columns are
+   encoded as bit vectors of vertical deltas and advanced 64 rows per word operation,
+   O(ceil(m / 64) * n) with m the length of the shortest string. Strings up to 64 chars
+   (after trimming their common prefix and suffix) need no allocation at all, longer ones
+   use a scratch arena.
+   As soon as the distance is known to exceed `max_distance` it stops returning
+   `max_distance + 1`, and only the band of the rows within `max_distance` of the diagonal
+   is ever computed. Pass SIZE_MAX for the exact distance.
+
+   @EXAMPLE USAGE:
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+   // Dictionary lookup of the identifiers within 2 edits of `ident`
+   for (...) {
+       if (levenshtein_distance(ident, ident_len, dict[i], dict_len[i], 2) <= 2) { ... }
+   }
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+*/
+size_t levenshtein_distance(const char *s, size_t s_len,
+                            const char *t, size_t t_len,
+                            size_t max_distance);
+
+__END_DECLS
 
 #endif /* HGUARD_5357420049c74e87909cad414989c447 */
@@ -34,38 +34,225 @@
 
 
 
+/* ##########################################################################
+   Allocator Stats Implementation
+   ########################################################################## */
+
+#if DPCRT_ALLOCATOR_STATS
+#  define ALLOC_STATS_ONLY(...) __VA_ARGS__
+#else
+#  define ALLOC_STATS_ONLY(...)
+#endif
+
+
+#if DPCRT_ALLOCATOR_STATS
+
+static inline U64
+alloc_stats__timestamp(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+    return (U64) __builtin_ia32_rdtsc();
+#elif defined(__clang__)
+    return (U64) __builtin_readcyclecounter();
+#else
+    return 0;
+#endif
+}
+
+static inline U32
+alloc_stats__bucket(U64 value)
+{
+    if (value == 0)
+    {
+        return 0;
+    }
+    const U32 bucket = (U32) (63 - __builtin_clzll(value));
+    return MIN(bucket, ALLOC_STATS_HISTOGRAM_BUCKET_COUNT - 1);
+}
+
+static inline void
+alloc_stats__update_usage(AllocStats *stats, U64 live_bytes, U64 reserved_bytes, U64 chunk_count)
+{
+    stats->live_bytes          = live_bytes;
+    stats->peak_live_bytes     = MAX(stats->peak_live_bytes, live_bytes);
+    stats->reserved_bytes      = reserved_bytes;
+    stats->peak_reserved_bytes = MAX(stats->peak_reserved_bytes, reserved_bytes);
+    stats->chunk_count         = chunk_count;
+    stats->peak_chunk_count    = MAX(stats->peak_chunk_count, chunk_count);
+}
+
+/* `start` is the timestamp taken before the allocation, 0 to not record the latency */
+static inline void
+alloc_stats__record_alloc(AllocStats *stats, U64 size, bool success, U64 start)
+{
+    if (start)
+    {
+        stats->alloc_latency_histogram[alloc_stats__bucket(alloc_stats__timestamp() - start)]++;
+    }
+    stats->size_class_counts[alloc_stats__bucket(size)]++;
+    if (success)
+    {
+        stats->alloc_count++;
+    }
+    else
+    {
+        stats->failed_alloc_count++;
+    }
+}
+
+static inline void
+alloc_stats__record_free(AllocStats *stats, U64 start)
+{
+    if (start)
+    {
+        stats->free_latency_histogram[alloc_stats__bucket(alloc_stats__timestamp() - start)]++;
+    }
+    stats->free_count++;
+}
+
+
+F64
+alloc_stats_fragmentation(AllocStats *stats)
+{
+    if (stats->reserved_bytes == 0)
+    {
+        return 0.0;
+    }
+    return 1.0 - (F64) stats->live_bytes / (F64) stats->reserved_bytes;
+}
+
+
+void
+alloc_stats_reset(AllocStats *stats)
+{
+    memclr(stats, sizeof(*stats));
+}
+
+
+static void
+alloc_stats__dump_histogram(U64 *histogram, const char *title, FILE *stream)
+{
+    /* Print only the range of non empty buckets */
+    U32 first_bucket = ALLOC_STATS_HISTOGRAM_BUCKET_COUNT;
+    U32 last_bucket = 0;
+    for (U32 i = 0; i < ALLOC_STATS_HISTOGRAM_BUCKET_COUNT; i++)
+    {
+        if (histogram[i])
+        {
+            first_bucket = MIN(first_bucket, i);
+            last_bucket = i + 1;
+        }
+    }
+    if (last_bucket == 0)
+    {
+        return;
+    }
+
+    fprintf(stream, "  %s:\n", title);
+    for (U32 i = first_bucket; i < last_bucket; i++)
+    {
+        const U64 lo = (i == 0) ? 0 : ((U64) 1 << i);
+        if (i == ALLOC_STATS_HISTOGRAM_BUCKET_COUNT - 1)
+        {
+            fprintf(stream, "    [%12llu,          inf) %llu\n",
+                    (unsigned long long) lo, (unsigned long long) histogram[i]);
+        }
+        else
+        {
+            fprintf(stream, "    [%12llu, %12llu) %llu\n",
+                    (unsigned long long) lo, (unsigned long long) ((U64) 1 << (i + 1)),
+                    (unsigned long long) histogram[i]);
+        }
+    }
+}
+
+
+void
+alloc_stats_dump(AllocStats *stats, const char *name, FILE *stream)
+{
+    fprintf(stream, "== %s ==\n", name ? name : "allocator");
+    fprintf(stream, "  allocs: %llu, frees: %llu, reallocs: %llu, failed allocs: %llu\n",
+            (unsigned long long) stats->alloc_count,
+            (unsigned long long) stats->free_count,
+            (unsigned long long) stats->realloc_count,
+            (unsigned long long) stats->failed_alloc_count);
+    fprintf(stream, "  live bytes: %llu (peak %llu)\n",
+            (unsigned long long) stats->live_bytes,
+            (unsigned long long) stats->peak_live_bytes);
+    fprintf(stream, "  reserved bytes: %llu (peak %llu), chunks: %llu (peak %llu)\n",
+            (unsigned long long) stats->reserved_bytes,
+            (unsigned long long) stats->peak_reserved_bytes,
+            (unsigned long long) stats->chunk_count,
+            (unsigned long long) stats->peak_chunk_count);
+    fprintf(stream, "  fragmentation: %.2f%%\n", 100.0 * alloc_stats_fragmentation(stats));
+
+    alloc_stats__dump_histogram(stats->size_class_counts,       "requested sizes (bytes)", stream);
+    alloc_stats__dump_histogram(stats->alloc_latency_histogram, "alloc latency (cycles)",  stream);
+    alloc_stats__dump_histogram(stats->free_latency_histogram,  "free latency (cycles)",   stream);
+}
+
+#endif
+
+
+
 /* ##########################################################################
    MPool Implementation
    ########################################################################## */
 
 #define MPOOL_RESERVED_CHUNK_HEADER_SIZE ( ALIGN(size_t, sizeof(MPoolChunk), 128) )
+/* Past a few colours the chunks mostly wrap around the same cache sets anyway */
+#define MPOOL_MAX_CHUNK_COLOURS (8)
 
 
 static MPoolChunk *
 mpool_get_chunk_from_addr(MPool *mpool,
                           void *_addr)
 {
-    MPoolChunk *result = NULL;
+    U8 *addr = _addr;
 
-    MPoolChunk *it = mpool->first_chunk;
+    /* Chunks are mapped at an address multiple of `chunk_alignment`,
+       masking the address gives back the owning chunk without
+       walking the chain */
+    MPoolChunk *result = (MPoolChunk *)
+        ((usize) addr & ~((usize) mpool->chunk_alignment - 1));
 
-    U8 *addr = _addr;
+    if ((addr < ((U8*) result + mpool->first_block_offset))
+        || (addr >= ((U8*) result + mpool->chunk_size)))
+    {
+        return NULL;
+    }
 
-    if (0 != ((usize)(addr - MPOOL_RESERVED_CHUNK_HEADER_SIZE)
-              % mpool->block_size))
+    /* The header page of a chunk is never decommitted. Check that it is one
+       of ours before trusting anything else stored in it.
+       @NOTE :: This only catches blocks of another live pool, `addr` is trusted to
+       lie in a mapped chunk: freeing a foreign pointer is undefined behaviour */
+    if (result->owner != mpool)
+    {
+        return NULL;
+    }
+
+    if (addr < ((U8*) result + result->first_block_offset))
     {
         return NULL;
     }
 
-    do {
+    if (0 != ((usize)(addr - (U8*) result - result->first_block_offset)
+              % mpool->block_size))
+    {
+        return NULL;
+    }
 
-        if ((addr > ((U8*) it)) && (addr < (((U8*) it) + mpool->chunk_size)))
+#if __DEBUG
+    {
+        /* Make sure the address actually belongs to this pool */
+        MPoolChunk *it = mpool->first_chunk;
+        while (it && it != result)
         {
-            result = it;
-            break;
+            it = it->next_chunk;
         }
-
-    } while ((it = it->next_chunk));
+        internal_assert_msg(it == result, "The address does not belong to this MPool");
+    }
+#endif
 
     return result;
 }
@@ -100,6 +287,108 @@ mpool__get_next_adjacent_block(MPool *mpool,
 }
 
 
+static inline void
+mpool__link_avail_chunk(MPool *mpool,
+                        MPoolChunk *chunk)
+{
+    internal_assert(chunk->next_block);
+    internal_assert(!chunk->prev_avail_chunk && !chunk->next_avail_chunk);
+    internal_assert(mpool->first_avail_chunk != chunk);
+
+    chunk->prev_avail_chunk = NULL;
+    chunk->next_avail_chunk = mpool->first_avail_chunk;
+    if (mpool->first_avail_chunk)
+    {
+        mpool->first_avail_chunk->prev_avail_chunk = chunk;
+    }
+    mpool->first_avail_chunk = chunk;
+}
+
+static inline void
+mpool__unlink_avail_chunk(MPool *mpool,
+                          MPoolChunk *chunk)
+{
+    if (chunk->prev_avail_chunk)
+    {
+        chunk->prev_avail_chunk->next_avail_chunk = chunk->next_avail_chunk;
+    }
+    else
+    {
+        internal_assert(mpool->first_avail_chunk == chunk);
+        mpool->first_avail_chunk = chunk->next_avail_chunk;
+    }
+
+    if (chunk->next_avail_chunk)
+    {
+        chunk->next_avail_chunk->prev_avail_chunk = chunk->prev_avail_chunk;
+    }
+
+    chunk->prev_avail_chunk = NULL;
+    chunk->next_avail_chunk = NULL;
+}
+
+
+/* Gives back to the OS the pages of an empty chunk. Its free list is reset
+   to a single all free block so that nothing lives in the decommitted pages. */
+static void
+mpool__decommit_chunk(MPool *mpool,
+                      MPoolChunk *chunk)
+{
+    internal_assert(chunk->used_block_count == 0);
+    internal_assert(!chunk->decommitted);
+
+    MPoolBlock *first_block = (MPoolBlock*) ((U8*) chunk + chunk->first_block_offset);
+    first_block->following_blocks_are_all_free = true;
+    first_block->next_block = NULL;
+    chunk->next_block = first_block;
+
+    U8 *start = (U8*) PAGE_ALIGN((usize) first_block + sizeof(MPoolBlock));
+    U8 *end   = (U8*) chunk + mpool->chunk_size;
+    if (start < end)
+    {
+        pal_uncommit_addr_space(start, (size_t) (end - start));
+    }
+    chunk->decommitted = true;
+}
+
+/* Applies the warm chunks policy to a chunk that just became empty */
+static inline void
+mpool__release_empty_chunk(MPool *mpool,
+                           MPoolChunk *chunk)
+{
+    if ((mpool->warm_chunk_count < mpool->max_warm_chunks) || mpool->huge_pages)
+    {
+        mpool->warm_chunk_count++;
+    }
+    else
+    {
+        mpool__decommit_chunk(mpool, chunk);
+    }
+}
+
+static inline void
+mpool__chunk_add_used_blocks(MPool *mpool,
+                             MPoolChunk *chunk,
+                             U32 count)
+{
+    if (chunk->used_block_count == 0)
+    {
+        /* Decommitted pages are refilled (zeroed) by the OS on first touch */
+        if (chunk->decommitted)
+        {
+            chunk->decommitted = false;
+        }
+        else
+        {
+            internal_assert(mpool->warm_chunk_count);
+            mpool->warm_chunk_count--;
+        }
+    }
+
+    chunk->used_block_count += count;
+    mpool->total_user_memory_usage += (size_t) count * mpool->block_size;
+}
+
 static inline void
 mpool__mark_block_as_used(MPool *mpool,
                           MPoolChunk *chunk,
@@ -125,8 +414,14 @@ mpool__mark_block_as_used(MPool *mpool,
     mpool__assert_block_fits_in_chunk(mpool, chunk, next_block);
     chunk->next_block = next_block;
 
+    if (!next_block)
+    {
+        /* The chunk is now full */
+        mpool__unlink_avail_chunk(mpool, chunk);
+    }
+
+    mpool__chunk_add_used_blocks(mpool, chunk, 1);
     memclr(block, mpool->block_size);
-    mpool->total_user_memory_usage += mpool->block_size;
 }
 
 static inline void
@@ -134,6 +429,8 @@ mpool__mark_block_as_avail(MPool *mpool,
                            MPoolChunk *chunk,
                            MPoolBlock *block)
 {
+    const bool chunk_was_full = (chunk->next_block == NULL);
+
     {
         *block = (MPoolBlock) {0};
         block->following_blocks_are_all_free = false;
@@ -144,28 +441,53 @@ mpool__mark_block_as_avail(MPool *mpool,
     mpool__assert_block_fits_in_chunk(mpool, chunk, block->next_block);
     chunk->next_block = block;
 
+    if (chunk_was_full)
+    {
+        mpool__link_avail_chunk(mpool, chunk);
+    }
+
     mpool->total_user_memory_usage -= mpool->block_size;
+
+    internal_assert(chunk->used_block_count);
+    if (--chunk->used_block_count == 0)
+    {
+        mpool__release_empty_chunk(mpool, chunk);
+    }
 }
 
 
 static inline void
 mpool__init_chunk(MPoolChunk *chunk)
 {
-    chunk->next_chunk    = NULL;
-    chunk->next_block    = (MPoolBlock*) ((U8*) chunk
-                                          + MPOOL_RESERVED_CHUNK_HEADER_SIZE);
+    chunk->next_chunk       = NULL;
+    chunk->prev_avail_chunk = NULL;
+    chunk->next_avail_chunk = NULL;
+    chunk->used_block_count = 0;
+    chunk->decommitted      = false;
+    chunk->next_block       = (MPoolBlock*) ((U8*) chunk
+                                             + chunk->first_block_offset);
     chunk->next_block->following_blocks_are_all_free = true;
 }
 
 
 static inline MPoolChunk *
-mpool__new_chunk(U32 chunk_size)
+mpool__new_chunk(MPool *mpool)
 {
+    const U32 chunk_size      = mpool->chunk_size;
+    const U32 chunk_alignment = mpool->chunk_alignment;
     assert(IS_PAGE_ALIGNED(chunk_size));
-    MPoolChunk *newchunk = (MPoolChunk*) mem_mmap(chunk_size);
+    assert(IS_POW2(chunk_alignment) && chunk_alignment >= chunk_size);
+    MPoolChunk *newchunk = (MPoolChunk*) (mpool->huge_pages
+                                          ? mem_mmap_huge(chunk_size, chunk_alignment)
+                                          : mem_mmap_aligned(chunk_size, chunk_alignment));
 
     if (newchunk)
     {
+        newchunk->owner = mpool;
+        /* The colour sticks with the chunk for its whole life */
+        newchunk->first_block_offset = mpool->first_block_offset
+            + mpool->next_colour * (U32) CACHE_LINE_SIZE;
+        mpool->next_colour = (mpool->next_colour + 1) % mpool->colour_count;
         mpool__init_chunk(newchunk);
     }
 
@@ -174,21 +496,28 @@ mpool__new_chunk(U32 chunk_size)
 
 
 
+/* The new chunk is chained right after `prev_chunk` and it is
+   made immediately available for allocations */
 static inline MPoolChunk *
 mpool__chain_new_chunk(MPool *mpool,
                        MPoolChunk *prev_chunk)
 {
     U32 chunk_size = mpool->chunk_size;
 
-    MPoolChunk *newchunk = mpool__new_chunk(chunk_size);
+    MPoolChunk *newchunk = mpool__new_chunk(mpool);
     if (newchunk)
     {
         mpool->total_allocator_memory_usage += chunk_size;
-    }
+        /* Empty until the caller allocates from it */
+        mpool->warm_chunk_count++;
 
-    if (prev_chunk)
-    {
-        prev_chunk->next_chunk = newchunk;
+        if (prev_chunk)
+        {
+            newchunk->next_chunk = prev_chunk->next_chunk;
+            prev_chunk->next_chunk = newchunk;
+        }
+
+        mpool__link_avail_chunk(mpool, newchunk);
     }
 
     return newchunk;
@@ -207,6 +536,14 @@ mpool__del_chained_chunk(MPool *mpool,
                          MPoolChunk *prev_chunk,
                          MPoolChunk *chunk_to_be_deleted)
 {
+    if (chunk_to_be_deleted->next_block)
+    {
+        mpool__unlink_avail_chunk(mpool, chunk_to_be_deleted);
+    }
+    if ((chunk_to_be_deleted->used_block_count == 0) && !chunk_to_be_deleted->decommitted)
+    {
+        mpool->warm_chunk_count--;
+    }
     prev_chunk->next_chunk = chunk_to_be_deleted->next_chunk;
     mpool->total_allocator_memory_usage -= mpool->chunk_size;
     mpool__del_chunk(chunk_to_be_deleted, mpool->chunk_size);
@@ -214,8 +551,8 @@ mpool__del_chained_chunk(MPool *mpool,
 
 
 
-void
-mpool_free(MPool *mpool, void *_addr)
+static inline void
+mpool__free(MPool *mpool, void *_addr)
 {
     MPoolChunk *chunk = mpool_get_chunk_from_addr(mpool, _addr);
     assert(chunk);
@@ -236,12 +573,49 @@ mpool_clear(MPool *mpool)
     assert(mpool->first_chunk);
     MPoolChunk *chunk = mpool->first_chunk;
 
+    mpool->first_avail_chunk = NULL;
+    mpool->warm_chunk_count  = 0;
+
     while(chunk)
     {
         MPoolChunk *tmp = chunk->next_chunk;
+        const bool32 was_decommitted = chunk->decommitted;
+        const bool was_empty = (chunk->used_block_count == 0);
         mpool__init_chunk(chunk);
+        chunk->next_chunk = tmp;
+        mpool__link_avail_chunk(mpool, chunk);
+
+        if (was_empty && was_decommitted)
+        {
+            /* Nothing to give back */
+            chunk->decommitted = true;
+        }
+        else
+        {
+            mpool__release_empty_chunk(mpool, chunk);
+        }
         chunk = tmp;
     }
+
+    mpool->total_user_memory_usage = 0;
+}
+
+
+void
+mpool_set_max_warm_chunks(MPool *mpool, U32 max_warm_chunks)
+{
+    mpool->max_warm_chunks = max_warm_chunks;
+
+    for (MPoolChunk *chunk = mpool->first_chunk;
+         chunk && (mpool->warm_chunk_count > max_warm_chunks) && !mpool->huge_pages;
+         chunk = chunk->next_chunk)
+    {
+        if ((chunk->used_block_count == 0) && !chunk->decommitted)
+        {
+            mpool__decommit_chunk(mpool, chunk);
+            mpool->warm_chunk_count--;
+        }
+    }
 }
 
 
@@ -262,8 +636,8 @@ mpool_del(MPool *mpool)
 }
 
 
-void *
-mpool_alloc(MPool *mpool, U16 size)
+static inline void *
+mpool__alloc(MPool *mpool, U16 size)
 {
     assert(mpool->first_chunk);
     if (size > mpool->block_size)
@@ -271,22 +645,15 @@ mpool_alloc(MPool *mpool, U16 size)
         return NULL;
     }
 
-    /* Find the chunk where we can allocate */
-    MPoolChunk *chunk   = mpool->first_chunk;
+    /* Any chunk in the avail chain has at least one free block */
+    MPoolChunk *chunk = mpool->first_avail_chunk;
 
-    while( chunk->next_chunk
-           && (chunk->next_block == NULL))
-    {
-        chunk = chunk->next_chunk;
-    }
-
-    /* Check if we have blocks available in this block, if not try to allocate
-       a new chunk if possible */
-    if (chunk->next_block == NULL)
+    /* All the chunks are full, try to allocate a new chunk if possible */
+    if (!chunk)
     {
         if (mpool->allocate_more_chunks_on_demand)
         {
-            chunk = mpool__chain_new_chunk(mpool, chunk);
+            chunk = mpool__chain_new_chunk(mpool, mpool->first_chunk);
         }
         else
         {
@@ -310,348 +677,1611 @@ mpool_alloc(MPool *mpool, U16 size)
     return result;
 }
 
-bool
-mpool_init_aux(MPool *mpool,
-               U32 chunk_size,
-               U16 block_size,
-               bool8 allocate_more_chunks_on_demand )
-{
-    bool result = true;
-
-    assert(block_size < chunk_size);
-    assert_msg(chunk_size >= (2 * MPOOL_RESERVED_CHUNK_HEADER_SIZE), "Make sure to ask for a reasonable chunk size");
-    assert_msg(block_size >= sizeof(void*), "Make sure to ask for a reasonable block_size");
 
-    chunk_size = (U32) PAGE_ALIGN(chunk_size);
-    block_size = ALIGN(U16, block_size, sizeof(void*));
+#if DPCRT_ALLOCATOR_STATS
+static inline void
+mpool__update_stats_usage(MPool *mpool)
+{
+    alloc_stats__update_usage(&mpool->stats,
+                              mpool->total_user_memory_usage,
+                              mpool->total_allocator_memory_usage,
+                              mpool->total_allocator_memory_usage / mpool->chunk_size);
+}
 
-    *mpool                                = (MPool) {0};
-    mpool->chunk_size                     = chunk_size;
-    mpool->block_size                     = block_size;
-    mpool->allocate_more_chunks_on_demand = allocate_more_chunks_on_demand;
+AllocStats *
+mpool_stats(MPool *mpool)
+{
+    mpool__update_stats_usage(mpool);
+    return &mpool->stats;
+}
+#endif
 
 
-    mpool->first_chunk                    = mpool__new_chunk(chunk_size);
+void *
+mpool_alloc(MPool *mpool, U16 size)
+{
+#if DPCRT_ALLOCATOR_STATS
+    const U64 start = alloc_stats__timestamp();
+    void *result = mpool__alloc(mpool, size);
+    alloc_stats__record_alloc(&mpool->stats, size, result != NULL, start);
+    mpool__update_stats_usage(mpool);
+    return result;
+#else
+    return mpool__alloc(mpool, size);
+#endif
+}
 
-    if (!mpool->first_chunk)
-    {
-        result = false;
-    }
 
-    return result;
+void
+mpool_free(MPool *mpool, void *ptr)
+{
+#if DPCRT_ALLOCATOR_STATS
+    const U64 start = alloc_stats__timestamp();
+    mpool__free(mpool, ptr);
+    alloc_stats__record_free(&mpool->stats, start);
+    mpool__update_stats_usage(mpool);
+#else
+    mpool__free(mpool, ptr);
+#endif
 }
 
-bool
-mpool_init(MPool *mpool, U16 block_size)
+/* Takes up to `count` blocks from the chunk (which must be in the avail chain).
+   Freed blocks are popped one at a time, while the tail of the chunk that
+   was never handed out (`following_blocks_are_all_free`) is carved as a
+   single contiguous run. Returns the number of blocks taken. */
+static U32
+mpool__take_chunk_blocks(MPool *mpool,
+                         MPoolChunk *chunk,
+                         U32 count,
+                         void **out)
 {
-    const bool allocate_more_chunks_on_demand = true;
+    internal_assert(chunk->next_block);
 
-    return mpool_init_aux(mpool,
-                          (U32) KILOBYTES(64),
-                          block_size,
-                          allocate_more_chunks_on_demand);
-}
+    const U32 block_size = mpool->block_size;
+    U8 *const chunk_end = (U8*) chunk + mpool->chunk_size;
+    U32 taken = 0;
 
+    while ((taken < count) && chunk->next_block)
+    {
+        MPoolBlock *block = chunk->next_block;
+        mpool__assert_block_fits_in_chunk(mpool, chunk, block);
 
+        if (block->following_blocks_are_all_free)
+        {
+            const U32 run_len = (U32) ((usize) (chunk_end - (U8*) block) / block_size);
+            const U32 n = MIN(run_len, count - taken);
 
+            for (U32 i = 0; i < n; i++)
+            {
+                out[taken + i] = (U8*) block + (size_t) i * block_size;
+            }
+            memclr(block, (size_t) n * block_size);
 
-/* #############################################################################
-   MFList Implementation
-   #############################################################################
- */
+            MPoolBlock *next_block = NULL;
+            if (n < run_len)
+            {
+                next_block = (MPoolBlock*) ((U8*) block + (size_t) n * block_size);
+                next_block->following_blocks_are_all_free = true;
+            }
+            chunk->next_block = next_block;
+            taken += n;
+        }
+        else
+        {
+            chunk->next_block = block->next_block;
+            memclr(block, block_size);
+            out[taken++] = block;
+        }
+    }
 
+    if (!chunk->next_block)
+    {
+        /* The chunk is now full */
+        mpool__unlink_avail_chunk(mpool, chunk);
+    }
 
-#define MFLIST_RESERVED_CHUNK_HEADER_SIZE ( ALIGN(sizeof(MFListChunk), 128) )
+    if (taken)
+    {
+        mpool__chunk_add_used_blocks(mpool, chunk, taken);
+    }
 
-enum MFListAllocCateg
-{
-    MFListAllocCateg_512  = 0,
-    MFListAllocCateg_4K   = 1,
-    MFListAllocCateg_32K  = 2,
-    MFListAllocCateg_128K = 3,
-    MFListAllocCateg_512K = 4,
-    MFListAllocCateg_More = 5,
+    return taken;
+}
 
-    MFListAllocCateg_Last,
-};
 
-static const U32 s_mflist_categ_sizes[] =
+U32
+mpool_alloc_batch(MPool *mpool, U32 count, void **out)
 {
-    KILOBYTES(16),
-    KILOBYTES(32),
-    KILOBYTES(128),
-    KILOBYTES(1024),
-    KILOBYTES(8192),
+    assert(mpool->first_chunk);
+    U32 result = 0;
 
-    /* Allocations of `MFListChunkSizeIndex_512K` or more size will have a dedicated mmap chunk */
-    0,
-};
+    while (result < count)
+    {
+        MPoolChunk *chunk = mpool->first_avail_chunk;
+        if (!chunk && mpool->allocate_more_chunks_on_demand)
+        {
+            chunk = mpool__chain_new_chunk(mpool, mpool->first_chunk);
+        }
+        if (!chunk)
+        {
+            break;
+        }
 
-static_assert(MFListAllocCateg_Last == ARRAY_LEN(s_mflist_categ_sizes), "");
+        result += mpool__take_chunk_blocks(mpool, chunk, count - result, out + result);
+    }
+
+#if DPCRT_ALLOCATOR_STATS
+    for (U32 i = 0; i < count; i++)
+    {
+        alloc_stats__record_alloc(&mpool->stats, mpool->block_size, i < result, 0);
+    }
+    mpool__update_stats_usage(mpool);
+#endif
 
+    return result;
+}
 
-ATTRIB_CONST static inline MFListBlock *
-mflist__get_first_block_from_chunk(MFListChunk *chunk)
+
+void
+mpool_free_batch(MPool *mpool, U32 count, void **ptrs)
 {
-    MFListBlock *result = ( (MFListBlock *)
-             (  (U8*) chunk + sizeof(MFListChunk))
+    U32 i = 0;
 
-        );
+    while (i < count)
+    {
+        MPoolChunk *chunk = mpool_get_chunk_from_addr(mpool, ptrs[i]);
+        assert(chunk);
+        if (!chunk)
+        {
+            i++;
+            continue;
+        }
 
-    internal_assert( chunk->size > (U8*) result - (U8*) chunk );
+        /* Link together the run of blocks belonging to the same chunk,
+           then splice it in front of the chunk free list at once */
+        MPoolBlock *first = (MPoolBlock*) ptrs[i];
+        MPoolBlock *last  = first;
+        U32 n = 1;
+        first->following_blocks_are_all_free = false;
+
+        for (i = i + 1; i < count; i++, n++)
+        {
+            MPoolBlock *block = (MPoolBlock*) ptrs[i];
+            if (mpool_get_chunk_from_addr(mpool, block) != chunk)
+            {
+                break;
+            }
+            block->following_blocks_are_all_free = false;
+            last->next_block = block;
+            last = block;
+        }
 
-    result = (MFListBlock*) ALIGN(usize, result, sizeof(MFListBlock));
+        const bool chunk_was_full = (chunk->next_block == NULL);
+        last->next_block = chunk->next_block;
+        chunk->next_block = first;
+        if (chunk_was_full)
+        {
+            mpool__link_avail_chunk(mpool, chunk);
+        }
 
-    return result;
+        internal_assert(chunk->used_block_count >= n);
+        chunk->used_block_count -= n;
+        mpool->total_user_memory_usage -= (size_t) n * mpool->block_size;
+        ALLOC_STATS_ONLY(mpool->stats.free_count += n);
+
+        if (chunk->used_block_count == 0)
+        {
+            mpool__release_empty_chunk(mpool, chunk);
+        }
+    }
+
+    ALLOC_STATS_ONLY(mpool__update_stats_usage(mpool));
 }
 
 
-ATTRIB_PURE static inline MFListBlock *
-mflist__next_block(MFListChunk *chunk,
-                   MFListBlock *block)
+static bool
+mpool__init(MPool *mpool,
+            U32 chunk_size,
+            U16 block_size,
+            U16 block_alignment,
+            bool8 allocate_more_chunks_on_demand,
+            bool8 huge_pages,
+            bool8 colour_chunks)
 {
-    MFListBlock *result = (MFListBlock *) (
-        (U8*) block + sizeof(MFListBlock) + block->size
-        );
+    bool result = true;
 
-    if ((U8*) result + sizeof(MFListBlock) < (U8*) chunk + chunk->size)
+    block_alignment = MAX(block_alignment, (U16) sizeof(void*));
+    assert(block_size < chunk_size);
+    assert_msg(IS_POW2(block_alignment) && block_alignment <= G_pal.page_size, "The alignment must be a power of 2 not bigger than a page");
+    assert_msg(block_size >= sizeof(void*), "Make sure to ask for a reasonable block_size");
+
+    /* Every block is aligned as long as the first one and the block size are */
+    const U32 first_block_offset = (U32) ALIGN(size_t, MPOOL_RESERVED_CHUNK_HEADER_SIZE, block_alignment);
+    assert_msg(chunk_size >= (2 * first_block_offset), "Make sure to ask for a reasonable chunk size");
+
+    chunk_size = huge_pages
+        ? (U32) MEM_HUGE_PAGE_ALIGN(chunk_size)
+        : (U32) PAGE_ALIGN(chunk_size);
+    block_size = ALIGN(U16, block_size, block_alignment);
+
+    U32 colour_count = 1;
+    if (colour_chunks)
     {
-        return result;
+        /* Colour with the slack left at the end of the chunk. When it is less
+           than a cache line, give up the last block of the chunk instead */
+        const U32 block_count = (chunk_size - first_block_offset) / block_size;
+        U32 slack = (chunk_size - first_block_offset) % block_size;
+        if ((slack < CACHE_LINE_SIZE) && (block_count > 1))
+        {
+            slack += block_size;
+        }
+        colour_count = MIN(slack / (U32) CACHE_LINE_SIZE + 1, (U32) MPOOL_MAX_CHUNK_COLOURS);
+    }
+
+    *mpool                                = (MPool) {0};
+    mpool->chunk_size                     = chunk_size;
+    mpool->block_size                     = block_size;
+    mpool->allocate_more_chunks_on_demand = allocate_more_chunks_on_demand;
+    mpool->chunk_alignment                = (U32) next_pow2_u64(chunk_size);
+    mpool->huge_pages                     = huge_pages;
+    mpool->max_warm_chunks                = ALLOCATOR_DEFAULT_MAX_WARM_CHUNKS;
+    mpool->first_block_offset             = first_block_offset;
+    mpool->colour_count                   = colour_count;
+
+
+    mpool->first_chunk                    = mpool__new_chunk(mpool);
+
+    if (!mpool->first_chunk)
+    {
+        result = false;
     }
     else
     {
-        return NULL;
+        mpool->total_allocator_memory_usage += chunk_size;
+        mpool->warm_chunk_count = 1;
+        mpool__link_avail_chunk(mpool, mpool->first_chunk);
     }
+
+    return result;
 }
 
+bool
+mpool_init_aux(MPool *mpool,
+               U32 chunk_size,
+               U16 block_size,
+               bool8 allocate_more_chunks_on_demand )
+{
+    return mpool__init(mpool, chunk_size, block_size, 0, allocate_more_chunks_on_demand, false, false);
+}
 
-#define MFLIST__ENABLE_DEBUG_INTEGRITY_CHECKS (1) && __DEBUG
+bool
+mpool_init_aligned(MPool *mpool,
+                   U32 chunk_size,
+                   U16 block_size,
+                   U16 block_alignment,
+                   bool8 allocate_more_chunks_on_demand )
+{
+    return mpool__init(mpool, chunk_size, block_size, block_alignment, allocate_more_chunks_on_demand, false, false);
+}
 
-#if MFLIST__ENABLE_DEBUG_INTEGRITY_CHECKS
-#  define __mflist_assert_integrity(...) __mflist_assert_integrity__(__VA_ARGS__)
-#else
-#  define __mflist_assert_integrity(...)
-#endif
+bool
+mpool_init_cache_aware(MPool *mpool,
+                       U32 chunk_size,
+                       U16 block_size,
+                       bool8 allocate_more_chunks_on_demand )
+{
+    return mpool__init(mpool, chunk_size, block_size, CACHE_LINE_SIZE, allocate_more_chunks_on_demand, false, true);
+}
 
+bool
+mpool_init_huge_pages(MPool *mpool,
+                      U32 chunk_size,
+                      U16 block_size,
+                      bool8 allocate_more_chunks_on_demand )
+{
+    return mpool__init(mpool, chunk_size, block_size, 0, allocate_more_chunks_on_demand, true, false);
+}
 
-#if MFLIST__ENABLE_DEBUG_INTEGRITY_CHECKS
-void
-__mflist_assert_integrity__(MFListChunk *chunk)
+bool
+mpool_init(MPool *mpool, U16 block_size)
 {
-    size_t max_contiguous_block_size_avail = 0;
-    MFListBlock *block = mflist__get_first_block_from_chunk(chunk);
+    const bool allocate_more_chunks_on_demand = true;
 
-    while(block)
+    return mpool_init_aux(mpool,
+                          (U32) KILOBYTES(64),
+                          block_size,
+                          allocate_more_chunks_on_demand);
+}
+
+
+
+
+/* ##########################################################################
+   MPoolShared Implementation
+   ########################################################################## */
+
+
+typedef struct MPoolMagazine
+{
+    /* `id` of the `MPoolShared` owning this magazine, 0 if unused */
+    U32   pool_id;
+    U32   count;
+    void *blocks[MPOOL_SHARED_MAGAZINE_SIZE];
+} MPoolMagazine;
+
+static THREAD_LOCAL_STORAGE MPoolMagazine S_mpool_magazines[MPOOL_SHARED_MAX_POOLS_PER_THREAD];
+
+/* Registry of the live pools. A pool `id` is made of the index of its slot in
+   the registry (low bits) and of the generation of that slot (high bits).
+   An odd generation means that the slot is in use, deleting the pool bumps the
+   generation so that the magazines of every thread still referring to it can
+   tell that the pool is gone and reuse their slot */
+#define MPOOL_SHARED_ID_SLOT_BITS  (bit_scan_forward_u32(MPOOL_SHARED_MAX_LIVE_POOLS))
+#define MPOOL_SHARED_ID_SLOT_MASK  ((U32) MPOOL_SHARED_MAX_LIVE_POOLS - 1)
+static U32 S_mpool_shared_generations[MPOOL_SHARED_MAX_LIVE_POOLS];
+static_assert(IS_POW2(MPOOL_SHARED_MAX_LIVE_POOLS), "MPOOL_SHARED_MAX_LIVE_POOLS must be a power of 2");
+
+
+static U32
+mpool_shared__register_id(void)
+{
+    for (U32 slot = 0; slot < MPOOL_SHARED_MAX_LIVE_POOLS; slot++)
     {
+        U32 generation = atomic_load(&S_mpool_shared_generations[slot]);
+        while (0 == (generation & 1))
+        {
+            if (atomic_compare_exchange(&S_mpool_shared_generations[slot],
+                                        &generation, generation + 1))
+            {
+                return ((generation + 1) << MPOOL_SHARED_ID_SLOT_BITS) | slot;
+            }
+        }
+    }
+    /* Too many live pools */
+    return 0;
+}
 
-        internal_assert(block->parent_chunk == chunk);
-        /* Assert block pointer lives inside the chunk region */
 
-        internal_assert((U8*) block + sizeof (MFListBlock) <=
-                        (U8*) chunk + chunk->size);
+static inline bool
+mpool_shared__is_id_alive(U32 id)
+{
+    const U32 generation = atomic_load(&S_mpool_shared_generations[id & MPOOL_SHARED_ID_SLOT_MASK]);
+    /* Only the low bits of the generation fit in the id */
+    return (generation << MPOOL_SHARED_ID_SLOT_BITS) == (id & ~MPOOL_SHARED_ID_SLOT_MASK);
+}
 
-        /* The block should be at a multiple of the block size (16 bytes for 64 bits) */
-        internal_assert((usize) block % sizeof(MFListBlock) == 0);
 
-        if (block->is_avail && block->size > max_contiguous_block_size_avail)
+static void
+mpool_shared__unregister_id(U32 id)
+{
+    if (id)
+    {
+        U32 *generation = &S_mpool_shared_generations[id & MPOOL_SHARED_ID_SLOT_MASK];
+        internal_assert(mpool_shared__is_id_alive(id));
+        atomic_add_fetch(generation, 1);
+    }
+}
+
+
+static MPoolMagazine *
+mpool_shared__get_thread_magazine(MPoolShared *shared)
+{
+    if (!shared->id)
+    {
+        return NULL;
+    }
+
+    for (U32 i = 0; i < ARRAY_LEN(S_mpool_magazines); i++)
+    {
+        if (S_mpool_magazines[i].pool_id == shared->id)
         {
-            max_contiguous_block_size_avail = block->size;
+            return &S_mpool_magazines[i];
         }
+    }
 
-        MFListBlock *temp = block;
-        (void) temp;
-        block = mflist__next_block(chunk, block);
+    for (U32 i = 0; i < ARRAY_LEN(S_mpool_magazines); i++)
+    {
+        MPoolMagazine *magazine = &S_mpool_magazines[i];
+        if (magazine->pool_id && !mpool_shared__is_id_alive(magazine->pool_id))
+        {
+            /* The blocks cached went away together with the depot
+               of the deleted pool, there's nothing to give back */
+            magazine->count   = 0;
+            magazine->pool_id = 0;
+        }
 
-        /* Assert the block is pointing */
-        if (block)
+        if (magazine->count == 0)
         {
-            internal_assert(block->prev_block == temp);
+            /* A magazine not caching any block can be
+               safely reassigned to another pool */
+            magazine->pool_id = shared->id;
+            return magazine;
         }
     }
 
-    internal_assert(max_contiguous_block_size_avail == chunk->max_contiguous_block_size_avail);
+    return NULL;
 }
-#endif
 
-ATTRIB_PURE MFListBlock *
-mflist__get_block_from_user_addr(void *_addr)
+
+static void
+mpool_shared__refill_magazine(MPoolShared *shared,
+                              MPoolMagazine *magazine)
 {
-    MFListBlock *result = (MFListBlock *)
-        ( (U8*)_addr - sizeof(MFListBlock));
-    internal_assert(result == container_of(MFListBlock, _addr, payload));
-    return result;
+    internal_assert(magazine->count == 0);
+
+    spinlock_lock(&shared->depot_lock);
+    while (magazine->count < MPOOL_SHARED_MAGAZINE_SIZE / 2)
+    {
+        void *block = mpool_alloc(&shared->depot, shared->depot.block_size);
+        if (!block)
+        {
+            break;
+        }
+        magazine->blocks[magazine->count++] = block;
+    }
+    spinlock_unlock(&shared->depot_lock);
 }
 
 
+static void
+mpool_shared__drain_magazine(MPoolShared *shared,
+                             MPoolMagazine *magazine,
+                             U32 num_blocks_to_keep)
+{
+    spinlock_lock(&shared->depot_lock);
+    while (magazine->count > num_blocks_to_keep)
+    {
+        mpool_free(&shared->depot, magazine->blocks[--magazine->count]);
+    }
+    spinlock_unlock(&shared->depot_lock);
+}
 
 
-#if 0
-ATTRIB_PURE static MFListUserAddrLocation
-mflist__find_user_addr_location(MFList *mflist,
-                                void *_addr)
+bool
+mpool_shared_init_aux(MPoolShared *shared,
+                      U32 chunk_size,
+                      U16 block_size)
 {
-    MFListUserAddrLocation result = { 0 };
-    U8 *addr = _addr;
+    const bool allocate_more_chunks_on_demand = true;
 
-    /* Find The chunk first */
-    for (enum MFListAllocCateg categ = 0;
-         categ < ARRAY_LEN(mflist->chunks);
-         categ ++ )
+    memclr(shared, sizeof(*shared));
+    shared->id = mpool_shared__register_id();
+
+    return mpool_init_aux(&shared->depot,
+                          chunk_size,
+                          block_size,
+                          allocate_more_chunks_on_demand);
+}
+
+
+bool
+mpool_shared_init(MPoolShared *shared, U16 block_size)
+{
+    return mpool_shared_init_aux(shared, (U32) KILOBYTES(64), block_size);
+}
+
+
+void *
+mpool_shared_alloc(MPoolShared *shared, U16 size)
+{
+    if (size > shared->depot.block_size)
     {
-        MFListChunk *prev_chunk = NULL;
-        MFListChunk *chunk = mflist->chunks[categ];
+        return NULL;
+    }
+
+    void *result = NULL;
+    MPoolMagazine *magazine = mpool_shared__get_thread_magazine(shared);
+
+    if (!magazine)
+    {
+        /* This thread is caching blocks for too many pools, fallback
+           to the depot */
+        spinlock_lock(&shared->depot_lock);
+        result = mpool_alloc(&shared->depot, size);
+        spinlock_unlock(&shared->depot_lock);
+        return result;
+    }
+
+    if (magazine->count == 0)
+    {
+        mpool_shared__refill_magazine(shared, magazine);
+    }
+
+    if (magazine->count)
+    {
+        result = magazine->blocks[--magazine->count];
+        /* Keep the same semantics of `mpool_alloc`: blocks are handed out cleared */
+        memclr(result, shared->depot.block_size);
+    }
+
+    return result;
+}
+
+
+void
+mpool_shared_free(MPoolShared *shared, void *ptr)
+{
+    assert(ptr);
+    MPoolMagazine *magazine = mpool_shared__get_thread_magazine(shared);
+
+    if (!magazine)
+    {
+        spinlock_lock(&shared->depot_lock);
+        mpool_free(&shared->depot, ptr);
+        spinlock_unlock(&shared->depot_lock);
+        return;
+    }
+
+    if (magazine->count == MPOOL_SHARED_MAGAZINE_SIZE)
+    {
+        mpool_shared__drain_magazine(shared, magazine, MPOOL_SHARED_MAGAZINE_SIZE / 2);
+    }
+
+    magazine->blocks[magazine->count++] = ptr;
+}
+
+
+void
+mpool_shared_flush_thread_cache(MPoolShared *shared)
+{
+    for (U32 i = 0; i < ARRAY_LEN(S_mpool_magazines); i++)
+    {
+        MPoolMagazine *magazine = &S_mpool_magazines[i];
+        if (magazine->pool_id == shared->id)
+        {
+            mpool_shared__drain_magazine(shared, magazine, 0);
+            magazine->pool_id = 0;
+            break;
+        }
+    }
+}
+
+
+void
+mpool_shared_del(MPoolShared *shared)
+{
+    /* Only the magazine of the calling thread can be flushed here.
+       Magazines of other threads still referring to this pool are
+       reclaimed by those threads, as soon as they find out that the
+       pool `id` is not alive anymore */
+    mpool_shared_flush_thread_cache(shared);
+    mpool_shared__unregister_id(shared->id);
+    mpool_del(&shared->depot);
+    memclr(shared, sizeof(*shared));
+}
+
+
+
+
+/* ##########################################################################
+   MSlab Implementation
+   ########################################################################## */
+
+#define MSLAB_NULL_SLOT U32_MAX
+
+
+/* Flips the slot between used (odd) and free (even). The generations wrap
+   around preserving their parity, `MSLAB_HANDLE_GENERATION_MASK + 1` is even */
+static inline U32
+mslab__next_generation(U32 generation)
+{
+    return (generation + 1) & MSLAB_HANDLE_GENERATION_MASK;
+}
+
+
+/* Commits the 3 arrays so that they can hold at least `needed_count` elements.
+   They are all grown together since `slot_count >= count` */
+static bool
+mslab__commit(MSlab *slab, U32 needed_count)
+{
+    if (needed_count <= slab->committed_count)
+    {
+        return true;
+    }
+
+    const U32 min_growth = (U32) MAX(G_pal.page_size / sizeof(MSlabSlot), 64);
+    U64 new_count = MAX((U64) slab->committed_count * 2, (U64) needed_count);
+    new_count = MAX(new_count, (U64) min_growth);
+    new_count = MIN(new_count, (U64) slab->max_objects);
+
+    const U32 old_count = slab->committed_count;
+
+    if (!mem_realloc(ReallocStrategy_CommitAddrSpace, slab->objects,
+                     (size_t) old_count * slab->object_size,
+                     (size_t) new_count * slab->object_size, G_pal.page_size)
+        || !mem_realloc(ReallocStrategy_CommitAddrSpace, slab->object_slots,
+                        (size_t) old_count * sizeof(U32),
+                        (size_t) new_count * sizeof(U32), G_pal.page_size)
+        || !mem_realloc(ReallocStrategy_CommitAddrSpace, slab->slots,
+                        (size_t) old_count * sizeof(MSlabSlot),
+                        (size_t) new_count * sizeof(MSlabSlot), G_pal.page_size))
+    {
+        return false;
+    }
+
+    slab->committed_count = (U32) new_count;
+    return true;
+}
+
+
+bool
+mslab_init(MSlab *slab, U32 object_size, U32 max_objects)
+{
+    assert(object_size);
+    assert_msg(max_objects && max_objects <= MSLAB_MAX_OBJECTS, "The handles cannot address that many objects");
+
+    *slab = (MSlab) {0};
+    max_objects = MIN(max_objects, MSLAB_MAX_OBJECTS);
+
+    slab->object_size     = object_size;
+    slab->max_objects     = max_objects;
+    slab->first_free_slot = MSLAB_NULL_SLOT;
+
+    /* Nothing is committed until the first allocation */
+    slab->objects      = mem_alloc(AllocStrategy_ReserveAddrSpace, (size_t) max_objects * object_size, G_pal.page_size);
+    slab->object_slots = mem_alloc(AllocStrategy_ReserveAddrSpace, (size_t) max_objects * sizeof(U32), G_pal.page_size);
+    slab->slots        = mem_alloc(AllocStrategy_ReserveAddrSpace, (size_t) max_objects * sizeof(MSlabSlot), G_pal.page_size);
+
+    if (!slab->objects || !slab->object_slots || !slab->slots)
+    {
+        mslab_del(slab);
+        return false;
+    }
+
+    return true;
+}
+
+
+void
+mslab_del(MSlab *slab)
+{
+    if (slab->objects)
+    {
+        mem_dealloc(DeallocStrategy_ReleaseAddrSpace, slab->objects,
+                    PAGE_ALIGN((size_t) slab->max_objects * slab->object_size));
+    }
+    if (slab->object_slots)
+    {
+        mem_dealloc(DeallocStrategy_ReleaseAddrSpace, slab->object_slots,
+                    PAGE_ALIGN((size_t) slab->max_objects * sizeof(U32)));
+    }
+    if (slab->slots)
+    {
+        mem_dealloc(DeallocStrategy_ReleaseAddrSpace, slab->slots,
+                    PAGE_ALIGN((size_t) slab->max_objects * sizeof(MSlabSlot)));
+    }
+
+    memclr(slab, sizeof(*slab));
+}
+
+
+MSlabHandle
+mslab_alloc(MSlab *slab)
+{
+    if (slab->count >= slab->max_objects)
+    {
+        return 0;
+    }
+
+    U32 slot_index = slab->first_free_slot;
+
+    if (slot_index == MSLAB_NULL_SLOT)
+    {
+        if (!mslab__commit(slab, slab->slot_count + 1))
+        {
+            return 0;
+        }
+        slot_index = slab->slot_count++;
+        slab->slots[slot_index].generation = 1;
+    }
+    else
+    {
+        slab->first_free_slot = slab->slots[slot_index].index;
+        slab->slots[slot_index].generation = mslab__next_generation(slab->slots[slot_index].generation);
+    }
+    internal_assert(slab->slots[slot_index].generation & 1);
+
+    const U32 index = slab->count++;
+    MSlabSlot *slot = &slab->slots[slot_index];
+    slot->index = index;
+    slab->object_slots[index] = slot_index;
+
+    memclr(slab->objects + (size_t) index * slab->object_size, slab->object_size);
+
+    return (slot->generation << MSLAB_HANDLE_INDEX_BITS) | slot_index;
+}
+
+
+void
+mslab_free(MSlab *slab, MSlabHandle handle)
+{
+    void *object = mslab_get(slab, handle);
+    assert_msg(object, "Stale or invalid handle. Possible double free");
+    if (!object)
+    {
+        return;
+    }
+
+    const U32 slot_index = handle & MSLAB_HANDLE_INDEX_MASK;
+    MSlabSlot *slot = &slab->slots[slot_index];
+    const U32 index = slot->index;
+    const U32 last  = --slab->count;
+
+    if (index != last)
+    {
+        /* Keep the objects densely packed: move the last one in the hole */
+        memcpy(object, slab->objects + (size_t) last * slab->object_size, slab->object_size);
+        const U32 moved_slot_index = slab->object_slots[last];
+        slab->object_slots[index] = moved_slot_index;
+        slab->slots[moved_slot_index].index = index;
+    }
+
+    slot->generation      = mslab__next_generation(slot->generation);
+    slot->index           = slab->first_free_slot;
+    slab->first_free_slot = slot_index;
+}
+
+
+void
+mslab_clear(MSlab *slab)
+{
+    for (U32 i = 0; i < slab->count; i++)
+    {
+        const U32 slot_index = slab->object_slots[i];
+        MSlabSlot *slot = &slab->slots[slot_index];
+        slot->generation      = mslab__next_generation(slot->generation);
+        slot->index           = slab->first_free_slot;
+        slab->first_free_slot = slot_index;
+    }
+    slab->count = 0;
+}
+
+
+
+
+/* #############################################################################
+   MFList Implementation
+   #############################################################################
+ */
+
+
+#define MFLIST_RESERVED_CHUNK_HEADER_SIZE ( ALIGN(sizeof(MFListChunk), 128) )
+
+enum MFListAllocCateg
+{
+    MFListAllocCateg_512  = 0,
+    MFListAllocCateg_4K   = 1,
+    MFListAllocCateg_32K  = 2,
+    MFListAllocCateg_128K = 3,
+    MFListAllocCateg_512K = 4,
+    MFListAllocCateg_More = 5,
+
+    MFListAllocCateg_Last,
+};
+
+static const U32 s_mflist_categ_sizes[] =
+{
+    KILOBYTES(16),
+    KILOBYTES(32),
+    KILOBYTES(128),
+    KILOBYTES(1024),
+    KILOBYTES(8192),
+
+    /* Allocations of `MFListChunkSizeIndex_512K` or more size will have a dedicated mmap chunk */
+    0,
+};
+
+static_assert(MFListAllocCateg_Last == ARRAY_LEN(s_mflist_categ_sizes), "");
+
+
+ATTRIB_CONST static inline MFListBlock *
+mflist__get_first_block_from_chunk(MFListChunk *chunk)
+{
+    /* The offset of the first block must not depend on the address of the chunk:
+       a chunk moved by `mremap` keeps its layout */
+    MFListBlock *result = ( (MFListBlock *)
+             (  (U8*) chunk + ALIGN(usize, sizeof(MFListChunk), sizeof(MFListBlock)))
+
+        );
+
+    internal_assert( chunk->size > (U8*) result - (U8*) chunk );
+
+    return result;
+}
+
+
+ATTRIB_PURE static inline MFListBlock *
+mflist__next_block(MFListChunk *chunk,
+                   MFListBlock *block)
+{
+    MFListBlock *result = (MFListBlock *) (
+        (U8*) block + sizeof(MFListBlock) + block->size
+        );
+
+    if ((U8*) result + sizeof(MFListBlock) < (U8*) chunk + chunk->size)
+    {
+        return result;
+    }
+    else
+    {
+        return NULL;
+    }
+}
+
+
+#define MFLIST__ENABLE_DEBUG_INTEGRITY_CHECKS (1) && __DEBUG
+
+#if MFLIST__ENABLE_DEBUG_INTEGRITY_CHECKS
+#  define __mflist_assert_integrity(...) __mflist_assert_integrity__(__VA_ARGS__)
+#else
+#  define __mflist_assert_integrity(...)
+#endif
+
+
+#if MFLIST__ENABLE_DEBUG_INTEGRITY_CHECKS
+void
+__mflist_assert_integrity__(MFListChunk *chunk)
+{
+    size_t max_contiguous_block_size_avail = 0;
+    MFListBlock *block = mflist__get_first_block_from_chunk(chunk);
+
+    while(block)
+    {
+
+        internal_assert(block->parent_chunk == chunk);
+        /* Assert block pointer lives inside the chunk region */
+
+        internal_assert((U8*) block + sizeof (MFListBlock) <=
+                        (U8*) chunk + chunk->size);
+
+        /* The block should be at a multiple of the block size from the start of the chunk */
+        internal_assert((usize) ((U8*) block - (U8*) chunk) % sizeof(MFListBlock) == 0);
+
+        if (block->is_avail && block->size > max_contiguous_block_size_avail)
+        {
+            max_contiguous_block_size_avail = block->size;
+        }
+
+        MFListBlock *temp = block;
+        (void) temp;
+        block = mflist__next_block(chunk, block);
+
+        /* Assert the block is pointing */
+        if (block)
+        {
+            internal_assert(block->prev_block == temp);
+
+            /* Segregated chunks always coalesce adjacent free blocks */
+            internal_assert(!chunk->segregated || !(block->is_avail && temp->is_avail));
+        }
+    }
+
+    if (!chunk->segregated)
+    {
+        internal_assert(max_contiguous_block_size_avail == chunk->max_contiguous_block_size_avail);
+    }
+}
+#endif
+
+ATTRIB_PURE MFListBlock *
+mflist__get_block_from_user_addr(void *_addr)
+{
+    MFListBlock *result = (MFListBlock *)
+        ( (U8*)_addr - sizeof(MFListBlock));
+    internal_assert(result == container_of(MFListBlock, _addr, payload));
+    return result;
+}
+
+
+
+
+#if 0
+ATTRIB_PURE static MFListUserAddrLocation
+mflist__find_user_addr_location(MFList *mflist,
+                                void *_addr)
+{
+    MFListUserAddrLocation result = { 0 };
+    U8 *addr = _addr;
+
+    /* Find The chunk first */
+    for (enum MFListAllocCateg categ = 0;
+         categ < ARRAY_LEN(mflist->chunks);
+         categ ++ )
+    {
+        MFListChunk *prev_chunk = NULL;
+        MFListChunk *chunk = mflist->chunks[categ];
+
+        while(chunk)
+        {
+            __mflist_assert_integrity(chunk);
+
+
+            if ((addr > ((U8*) chunk)) && (addr < (((U8*) chunk) + chunk->size)))
+            {
+                result.categ = categ;
+                result.prev_chunk = prev_chunk;
+                result.chunk = chunk;
+                goto end_chunk_search;
+            }
+
+            prev_chunk = chunk;
+            chunk = chunk->next_chunk;
+        }
+    }
+
+end_chunk_search: { }
+
+    /* Determine the correct block from the chunk */
+    if (result.chunk)
+    {
+        MFListChunk *chunk = result.chunk;
+
+        for (MFListBlock *block = mflist__get_first_block_from_chunk(result.chunk);
+             block;
+             block = mflist__next_block(chunk, block))
+        {
+            if ((U8*) block == (addr - sizeof(MFListBlock)))
+            {
+                result.block = block;
+                break;
+            }
+        }
+    }
+
+
+    return result;
+}
+
+#endif
+
+
+static inline void
+mflist__init_chunk(MFListChunk *chunk, U32 chunk_size, enum MFListAllocCateg categ)
+{
+    chunk->prev_chunk = NULL;
+    chunk->next_chunk = NULL;
+    chunk->size = chunk_size;
+    chunk->categ = categ;
+    chunk->segregated = false;
+    chunk->empty = false;
+    chunk->decommitted = false;
+
+    MFListBlock *first_block = mflist__get_first_block_from_chunk(chunk);
+    {
+        *first_block = (MFListBlock) {0};
+        first_block->parent_chunk = chunk;
+        first_block->prev_block = NULL;
+        first_block->is_avail = true;
+        /* The first block may not immediately follow the chunk header due to alignment */
+        first_block->size = (U32) (((U8*) chunk + chunk->size) - ((U8*) first_block + sizeof(MFListBlock)));
+    }
+
+    chunk->max_contiguous_block_size_avail = first_block->size;
+}
+
+static inline MFListChunk *
+mflist__new_chunk(U32 chunk_size, enum MFListAllocCateg categ, bool huge_pages)
+{
+    assert(IS_PAGE_ALIGNED(chunk_size));
+    assert(!huge_pages || chunk_size == MEM_HUGE_PAGE_ALIGN(chunk_size));
+    MFListChunk *newchunk = (MFListChunk*) (huge_pages
+                                            ? mem_mmap_huge(chunk_size, MEM_HUGE_PAGE_SIZE)
+                                            : mem_mmap(chunk_size));
+
+    if (newchunk)
+    {
+        mflist__init_chunk(newchunk, chunk_size, categ);
+    }
+
+    return newchunk;
+}
+
+
+
+static inline MFListChunk *
+mflist__chain_new_chunk(MFList *mflist,
+                        MFListChunk *prev_chunk,
+                        U32 chunk_size,
+                        enum MFListAllocCateg categ)
+{
+    if (mflist->huge_pages)
+    {
+        /* The chunk (and thus its first block) simply gets bigger */
+        chunk_size = (U32) MIN(MEM_HUGE_PAGE_ALIGN(chunk_size), U32_MAX & ~(MEM_HUGE_PAGE_SIZE - 1));
+    }
+    MFListChunk *newchunk = mflist__new_chunk(chunk_size, categ, mflist->huge_pages);
+
+    if (newchunk)
+    {
+        newchunk->prev_chunk = prev_chunk;
+        mflist->total_allocator_memory_usage += chunk_size;
+        ALLOC_STATS_ONLY(mflist->stats.chunk_count++);
+    }
+
+    if (prev_chunk)
+    {
+        prev_chunk->next_chunk = newchunk;
+    }
+
+    return newchunk;
+}
+
+
+static inline void
+mflist__del_chunk(MFListChunk *chunk_to_be_deleted)
+{
+    mem_unmap(chunk_to_be_deleted, chunk_to_be_deleted->size);
+}
+
+
+static inline void
+mflist__del_chained_chunk(MFList *mflist,
+                          MFListChunk *chunk_to_be_deleted)
+{
+    MFListChunk *const prev_chunk = chunk_to_be_deleted->prev_chunk;
+    const enum MFListAllocCateg categ = chunk_to_be_deleted->categ;
+
+    if (prev_chunk)
+    {
+        prev_chunk->next_chunk = chunk_to_be_deleted->next_chunk;
+    }
+    else
+    {
+        internal_assert(categ >= 0 && categ < MFListAllocCateg_Last);
+        mflist->chunks[categ] = chunk_to_be_deleted->next_chunk;
+    }
+    if (chunk_to_be_deleted->next_chunk)
+    {
+        chunk_to_be_deleted->next_chunk->prev_chunk = prev_chunk;
+    }
+    if (chunk_to_be_deleted->empty && !chunk_to_be_deleted->decommitted)
+    {
+        mflist->warm_chunk_count--;
+    }
+    mflist->total_allocator_memory_usage -= chunk_to_be_deleted->size;
+    ALLOC_STATS_ONLY(mflist->stats.chunk_count--);
+    mflist__del_chunk(chunk_to_be_deleted);
+}
+
+
+
+
+ATTRIB_PURE static inline bool
+mflist__is_chunk_empty(MFListChunk *chunk)
+{
+    bool result = false;
+
+    MFListBlock *first_block = mflist__get_first_block_from_chunk(chunk);
+    MFListBlock *next_block = mflist__next_block(chunk, first_block);
+
+    if (first_block && first_block->is_avail && !next_block)
+    {
+        result = true;
+        internal_assert((U8*) first_block->payload + first_block->size == (U8*) chunk + chunk->size);
+    }
+
+    return result;
+}
+
+
+static inline U32
+mflist__max_warm_chunks(MFList *mflist)
+{
+    return mflist->warm_chunks_limit
+        ? mflist->warm_chunks_limit - 1
+        : ALLOCATOR_DEFAULT_MAX_WARM_CHUNKS;
+}
+
+/* Gives back to the OS the pages of an empty chunk. Only the chunk header
+   and the header of its free block (with the free list links of the
+   segregated mode) must survive, they all live in the first page. */
+static void
+mflist__decommit_chunk(MFListChunk *chunk)
+{
+    internal_assert(chunk->empty && !chunk->decommitted);
+
+    MFListBlock *first_block = mflist__get_first_block_from_chunk(chunk);
+    U8 *start = (U8*) PAGE_ALIGN((usize) first_block->payload + 2 * sizeof(void*));
+    U8 *end   = (U8*) chunk + chunk->size;
+    if (start < end)
+    {
+        pal_uncommit_addr_space(start, (size_t) (end - start));
+    }
+    chunk->decommitted = true;
+}
+
+/* Applies the warm chunks policy to a chunk that just became empty */
+static void
+mflist__release_empty_chunk(MFList *mflist,
+                            MFListChunk *chunk)
+{
+    internal_assert(chunk->categ != MFListAllocCateg_More);
+    internal_assert(mflist__is_chunk_empty(chunk));
+
+    chunk->empty = true;
+    if ((mflist->warm_chunk_count < mflist__max_warm_chunks(mflist)) || mflist->huge_pages)
+    {
+        mflist->warm_chunk_count++;
+    }
+    else
+    {
+        mflist__decommit_chunk(chunk);
+    }
+}
+
+/* Must be called before handing out a block of a chunk which may be empty */
+static inline void
+mflist__mark_chunk_as_used(MFList *mflist,
+                           MFListChunk *chunk)
+{
+    if (chunk->empty)
+    {
+        chunk->empty = false;
+        if (chunk->decommitted)
+        {
+            /* Decommitted pages are refilled (zeroed) by the OS on first touch */
+            chunk->decommitted = false;
+        }
+        else
+        {
+            internal_assert(mflist->warm_chunk_count);
+            mflist->warm_chunk_count--;
+        }
+    }
+}
+
+
+void
+mflist_set_max_warm_chunks(MFList *mflist, U32 max_warm_chunks)
+{
+    mflist->warm_chunks_limit = (max_warm_chunks == U32_MAX) ? U32_MAX : max_warm_chunks + 1;
+    max_warm_chunks = mflist__max_warm_chunks(mflist);
+
+    for (enum MFListAllocCateg categ = 0; categ < ARRAY_LEN(mflist->chunks); categ ++ )
+    {
+        for (MFListChunk *chunk = mflist->chunks[categ];
+             chunk && (mflist->warm_chunk_count > max_warm_chunks) && !mflist->huge_pages;
+             chunk = chunk->next_chunk)
+        {
+            if (chunk->empty && !chunk->decommitted)
+            {
+                mflist__decommit_chunk(chunk);
+                mflist->warm_chunk_count--;
+            }
+        }
+    }
+
+    for (MFListCompactChunk *chunk = mflist->compact_empty_chunks;
+         chunk && (mflist->compact_warm_chunk_count > max_warm_chunks);
+         chunk = chunk->next_chunk)
+    {
+        if (!chunk->decommitted)
+        {
+            pal_uncommit_addr_space((U8*) chunk + G_pal.page_size,
+                                    MFLIST_COMPACT_CHUNK_SIZE - G_pal.page_size);
+            chunk->decommitted = true;
+            mflist->compact_warm_chunk_count--;
+        }
+    }
+}
+
+
+/* #############################################################################
+   MFList Compact mode (header-free small blocks)
+   ############################################################################# */
+
+#define MFLIST_COMPACT_FIRST_BLOCK_OFFSET ((U32) ALIGN(size_t, sizeof(MFListCompactChunk), 64))
+
+static_assert(IS_POW2(MFLIST_COMPACT_CHUNK_SIZE), "Compact chunks are found by masking");
+
+
+static inline bool
+mflist__is_compact_addr(MFList *mflist, void *addr)
+{
+    return ((U8*) addr >= mflist->compact_region)
+        && ((U8*) addr < mflist->compact_region + mflist->compact_region_used);
+}
+
+static inline MFListCompactChunk *
+mflist__compact_chunk_from_addr(void *addr)
+{
+    return (MFListCompactChunk *) ((usize) addr & ~((usize) MFLIST_COMPACT_CHUNK_SIZE - 1));
+}
+
+static void
+mflist__compact_init_chunk(MFListCompactChunk *chunk, U32 block_size)
+{
+    chunk->prev_chunk       = NULL;
+    chunk->next_chunk       = NULL;
+    chunk->block_size       = block_size;
+    chunk->block_count      = (MFLIST_COMPACT_CHUNK_SIZE - MFLIST_COMPACT_FIRST_BLOCK_OFFSET) / block_size;
+    chunk->used_block_count = 0;
+    chunk->first_free_word  = 0;
+    chunk->decommitted      = false;
+    memclr(chunk->used_bitmap, sizeof(chunk->used_bitmap));
+
+    /* The bits past the last block are marked as used so that they are never handed out */
+    for (U32 i = chunk->block_count; i < MFLIST_COMPACT_BITMAP_WORDS * 64; i++)
+    {
+        chunk->used_bitmap[i / 64] |= (U64) 1 << (i % 64);
+    }
+}
+
+static inline void
+mflist__compact_link_chunk(MFList *mflist, MFListCompactChunk *chunk)
+{
+    MFListCompactChunk **head = &mflist->compact_chunks[chunk->block_size / MFLIST_COMPACT_GRANULARITY - 1];
+    chunk->prev_chunk = NULL;
+    chunk->next_chunk = *head;
+    if (*head)
+    {
+        (*head)->prev_chunk = chunk;
+    }
+    *head = chunk;
+}
+
+static inline void
+mflist__compact_unlink_chunk(MFList *mflist, MFListCompactChunk *chunk)
+{
+    MFListCompactChunk **head = &mflist->compact_chunks[chunk->block_size / MFLIST_COMPACT_GRANULARITY - 1];
+    if (chunk->prev_chunk)
+    {
+        chunk->prev_chunk->next_chunk = chunk->next_chunk;
+    }
+    else
+    {
+        internal_assert(*head == chunk);
+        *head = chunk->next_chunk;
+    }
+    if (chunk->next_chunk)
+    {
+        chunk->next_chunk->prev_chunk = chunk->prev_chunk;
+    }
+    chunk->prev_chunk = NULL;
+    chunk->next_chunk = NULL;
+}
+
+/* Same warm chunks policy of the regular chunks, the bitmap
+   lives in the first page which is never given back */
+static void
+mflist__compact_release_empty_chunk(MFList *mflist, MFListCompactChunk *chunk)
+{
+    internal_assert(chunk->used_block_count == 0);
+
+    chunk->next_chunk = mflist->compact_empty_chunks;
+    chunk->prev_chunk = NULL;
+    mflist->compact_empty_chunks = chunk;
+
+    if (mflist->compact_warm_chunk_count < mflist__max_warm_chunks(mflist))
+    {
+        mflist->compact_warm_chunk_count++;
+    }
+    else
+    {
+        pal_uncommit_addr_space((U8*) chunk + G_pal.page_size,
+                                MFLIST_COMPACT_CHUNK_SIZE - G_pal.page_size);
+        chunk->decommitted = true;
+    }
+}
+
+static MFListCompactChunk *
+mflist__compact_get_chunk(MFList *mflist, U32 block_size)
+{
+    MFListCompactChunk *chunk = mflist->compact_chunks[block_size / MFLIST_COMPACT_GRANULARITY - 1];
+    if (chunk)
+    {
+        return chunk;
+    }
+
+    chunk = mflist->compact_empty_chunks;
+    if (chunk)
+    {
+        mflist->compact_empty_chunks = chunk->next_chunk;
+        if (!chunk->decommitted)
+        {
+            internal_assert(mflist->compact_warm_chunk_count);
+            mflist->compact_warm_chunk_count--;
+        }
+    }
+    else
+    {
+        if (!mflist->compact_region)
+        {
+            mflist->compact_region = mem_alloc(AllocStrategy_ReserveAddrSpace,
+                                               MFLIST_COMPACT_REGION_SIZE,
+                                               MFLIST_COMPACT_CHUNK_SIZE);
+        }
+        if (!mflist->compact_region
+            || ((size_t) mflist->compact_region_used + MFLIST_COMPACT_CHUNK_SIZE > MFLIST_COMPACT_REGION_SIZE))
+        {
+            return NULL;
+        }
+
+        chunk = (MFListCompactChunk *) (mflist->compact_region + mflist->compact_region_used);
+        if (!pal_commit_addr_space(chunk, MFLIST_COMPACT_CHUNK_SIZE, PAGE_PROT_READ | PAGE_PROT_WRITE))
+        {
+            return NULL;
+        }
+        mflist->compact_region_used += MFLIST_COMPACT_CHUNK_SIZE;
+        mflist->total_allocator_memory_usage += MFLIST_COMPACT_CHUNK_SIZE;
+        ALLOC_STATS_ONLY(mflist->stats.chunk_count++);
+    }
+
+    /* An empty chunk can be reused for any size class */
+    mflist__compact_init_chunk(chunk, block_size);
+    mflist__compact_link_chunk(mflist, chunk);
+    return chunk;
+}
+
+static void *
+mflist__compact_alloc(MFList *mflist, U32 alloc_size, bool zero_initialize)
+{
+    internal_assert(alloc_size && alloc_size <= MFLIST_COMPACT_MAX_SIZE);
+    const U32 block_size = ALIGN(U32, alloc_size, MFLIST_COMPACT_GRANULARITY);
+
+    MFListCompactChunk *chunk = mflist__compact_get_chunk(mflist, block_size);
+    if (!chunk)
+    {
+        return NULL;
+    }
+
+    U32 word = chunk->first_free_word;
+    while (chunk->used_bitmap[word] == ~(U64) 0)
+    {
+        word++;
+        internal_assert(word < MFLIST_COMPACT_BITMAP_WORDS);
+    }
+    const U32 bit = (U32) __builtin_ctzll(~chunk->used_bitmap[word]);
+    chunk->used_bitmap[word] |= (U64) 1 << bit;
+    chunk->first_free_word = word;
+
+    const U32 block_index = word * 64 + bit;
+    internal_assert(block_index < chunk->block_count);
+
+    if (++chunk->used_block_count == chunk->block_count)
+    {
+        /* The chunk is now full */
+        mflist__compact_unlink_chunk(mflist, chunk);
+    }
+    mflist->total_user_memory_usage += block_size;
+
+    U8 *result = (U8*) chunk + MFLIST_COMPACT_FIRST_BLOCK_OFFSET + (size_t) block_index * block_size;
+    if (zero_initialize)
+    {
+        memclr(result, block_size);
+    }
+    return result;
+}
 
-        while(chunk)
-        {
-            __mflist_assert_integrity(chunk);
+static void
+mflist__compact_free(MFList *mflist, void *addr)
+{
+    MFListCompactChunk *chunk = mflist__compact_chunk_from_addr(addr);
+    const U32 offset = (U32) ((U8*) addr - (U8*) chunk) - MFLIST_COMPACT_FIRST_BLOCK_OFFSET;
+    const U32 block_index = offset / chunk->block_size;
+    const U32 word = block_index / 64;
+    const U64 mask = (U64) 1 << (block_index % 64);
 
+    assert_msg((offset % chunk->block_size) == 0, "The address does not point to the start of a block");
+    assert_msg(chunk->used_bitmap[word] & mask, "Double free, or the address does not belong to this MFList");
 
-            if ((addr > ((U8*) chunk)) && (addr < (((U8*) chunk) + chunk->size)))
-            {
-                result.categ = categ;
-                result.prev_chunk = prev_chunk;
-                result.chunk = chunk;
-                goto end_chunk_search;
-            }
+    const bool chunk_was_full = (chunk->used_block_count == chunk->block_count);
+    chunk->used_bitmap[word] &= ~mask;
+    chunk->first_free_word = MIN(chunk->first_free_word, word);
+    chunk->used_block_count--;
+    mflist->total_user_memory_usage -= chunk->block_size;
 
-            prev_chunk = chunk;
-            chunk = chunk->next_chunk;
+    if (chunk->used_block_count == 0)
+    {
+        if (!chunk_was_full)
+        {
+            mflist__compact_unlink_chunk(mflist, chunk);
         }
+        mflist__compact_release_empty_chunk(mflist, chunk);
+    }
+    else if (chunk_was_full)
+    {
+        mflist__compact_link_chunk(mflist, chunk);
     }
+}
 
-end_chunk_search: { }
+static void
+mflist__compact_clear(MFList *mflist)
+{
+    memclr(mflist->compact_chunks, sizeof(mflist->compact_chunks));
+    mflist->compact_empty_chunks     = NULL;
+    mflist->compact_warm_chunk_count = 0;
 
-    /* Determine the correct block from the chunk */
-    if (result.chunk)
+    for (U32 offset = 0; offset < mflist->compact_region_used; offset += MFLIST_COMPACT_CHUNK_SIZE)
     {
-        MFListChunk *chunk = result.chunk;
+        MFListCompactChunk *chunk = (MFListCompactChunk *) (mflist->compact_region + offset);
+        const bool was_decommitted = (chunk->used_block_count == 0) && chunk->decommitted;
 
-        for (MFListBlock *block = mflist__get_first_block_from_chunk(result.chunk);
-             block;
-             block = mflist__next_block(chunk, block))
+        mflist__compact_init_chunk(chunk, chunk->block_size);
+        if (was_decommitted)
         {
-            if ((U8*) block == (addr - sizeof(MFListBlock)))
-            {
-                result.block = block;
-                break;
-            }
+            /* Nothing to give back */
+            chunk->decommitted = true;
+            chunk->next_chunk = mflist->compact_empty_chunks;
+            mflist->compact_empty_chunks = chunk;
+        }
+        else
+        {
+            mflist__compact_release_empty_chunk(mflist, chunk);
         }
     }
+}
 
+/* #############################################################################
+   MFList Segregated Fit (TLSF) size class index
+   ############################################################################# */
 
-    return result;
-}
+/* Free blocks of segregated chunks store the links of
+   their size class free list directly inside the payload */
+typedef struct MFListFreeBlockLinks
+{
+    MFListBlock *prev_free;
+    MFListBlock *next_free;
+} MFListFreeBlockLinks;
 
-#endif
+/* Do not split a free block if the remainder could not
+   even host the free list links */
+#define MFLIST_SEGREGATED_MIN_SPLIT_SIZE ((U32) (sizeof(MFListBlock) + sizeof(MFListFreeBlockLinks)))
 
 
-static inline void
-mflist__init_chunk(MFListChunk *chunk, U32 chunk_size, enum MFListAllocCateg categ)
-{
-    chunk->prev_chunk = NULL;
-    chunk->next_chunk = NULL;
-    chunk->size = chunk_size;
-    chunk->categ = categ;
+static void *mflist__segregated_alloc   (MFList *mflist, U32 alloc_size, bool zero_initialize);
+static MFListBlock *mflist__segregated_free (MFList *mflist, MFListBlock *block);
 
-    MFListBlock *first_block = mflist__get_first_block_from_chunk(chunk);
-    {
-        *first_block = (MFListBlock) {0};
-        first_block->parent_chunk = chunk;
-        first_block->prev_block = NULL;
-        first_block->is_avail = true;
-        first_block->size = chunk->size - (U32) sizeof(MFListChunk) - (U32) sizeof(MFListBlock);
-    }
 
-    chunk->max_contiguous_block_size_avail = first_block->size;
+static inline MFListFreeBlockLinks *
+mflist__free_links(MFListBlock *block)
+{
+    internal_assert(block->is_avail);
+    internal_assert(block->size >= sizeof(MFListFreeBlockLinks));
+    return (MFListFreeBlockLinks *) block->payload;
 }
 
-static inline MFListChunk *
-mflist__new_chunk(U32 chunk_size, enum MFListAllocCateg categ)
+
+/* Maps a block size to the size class (fl, sl) it belongs to */
+static inline void
+mflist__size_class_mapping(U32 size,
+                           U32 *fl,
+                           U32 *sl)
 {
-    assert(IS_PAGE_ALIGNED(chunk_size));
-    MFListChunk *newchunk = (MFListChunk*) mem_mmap(chunk_size);
+    internal_assert(size >= MFLIST_SL_INDEX_COUNT);
+    const U32 f = bit_scan_reverse_u32(size);
+    /* Drop the most significant bit and take the following `SL_INDEX_COUNT_LOG2` bits */
+    *sl = (size >> (f - MFLIST_SL_INDEX_COUNT_LOG2)) ^ MFLIST_SL_INDEX_COUNT;
+    *fl = f;
+}
 
-    if (newchunk)
-    {
-        mflist__init_chunk(newchunk, chunk_size, categ);
-    }
 
-    return newchunk;
+/* Maps an allocation request to the first size class whose
+   blocks are ALL guaranteed to satisfy the request */
+static inline void
+mflist__size_class_mapping_for_search(U32 size,
+                                      U32 *fl,
+                                      U32 *sl)
+{
+    internal_assert(size >= MFLIST_SL_INDEX_COUNT);
+    const U32 round = (U32_LIT(1) << (bit_scan_reverse_u32(size) - MFLIST_SL_INDEX_COUNT_LOG2)) - 1;
+    mflist__size_class_mapping(size + round, fl, sl);
 }
 
 
-
-static inline MFListChunk *
-mflist__chain_new_chunk(MFList *mflist,
-                        MFListChunk *prev_chunk,
-                        U32 chunk_size,
-                        enum MFListAllocCateg categ)
+static void
+mflist__size_class_insert(MFListSizeClassIndex *index,
+                          MFListBlock *block)
 {
-    MFListChunk *newchunk = mflist__new_chunk(chunk_size, categ);
+    U32 fl, sl;
+    mflist__size_class_mapping(block->size, &fl, &sl);
 
-    if (newchunk)
-    {
-        newchunk->prev_chunk = prev_chunk;
-        mflist->total_allocator_memory_usage += chunk_size;
-    }
+    MFListFreeBlockLinks *links = mflist__free_links(block);
+    MFListBlock *head = index->free_blocks[fl][sl];
 
-    if (prev_chunk)
+    links->prev_free = NULL;
+    links->next_free = head;
+    if (head)
     {
-        prev_chunk->next_chunk = newchunk;
+        mflist__free_links(head)->prev_free = block;
     }
+    index->free_blocks[fl][sl] = block;
 
-    return newchunk;
+    index->fl_bitmap     |= (U32_LIT(1) << fl);
+    index->sl_bitmap[fl] |= (U32_LIT(1) << sl);
 }
 
 
-static inline void
-mflist__del_chunk(MFListChunk *chunk_to_be_deleted)
+static void
+mflist__size_class_remove(MFListSizeClassIndex *index,
+                          MFListBlock *block)
 {
-    mem_unmap(chunk_to_be_deleted, chunk_to_be_deleted->size);
-}
+    U32 fl, sl;
+    mflist__size_class_mapping(block->size, &fl, &sl);
 
+    MFListFreeBlockLinks *links = mflist__free_links(block);
 
-static inline void
-mflist__del_chained_chunk(MFList *mflist,
-                          MFListChunk *chunk_to_be_deleted)
-{
-    MFListChunk *const prev_chunk = chunk_to_be_deleted->prev_chunk;
-    const enum MFListAllocCateg categ = chunk_to_be_deleted->categ;
-
-    if (prev_chunk)
+    if (links->prev_free)
     {
-        prev_chunk->next_chunk = chunk_to_be_deleted->next_chunk;
+        mflist__free_links(links->prev_free)->next_free = links->next_free;
     }
     else
     {
-        internal_assert(categ >= 0 && categ < MFListAllocCateg_Last);
-        mflist->chunks[categ] = chunk_to_be_deleted->next_chunk;
-    }
-    mflist->total_allocator_memory_usage -= chunk_to_be_deleted->size;
-    mflist__del_chunk(chunk_to_be_deleted);
-}
+        internal_assert(index->free_blocks[fl][sl] == block);
+        index->free_blocks[fl][sl] = links->next_free;
 
+        if (!links->next_free)
+        {
+            index->sl_bitmap[fl] &= ~(U32_LIT(1) << sl);
+            if (!index->sl_bitmap[fl])
+            {
+                index->fl_bitmap &= ~(U32_LIT(1) << fl);
+            }
+        }
+    }
 
+    if (links->next_free)
+    {
+        mflist__free_links(links->next_free)->prev_free = links->prev_free;
+    }
+}
 
 
-ATTRIB_PURE static inline bool
-mflist__is_chunk_empty(MFListChunk *chunk)
+/* Returns a free block guaranteed to fit `size` or NULL if the index
+   doesn't contain any. The block is NOT removed from the index. */
+static MFListBlock *
+mflist__size_class_find(MFListSizeClassIndex *index,
+                        U32 size)
 {
-    bool result = false;
+    U32 fl, sl;
+    mflist__size_class_mapping_for_search(size, &fl, &sl);
 
-    MFListBlock *first_block = mflist__get_first_block_from_chunk(chunk);
-    MFListBlock *next_block = mflist__next_block(chunk, first_block);
+    if (fl >= MFLIST_FL_INDEX_COUNT)
+    {
+        return NULL;
+    }
 
-    if (first_block && !first_block->is_avail && !next_block)
+    /* First look for a non empty free list in the same first level */
+    U32 sl_map = index->sl_bitmap[fl] & (~U32_LIT(0) << sl);
+    if (!sl_map)
     {
-        result = true;
-        internal_assert(first_block->size == chunk->size - (U32) sizeof(MFListChunk));
+        /* Then in the smallest non empty first level above */
+        const U32 fl_map = (fl + 1 < MFLIST_FL_INDEX_COUNT)
+            ? (index->fl_bitmap & (~U32_LIT(0) << (fl + 1)))
+            : 0;
+        if (!fl_map)
+        {
+            return NULL;
+        }
+        fl = bit_scan_forward_u32(fl_map);
+        sl_map = index->sl_bitmap[fl];
+        internal_assert(sl_map);
     }
+    sl = bit_scan_forward_u32(sl_map);
 
+    MFListBlock *result = index->free_blocks[fl][sl];
+    internal_assert(result && result->is_avail && result->size >= size);
     return result;
 }
 
 
+/* Marks the chunk as segregated and hands its (only) free block to the index */
+static void
+mflist__segregated_adopt_chunk(MFList *mflist,
+                               MFListChunk *chunk)
+{
+    internal_assert(chunk->categ != MFListAllocCateg_More);
+    chunk->segregated = true;
+    chunk->max_contiguous_block_size_avail = 0;
+
+    MFListBlock *first_block = mflist__get_first_block_from_chunk(chunk);
+    internal_assert(first_block->is_avail && !mflist__next_block(chunk, first_block));
+    mflist__size_class_insert(&mflist->size_classes, first_block);
+}
+
+
+
+
 /* Returns the merged blocks if they happened to merge with subsequent adjacent blocks
    or if no merge happened returns the same block passed (`loc->block`).
    @NOTE It may return NULL upon error or in case the blocks gets unmapped
@@ -668,7 +2298,7 @@ mflist__free_block_and_merge(MFList *mflist,
 
     MFListBlock *result = block_to_be_freed;
 
-    if (!block_to_be_freed->parent_chunk || !(block_to_be_freed->is_avail))
+    if (!block_to_be_freed->parent_chunk || block_to_be_freed->is_avail)
     {
         return NULL;
     }
@@ -678,6 +2308,7 @@ mflist__free_block_and_merge(MFList *mflist,
 
     if (categ == MFListAllocCateg_More)
     {
+        mflist->total_user_memory_usage -= block_to_be_freed->size;
         mflist__del_chained_chunk(mflist, parent_chunk);
         return NULL;
     }
@@ -738,6 +2369,13 @@ mflist__free_block_and_merge(MFList *mflist,
         }
     }
 
+    /* The block following the merged one must point back to it */
+    MFListBlock *following_block = mflist__next_block(parent_chunk, result);
+    if (following_block)
+    {
+        following_block->prev_block = result;
+    }
+
     if (combined_size > parent_chunk->max_contiguous_block_size_avail)
     {
         parent_chunk->max_contiguous_block_size_avail = combined_size;
@@ -749,131 +2387,309 @@ mflist__free_block_and_merge(MFList *mflist,
     return result;
 }
 
-void
-mflist_free(MFList *mflist, void *_addr)
+static inline void
+mflist__free(MFList *mflist, void *_addr)
 {
-    MFListBlock *block_to_be_freed = mflist__get_block_from_user_addr(_addr);
+    if (mflist__is_compact_addr(mflist, _addr))
+    {
+        mflist__compact_free(mflist, _addr);
+        return;
+    }
 
-    /* @NOTE Discard result, we don't care about it */
-    (void) mflist__free_block_and_merge(mflist, block_to_be_freed);
-}
+    MFListBlock *block_to_be_freed = mflist__get_block_from_user_addr(_addr);
 
+    MFListBlock *merged_block = mflist->segregated
+        ? mflist__segregated_free(mflist, block_to_be_freed)
+        : mflist__free_block_and_merge(mflist, block_to_be_freed);
 
-ATTRIB_PURE static inline bool
-mflist__should_del_chunk(MFListChunk *chunk)
-{
-    return ((chunk->size > KILOBYTES(64))
-            || mflist__is_chunk_empty(chunk)
-        );
+    /* The merged block spans the whole chunk: the chunk is now empty */
+    if (merged_block && !merged_block->prev_block
+        && !mflist__next_block(merged_block->parent_chunk, merged_block))
+    {
+        mflist__release_empty_chunk(mflist, merged_block->parent_chunk);
+    }
 }
 
+
 void
 mflist_clear(MFList *mflist)
 {
+    if (mflist->segregated)
+    {
+        memclr(&mflist->size_classes, sizeof(mflist->size_classes));
+    }
+    mflist->warm_chunk_count = 0;
+
     for (enum MFListAllocCateg categ = 0; categ < ARRAY_LEN(mflist->chunks); categ ++ )
     {
-        MFListChunk *prev_chunk = NULL;
         MFListChunk *chunk = mflist->chunks[categ];
 
+        while (chunk)
+        {
+            MFListChunk *next_chunk = chunk->next_chunk;
+
+            if (categ == MFListAllocCateg_More)
+            {
+                /* Dedicated chunks are never kept around */
+                mflist__del_chained_chunk(mflist, chunk);
+            }
+            else
+            {
+                /* Re-initializing the chunk must not lose the chain */
+                MFListChunk *prev_chunk = chunk->prev_chunk;
+                const bool was_decommitted = chunk->empty && chunk->decommitted;
+                mflist__init_chunk(chunk, chunk->size, chunk->categ);
+                chunk->prev_chunk = prev_chunk;
+                chunk->next_chunk = next_chunk;
+
+                if (mflist->segregated)
+                {
+                    mflist__segregated_adopt_chunk(mflist, chunk);
+                }
+
+                if (was_decommitted)
+                {
+                    /* Nothing to give back */
+                    chunk->empty = true;
+                    chunk->decommitted = true;
+                }
+                else
+                {
+                    mflist__release_empty_chunk(mflist, chunk);
+                }
+            }
+
+            chunk = next_chunk;
+        }
+    }
+
+    mflist__compact_clear(mflist);
+    mflist->total_user_memory_usage = 0;
+}
+
+
+void
+mflist_del(MFList *mflist)
+{
+    assert(mflist->chunks);
+
+    for (enum MFListAllocCateg categ = 0; categ < ARRAY_LEN(mflist->chunks); categ ++)
+    {
+        MFListChunk *chunk = mflist->chunks[categ];
         if (!chunk)
         {
             continue;
         }
 
-        MFListChunk *tmp = chunk->next_chunk;
-        if (mflist__should_del_chunk(chunk))
+
+        while(chunk)
         {
+            MFListChunk *tmp = chunk->next_chunk;
             mflist__del_chunk(chunk);
-            chunk = prev_chunk;
+            chunk = tmp;
         }
-        else
+    }
+
+    if (mflist->compact_region)
+    {
+        mem_dealloc(DeallocStrategy_ReleaseAddrSpace, mflist->compact_region, MFLIST_COMPACT_REGION_SIZE);
+    }
+
+    memclr(mflist, sizeof(*mflist));
+}
+
+typedef struct MFListChunkInitRequirements
+{
+    enum MFListAllocCateg categ;
+    U32                   required_chunk_size;
+} MFListChunkInitRequirements;
+
+
+static MFListChunkInitRequirements
+mflist__get_chunk_requirements(MFList *mflist,
+                               U32 alloc_size)
+{
+    /* Account for the padding between the chunk header and the first block too */
+    const U32 needed_chunk_size = alloc_size
+        + (U32) ALIGN(usize, sizeof(MFListChunk), sizeof(MFListBlock))
+        + (U32) sizeof(MFListBlock);
+
+    MFListChunkInitRequirements result = {0};
+    result.categ = MFListAllocCateg_More;
+    result.required_chunk_size = (U32) PAGE_ALIGN(needed_chunk_size);
+
+
+    /* Depending on how big the allocation is find the correct
+       categ where to allocate. We use different
+       chains to maintain different order of allocations sizes.
+       In this way we can limit high fragmentation inside the chunk
+       in case where big allocation and small allocations concur to
+       use the same chunks */
+    for (enum MFListAllocCateg i = 0; i < ARRAY_LEN(mflist->chunks); i++)
+    {
+        if (needed_chunk_size <= (U32) (0.25f * (float) s_mflist_categ_sizes[i]))
         {
-            mflist__init_chunk(chunk, chunk->size, chunk->categ);
+            result.categ = i;
+            result.required_chunk_size = s_mflist_categ_sizes[result.categ];
+            break;
         }
+    }
 
-        prev_chunk = chunk;
-        chunk = tmp;
-        internal_assert(prev_chunk);
+    return result;
+}
 
-        while (chunk)
-        {
-            tmp = chunk->next_chunk;
-            if (mflist__should_del_chunk(chunk))
-            {
-                mflist__del_chained_chunk(mflist, chunk);
-                chunk = prev_chunk;
-            }
-            else
-            {
-                mflist__init_chunk(chunk, chunk->size, chunk->categ);
-            }
-            prev_chunk = chunk;
-            chunk = tmp;
+
+/* #############################################################################
+   MFList Segregated Fit (TLSF) allocation
+   ############################################################################# */
+
+static inline void
+mflist__push_chunk(MFList *mflist,
+                   MFListChunk *chunk)
+{
+    const enum MFListAllocCateg categ = chunk->categ;
+    internal_assert(!chunk->prev_chunk);
+
+    chunk->next_chunk = mflist->chunks[categ];
+    if (chunk->next_chunk)
+    {
+        chunk->next_chunk->prev_chunk = chunk;
+    }
+    mflist->chunks[categ] = chunk;
+}
+
+
+/* Splits the free block (already removed from the index) keeping `alloc_size`
+   bytes of payload and gives back the remainder to the index */
+static void
+mflist__segregated_split(MFList *mflist,
+                         MFListChunk *chunk,
+                         MFListBlock *block,
+                         U32 alloc_size)
+{
+    internal_assert(block->size >= alloc_size);
+    const U32 remainder_size = block->size - alloc_size;
+
+    if (remainder_size >= MFLIST_SEGREGATED_MIN_SPLIT_SIZE)
+    {
+        MFListBlock *newblock = (MFListBlock*) ((U8*) block + sizeof(MFListBlock) + alloc_size);
+        newblock->parent_chunk = chunk;
+        newblock->prev_block   = block;
+        newblock->size         = remainder_size - (U32) sizeof(MFListBlock);
+        newblock->is_avail     = true;
+
+        MFListBlock *next_block = mflist__next_block(chunk, newblock);
+        if (next_block)
+        {
+            next_block->prev_block = newblock;
         }
+
+        block->size = alloc_size;
+        mflist__size_class_insert(&mflist->size_classes, newblock);
     }
 }
 
 
-void
-mflist_del(MFList *mflist)
+static void *
+mflist__segregated_alloc(MFList *mflist,
+                         U32 alloc_size,
+                         bool zero_initialize)
 {
-    assert(mflist->chunks);
+    MFListChunkInitRequirements req = mflist__get_chunk_requirements(mflist, alloc_size);
 
-    for (enum MFListAllocCateg categ = 0; categ < ARRAY_LEN(mflist->chunks); categ ++)
+    MFListChunk *chunk = NULL;
+    MFListBlock *block = NULL;
+
+    if (req.categ == MFListAllocCateg_More)
     {
-        MFListChunk *chunk = mflist->chunks[categ];
+        /* Unbounded allocations still get a dedicated chunk */
+        chunk = mflist__chain_new_chunk(mflist, NULL, req.required_chunk_size, req.categ);
         if (!chunk)
         {
-            continue;
+            return NULL;
         }
-
-
-        while(chunk)
+        mflist__push_chunk(mflist, chunk);
+        block = mflist__get_first_block_from_chunk(chunk);
+        chunk->max_contiguous_block_size_avail = 0;
+    }
+    else
+    {
+        block = mflist__size_class_find(&mflist->size_classes, alloc_size);
+        if (!block)
         {
-            MFListChunk *tmp = chunk->next_chunk;
-            mflist__del_chunk(chunk);
-            chunk = tmp;
+            chunk = mflist__chain_new_chunk(mflist, NULL, req.required_chunk_size, req.categ);
+            if (!chunk)
+            {
+                return NULL;
+            }
+            mflist__push_chunk(mflist, chunk);
+            mflist__segregated_adopt_chunk(mflist, chunk);
+            block = mflist__size_class_find(&mflist->size_classes, alloc_size);
         }
+        internal_assert(block);
+
+        chunk = block->parent_chunk;
+        mflist__mark_chunk_as_used(mflist, chunk);
+        mflist__size_class_remove(&mflist->size_classes, block);
+        mflist__segregated_split(mflist, chunk, block, alloc_size);
     }
 
-    memclr(mflist, sizeof(*mflist));
+    block->is_avail = false;
+    mflist->total_user_memory_usage += block->size;
+
+    if (zero_initialize)
+    {
+        memclr(block->payload, block->size);
+    }
+
+    __mflist_assert_integrity(chunk);
+    return block->payload;
 }
 
-typedef struct MFListChunkInitRequirements
+
+static MFListBlock *
+mflist__segregated_free(MFList *mflist,
+                        MFListBlock *block)
 {
-    enum MFListAllocCateg categ;
-    U32                   required_chunk_size;
-} MFListChunkInitRequirements;
+    assert_msg(block->parent_chunk, "Corrupted Block. Possible Memory overflow or Undeflow in UserLand");
+    assert_msg(!block->is_avail, "Possible Double free");
 
+    MFListChunk *const chunk = block->parent_chunk;
+    mflist->total_user_memory_usage -= block->size;
 
-static MFListChunkInitRequirements
-mflist__get_chunk_requirements(MFList *mflist,
-                               U32 alloc_size)
-{
-    const U32 needed_chunk_size = alloc_size + (U32) sizeof(MFListChunk) + (U32) sizeof(MFListBlock);
+    if (chunk->categ == MFListAllocCateg_More)
+    {
+        mflist__del_chained_chunk(mflist, chunk);
+        return NULL;
+    }
 
-    MFListChunkInitRequirements result = {0};
-    result.categ = MFListAllocCateg_More;
-    result.required_chunk_size = (U32) PAGE_ALIGN(needed_chunk_size);
+    block->is_avail = true;
 
+    /* Coalesce with the physically adjacent free blocks */
+    MFListBlock *next_block = mflist__next_block(chunk, block);
+    if (next_block && next_block->is_avail)
+    {
+        mflist__size_class_remove(&mflist->size_classes, next_block);
+        block->size += (U32) sizeof(MFListBlock) + next_block->size;
+    }
 
-    /* Depending on how big the allocation is find the correct
-       categ where to allocate. We use different
-       chains to maintain different order of allocations sizes.
-       In this way we can limit high fragmentation inside the chunk
-       in case where big allocation and small allocations concur to
-       use the same chunks */
-    for (enum MFListAllocCateg i = 0; i < ARRAY_LEN(mflist->chunks); i++)
+    MFListBlock *prev_block = block->prev_block;
+    if (prev_block && prev_block->is_avail)
     {
-        if (needed_chunk_size <= (U32) (0.25f * (float) s_mflist_categ_sizes[i]))
-        {
-            result.categ = i;
-            result.required_chunk_size = s_mflist_categ_sizes[result.categ];
-            break;
-        }
+        mflist__size_class_remove(&mflist->size_classes, prev_block);
+        prev_block->size += (U32) sizeof(MFListBlock) + block->size;
+        block = prev_block;
     }
 
-    return result;
+    next_block = mflist__next_block(chunk, block);
+    if (next_block)
+    {
+        next_block->prev_block = block;
+    }
+
+    mflist__size_class_insert(&mflist->size_classes, block);
+    __mflist_assert_integrity(chunk);
+    return block;
 }
 
 
@@ -892,6 +2708,8 @@ mflist__suballoc_fork(MFList *mflist,
     const enum MFListAllocCateg categ = allocatable_chunk->categ;
     const U32 chunk_size = allocatable_chunk->size;
 
+    mflist__mark_chunk_as_used(mflist, allocatable_chunk);
+
 
     const bool should_fit_a_new_block =
         ((categ != MFListAllocCateg_More)
@@ -913,6 +2731,12 @@ mflist__suballoc_fork(MFList *mflist,
             newblock->prev_block = allocatable_block;
             newblock->size = ( remainder_size - (U32) sizeof(MFListBlock) );
             newblock->is_avail = true;
+
+            MFListBlock *following_block = mflist__next_block(allocatable_chunk, newblock);
+            if (following_block)
+            {
+                following_block->prev_block = newblock;
+            }
         }
     }
     else
@@ -936,8 +2760,8 @@ mflist__suballoc_fork(MFList *mflist,
 }
 
 
-void *
-mflist_alloc1(MFList *mflist, U32 alloc_size, const bool zero_initialize)
+static void *
+mflist__alloc1(MFList *mflist, U32 alloc_size, const bool zero_initialize)
 {
     /* Always give a little bit of more room to avoid
        stupind off by 1 errors in case of string indexing for example
@@ -947,9 +2771,25 @@ mflist_alloc1(MFList *mflist, U32 alloc_size, const bool zero_initialize)
     {
         return NULL;
     }
+
+    if (mflist->compact && (alloc_size <= MFLIST_COMPACT_MAX_SIZE))
+    {
+        void *result = mflist__compact_alloc(mflist, alloc_size, zero_initialize);
+        if (result)
+        {
+            return result;
+        }
+        /* The compact region is exhausted, fall back to a regular block */
+    }
+
     alloc_size += (U32) sizeof(MFListBlock);
     alloc_size = ALIGN(U32, alloc_size, sizeof(MFListBlock));
 
+    if (mflist->segregated)
+    {
+        return mflist__segregated_alloc(mflist, alloc_size, zero_initialize);
+    }
+
     MFListChunkInitRequirements req = mflist__get_chunk_requirements(mflist, alloc_size);
 
     /* Allocate the first chunk if it's the first time */
@@ -1087,788 +2927,853 @@ mflist_alloc1(MFList *mflist, U32 alloc_size, const bool zero_initialize)
 }
 
 
-void *
-mflist_realloc1 (MFList *mflist, void *oldptr, U32 newsize, bool zero_initialize)
+/* Splits an allocated `block` keeping `size` bytes of payload, the remainder
+   (if big enough to be useful) becomes a new free block */
+static void
+mflist__split_block(MFList *mflist,
+                    MFListChunk *chunk,
+                    MFListBlock *block,
+                    U32 size)
 {
-    assert(newsize);
-    if (newsize == 0)
+    if (mflist->segregated)
     {
-        return NULL;
+        mflist__segregated_split(mflist, chunk, block, size);
+        return;
     }
-    newsize += (U32) sizeof(MFListBlock);
-    newsize = ALIGN(U32, newsize, sizeof(MFListBlock));
 
-    void *result = NULL;
-
-    MFListBlock *rblock = mflist__get_block_from_user_addr(oldptr);
-    MFListChunk *rchunk = rblock->parent_chunk;
-    const enum MFListAllocCateg categ = rchunk->categ;
-
-    assert_msg(rblock->size, "Corrupted Block. Possible Memory overflow or Undeflow in UserLand");
-    assert_msg(rblock->is_avail == false, "Corrupted Block. Possible Memory overflow or Undeflow in UserLand");
-    assert_msg(rchunk, "Corrupted Block. Possible Memory overflow or Undeflow in UserLand");
+    internal_assert(block->size >= size);
+    const U32 remainder_size = block->size - size;
 
-    if (rchunk && !(rblock->is_avail))
+    if (remainder_size >= MFLIST_SEGREGATED_MIN_SPLIT_SIZE)
     {
-        MFListChunkInitRequirements req = mflist__get_chunk_requirements(mflist, newsize);
+        MFListBlock *newblock = (MFListBlock*) ((U8*) block + sizeof(MFListBlock) + size);
+        newblock->parent_chunk = chunk;
+        newblock->prev_block   = block;
+        newblock->size         = remainder_size - (U32) sizeof(MFListBlock);
+        newblock->is_avail     = true;
 
-        if ((categ == req.categ)
-            && (rblock->size >= newsize))
+        MFListBlock *following_block = mflist__next_block(chunk, newblock);
+        if (following_block)
         {
-            /* We can reuse the same block, no need to free & alloc and copy data
-               over */
-            result = (U8*) (rblock) + sizeof(MFListBlock);
-
-            if (zero_initialize)
-            {
-                memclr((U8*) result + newsize, rblock->size - newsize);
-            }
+            following_block->prev_block = newblock;
         }
-        else
-        {
-            /* @NOTE We can `free` prematurely the block. We're not going to
-               lose the data that was there. Free is not a destructive operation.
-               It can merge blocks together but it does not touch memory newmemory
-               with new data, it just touches already existing block headers.
-            */
-            U8 *old_block_addr = (U8*) rblock;
-            U32 old_block_size = rblock->size;
-            (void) old_block_addr, (void) old_block_size;
-
-            MFListBlock *merged_block = mflist__free_block_and_merge(mflist, rblock);
-            (void) merged_block;
-
-            result = mflist_alloc1(mflist, newsize, false);
-            if (result)
-            {
-                MFListBlock *allocated_block = (MFListBlock*) ((U8*) result - sizeof(MFListBlock));
-
-                /* No need to waste time copying data around if we get back the
-                   same pointer (@NOTE Data is explicity not cleared upon free and alloc
-                   in this case) */
-                if (result != oldptr)
-                {
-                    internal_assert(!allocated_block->is_avail);
-                    //internal_assert(newsize == allocated_block->size);
-
-                    /* Here we can use memcpy instead of memmove. Memory regions
-                       are not going to collide. Let's assert it*/
-#if __DEBUG
-                    /* Interval of the old allocation */
-                    U8 *o1 = (U8*) old_block_addr + sizeof(MFListBlock);
-                    U8 *o2 = (U8*) old_block_addr + sizeof(MFListBlock) + old_block_size;
-                    /* Interval new allocation */
-                    U8 *n1 = (U8*) result;
-                    U8 *n2 = (U8*) result + newsize;
-
-                    internal_assert(
-                        ((o1 < n1) && (o2 < n1))
-                        || ((o1 >= n2))
-                        );
-#endif
-                    memcpy(result, oldptr, MIN(newsize, old_block_size));
-                }
 
-                if (zero_initialize)
-                {
-                    memclr((U8*) result + newsize, allocated_block->size - newsize);
-                }
-            }
-        }
+        block->size = size;
     }
-
-    return result;
 }
 
 
-
-
-/* #############################################################################
-   MArena Implementation
-   #############################################################################
-*/
-
-
-
-
-static inline bool
-marena_can_realloc(MArena *arena)
+static void
+mflist__update_max_contiguous_block_size_avail(MFListChunk *chunk)
 {
-    return (arena->realloc_strategy != ReallocStrategy_None);
+    U32 max_contiguous_block_size_avail = 0;
+    for (MFListBlock *block = mflist__get_first_block_from_chunk(chunk);
+         block;
+         block = mflist__next_block(chunk, block))
+    {
+        if (block->is_avail && block->size > max_contiguous_block_size_avail)
+        {
+            max_contiguous_block_size_avail = block->size;
+        }
+    }
+    chunk->max_contiguous_block_size_avail = max_contiguous_block_size_avail;
 }
 
 
-static inline bool
-marena_realloc(MArena *arena,
-               U32 newsize)
+/* Grows the allocated `block` up to `newsize` bytes of payload by absorbing
+   the physically following block, if it is free and big enough.
+   The data never moves. */
+static bool
+mflist__grow_block_in_place(MFList *mflist,
+                            MFListBlock *block,
+                            U32 newsize)
 {
-    bool success = false;
-    assert(marena_can_realloc(arena));
+    MFListChunk *const chunk = block->parent_chunk;
+    MFListBlock *next_block = mflist__next_block(chunk, block);
 
-    const size_t alignment = 128;
+    if (!next_block || !next_block->is_avail)
+    {
+        return false;
+    }
 
-    void *buffer = mem_realloc (arena->realloc_strategy,
-                                arena->buffer,
-                                arena->data_max_size,
-                                (size_t) newsize,
-                                alignment);
-    if ( buffer )
+    const U32 combined_size = block->size + (U32) sizeof(MFListBlock) + next_block->size;
+    if (combined_size < newsize)
     {
-        arena->buffer = buffer;
-        arena->data_max_size = newsize;
-        success = true;
+        return false;
     }
-    return success;
-}
 
-static inline bool
-marena_grow(MArena *arena)
-{
-    U32 newsize;
-    if ((arena->data_max_size << U32_LIT(1)) < arena->data_max_size)
+    const U32 old_size = block->size;
+    if (mflist->segregated)
     {
-        newsize = U32_MAX;
-        assert_msg(arena->data_max_size != newsize, "Assert that the arena was able to grow, eg we didn't hit the maximum memory usage");
+        mflist__size_class_remove(&mflist->size_classes, next_block);
+    }
 
-        if (newsize == arena->data_max_size)
-        {
-            /* Finished the available space that we can fit in a U32*/
-            return false;
-        }
+    block->size = combined_size;
+    MFListBlock *following_block = mflist__next_block(chunk, block);
+    if (following_block)
+    {
+        following_block->prev_block = block;
     }
-    else
+
+    mflist__split_block(mflist, chunk, block, newsize);
+    mflist->total_user_memory_usage += block->size - old_size;
+
+    if (!mflist->segregated)
     {
-        newsize = (U32) ((F32) arena->data_max_size * 1.25f) + 8 * (U32) G_pal.page_size;
+        mflist__update_max_contiguous_block_size_avail(chunk);
     }
-    return marena_realloc(arena, newsize);
-}
 
+    __mflist_assert_integrity(chunk);
+    return true;
+}
 
-#ifndef __DPCRT_MEM_LAYER__ARENA_ALWAYS_FORCE_REALLOC_AT_EVERY_PUSH
-#  define __DPCRT_MEM_LAYER__ARENA_ALWAYS_FORCE_REALLOC_AT_EVERY_PUSH 1
-#endif
 
-static bool
-marena_accomodate_for_size(MArena *arena, U32 size)
+/* Resizes the dedicated chunk of an unbounded allocation (`MFListAllocCateg_More`)
+   with `mremap`: the kernel moves the page table entries instead of copying the data.
+   Returns the (possibly moved) payload, NULL on failure (the old block is still valid) */
+static void *
+mflist__remap_dedicated_chunk(MFList *mflist,
+                              MFListBlock *block,
+                              U32 newsize)
 {
-    bool success = false;
-    assert(arena);
-    bool can_realloc = marena_can_realloc(arena);
+    MFListChunk *const chunk = block->parent_chunk;
+    internal_assert(chunk->categ == MFListAllocCateg_More);
+
+    MFListChunkInitRequirements req = mflist__get_chunk_requirements(mflist, newsize);
+    internal_assert(req.categ == MFListAllocCateg_More);
 
-    const size_t needed_data_size = arena->data_size + size;
+    MFListChunk *const prev_chunk = chunk->prev_chunk;
+    MFListChunk *const next_chunk = chunk->next_chunk;
+    const U32 old_chunk_size = chunk->size;
+    const U32 old_block_size = block->size;
 
-    if ( needed_data_size >= (size_t)(arena->data_max_size))
+    MFListChunk *newchunk = (MFListChunk*) mem_realloc(ReallocStrategy_MRemap_MayMove,
+                                                       chunk,
+                                                       old_chunk_size,
+                                                       req.required_chunk_size,
+                                                       G_pal.page_size);
+    if (!newchunk)
     {
-        // needs to grow
-        if ( !can_realloc )
-        {
-            return false;
-        }
-        else
-        {
-            if (marena_grow(arena))
-            {
-                success = true;
-            }
-            else
-            {
-                success = false;
-            }
-        }
+        return NULL;
     }
-#if __DEBUG
-    else if (__DPCRT_MEM_LAYER__ARENA_ALWAYS_FORCE_REALLOC_AT_EVERY_PUSH & can_realloc)
+
+    /* The chunk may have moved: fix the links pointing to it */
+    if (prev_chunk)
     {
-        // If the arena didn't really need to grow, and the macro
-        //    is defined we're going to force a new grow
-        return marena_realloc(arena, arena->data_max_size);
+        prev_chunk->next_chunk = newchunk;
     }
-#endif
     else
     {
-        success = true;
+        mflist->chunks[MFListAllocCateg_More] = newchunk;
     }
-    return success;
-}
-
-
-
-MArena
-marena_new_aux ( enum AllocStrategy alloc_strategy,
-                 enum ReallocStrategy realloc_strategy,
-                 enum DeallocStrategy dealloc_strategy,
-                 U32 size )
-{
-    assert(size);
-    MArena marena = {0};
-    size = ALIGN(U32, size, MARENA_MINIMUM_ALLOWED_STACK_POINTER_VALUE);
-    const U32 alignment = 128;
-    size = ALIGN(U32, size, alignment);
-    const size_t alloc_size = size;
-
-    void *buffer = mem_alloc( alloc_strategy, alloc_size, alignment);
-
-    if (buffer)
+    if (next_chunk)
     {
-        marena.buffer = buffer;
-        // We're going to reserve the first 64 bytes
-        // so we can return `MRef` (indices to the buffer)
-        // that do not start at zero
-        marena.data_size = MARENA_MINIMUM_ALLOWED_STACK_POINTER_VALUE;
-        marena.data_max_size = size;
-        marena.alloc_strategy = alloc_strategy;
-        marena.realloc_strategy = realloc_strategy;
-        marena.dealloc_strategy = dealloc_strategy;
+        next_chunk->prev_chunk = newchunk;
     }
-    return marena;
-}
 
+    newchunk->size = req.required_chunk_size;
+    block = mflist__get_first_block_from_chunk(newchunk);
+    block->parent_chunk = newchunk;
+    block->size = (U32) (((U8*) newchunk + newchunk->size) - ((U8*) block + sizeof(MFListBlock)));
+    internal_assert(block->size >= newsize);
 
-MArena
-marena_new( U32 size, bool buffer_may_change_addr )
-{
-    const enum AllocStrategy alloc_strategy = AllocStrategy_Mmap;
-    const enum ReallocStrategy realloc_strategy =  buffer_may_change_addr
-        ? ReallocStrategy_MRemap_MayMove
-        : ReallocStrategy_MRemap_KeepAddr;
-    const enum DeallocStrategy dealloc_strategy = DeallocStrategy_Munmap;
+    mflist->total_allocator_memory_usage += newchunk->size - old_chunk_size;
+    mflist->total_user_memory_usage      += block->size - old_block_size;
 
-    return marena_new_aux ( alloc_strategy, realloc_strategy, dealloc_strategy, size );
+    /* @NOTE :: The pages added at the end come zeroed from the OS */
+    return block->payload;
 }
 
 
-void
-marena_del(MArena *arena)
+static void *
+mflist__realloc1 (MFList *mflist, void *oldptr, U32 newsize, bool zero_initialize)
 {
-    assert(arena);
-    if ( arena )
+    assert(newsize);
+    if (newsize == 0)
     {
-        mem_dealloc(arena->dealloc_strategy, arena->buffer, arena->data_max_size);
-        arena->buffer = NULL;
+        return NULL;
     }
-    memclr(arena, sizeof(*arena));
-}
-
+    const U32 user_size = newsize;
 
-static inline void
-assert_valid_marena(MArena *arena)
-{
-    (void) arena;
-    assert(arena && arena->buffer && (arena->data_size != 0) && arena->data_max_size);
-}
+    if (mflist__is_compact_addr(mflist, oldptr))
+    {
+        const U32 old_size = mflist__compact_chunk_from_addr(oldptr)->block_size;
+        if (newsize <= old_size)
+        {
+            if (zero_initialize)
+            {
+                memclr((U8*) oldptr + newsize, old_size - newsize);
+            }
+            return oldptr;
+        }
 
+        void *result = mflist__alloc1(mflist, newsize, false);
+        if (result)
+        {
+            memcpy(result, oldptr, old_size);
+            if (zero_initialize)
+            {
+                memclr((U8*) result + old_size, newsize - old_size);
+            }
+            mflist__compact_free(mflist, oldptr);
+        }
+        return result;
+    }
 
-void
-marena_clear(MArena *arena)
-{
-    assert_valid_marena(arena);
-    assert(arena->alloc_context.staging_size == 0);
-    memclr(&arena->alloc_context, sizeof(arena->alloc_context));
-    arena->data_size = MARENA_MINIMUM_ALLOWED_STACK_POINTER_VALUE;
-}
+    newsize += (U32) sizeof(MFListBlock);
+    newsize = ALIGN(U32, newsize, sizeof(MFListBlock));
 
+    void *result = NULL;
 
-void
-marena_pop_upto(MArena *arena, MRef ref)
-{
-    assert_valid_marena(arena);
-    assert(arena->alloc_context.staging_size == 0);
+    MFListBlock *rblock = mflist__get_block_from_user_addr(oldptr);
+    MFListChunk *rchunk = rblock->parent_chunk;
 
-    assert(ref >= MARENA_MINIMUM_ALLOWED_STACK_POINTER_VALUE);
+    assert_msg(rblock->size, "Corrupted Block. Possible Memory overflow or Undeflow in UserLand");
+    assert_msg(rblock->is_avail == false, "Corrupted Block. Possible Memory overflow or Undeflow in UserLand");
+    assert_msg(rchunk, "Corrupted Block. Possible Memory overflow or Undeflow in UserLand");
 
-    assert(ref < arena->data_size);
-    if (ref < arena->data_size)
+    if (!rchunk || rblock->is_avail)
     {
-        arena->data_size = ref;
+        return NULL;
     }
-    else
+
+    const enum MFListAllocCateg categ = rchunk->categ;
+    const U32 old_size = rblock->size;
+    MFListChunkInitRequirements req = mflist__get_chunk_requirements(mflist, newsize);
+
+    if ((rblock->size >= newsize)
+        && (categ == req.categ || categ != MFListAllocCateg_More))
     {
-        assert_msg(0, "You're using a reference that is possibly invalid, since it points to buffer that does not currently exist\n");
+        /* We can reuse the same block, no need to free & alloc and copy data
+           over */
+        result = oldptr;
+
+        if (zero_initialize)
+        {
+            memclr((U8*) result + newsize, rblock->size - newsize);
+        }
+        return result;
     }
-}
 
-void
-marena_fetch( MArena *arena, MRef ref, void *output, U32 sizeof_elem )
-{
-    void *ptr = marena_unpack_ref__unsafe(arena, ref);
-    assert(ptr);
-    if (ptr)
+    if (categ == MFListAllocCateg_More)
     {
-        memcpy(output, ptr, sizeof_elem);
+        /* Explicit huge pages mappings cannot be reliably remapped.
+           Aligned allocations (see `mflist__alloc_aligned`) may not own the whole chunk */
+        if ((req.categ == MFListAllocCateg_More) && !mflist->huge_pages && !rblock->prev_block)
+        {
+            result = mflist__remap_dedicated_chunk(mflist, rblock, newsize);
+        }
     }
-    else
+    else if (mflist__grow_block_in_place(mflist, rblock, newsize))
     {
-        memclr(output, sizeof_elem);
+        result = oldptr;
+        if (zero_initialize)
+        {
+            memclr((U8*) result + old_size, rblock->size - old_size);
+        }
     }
-}
-
-
-void
-marena_begin (MArena *arena)
-{
-    assert_valid_marena(arena);
-    assert_msg(arena->alloc_context.staging_size == 0, "Previous push begins must finish");
-    arena->alloc_context.staging_size = (arena->data_size);
-}
-
-
-void
-marena_dismiss (MArena *arena)
-{
-    assert_valid_marena(arena);
-    /* @NOTE :: Copied from pop_upto function */
-    assert(arena && (arena->data_size != 0));
-    assert(arena->alloc_context.staging_size >= arena->data_size);
-
-    memclr(&arena->alloc_context, sizeof(arena->alloc_context));
-}
-
 
-MRef
-marena_commit (MArena *arena)
-{
-    MRef ref = 0;
+    if (!result)
+    {
+        /* Slow path: allocate a new block, move the data and only then free the old one */
+        result = mflist__alloc1(mflist, user_size, false);
+        if (result)
+        {
+            /* Small (aligned) regular blocks may move to a compact one */
+            const U32 allocated_size = mflist__is_compact_addr(mflist, result)
+                ? mflist__compact_chunk_from_addr(result)->block_size
+                : mflist__get_block_from_user_addr(result)->size;
+            memcpy(result, oldptr, MIN(old_size, allocated_size));
 
-    assert_valid_marena(arena);
-    assert(arena->alloc_context.staging_size >= arena->data_size);
+            if (zero_initialize && allocated_size > old_size)
+            {
+                memclr((U8*) result + old_size, allocated_size - old_size);
+            }
 
-    if (!arena->alloc_context.failed)
-    {
-        ref = arena->data_size;
-        arena->data_size = arena->alloc_context.staging_size;
+            mflist__free(mflist, oldptr);
+        }
     }
 
-    marena_dismiss(arena);
-
-    return ref;
+    return result;
 }
 
 
-static bool
-marena_add_failure(MArena *arena)
-{
-    assert_valid_marena(arena);
-    assert(arena->alloc_context.staging_size != 0);
-    arena->alloc_context.failed = true;
-    return false;
-}
+/* Payloads are naturally aligned to the alignment of the blocks headers */
+#define MFLIST_NATURAL_ALIGNMENT ((U32) sizeof(void*))
 
-static inline bool
-marena_would_overflow_stack_pointer(MArena *arena,
-                                    U32 sizeof_data)
+/* Over allocates a block, then gives back both the unaligned head and the unused tail.
+   Block headers sit at a multiple of `sizeof(MFListBlock)` from the (page aligned) start
+   of their chunk, thus an aligned payload is always found within
+   `lcm(sizeof(MFListBlock), alignment)` bytes. */
+static void *
+mflist__alloc_aligned(MFList *mflist, U32 alloc_size, U32 alignment, bool zero_initialize)
 {
-    if ( sizeof_data > U32_MAX - arena->alloc_context.staging_size)
-    {
-        return true;
-    }
-    else
+    assert(IS_POW2(alignment));
+    if (alignment <= MFLIST_NATURAL_ALIGNMENT)
     {
-        return false;
+        return mflist__alloc1(mflist, alloc_size, zero_initialize);
     }
-}
-
 
-static inline bool
-marena_ensure_add_operation_is_possible(MArena *arena,
-                                        U32 sizeof_data_to_be_added)
-{
-    assert_valid_marena(arena);
-    assert(arena->alloc_context.staging_size != 0);
+    const U32 header_size = (U32) sizeof(MFListBlock);
+    const U32 header_low_bit = header_size & (~header_size + 1);
+    const U64 period = (U64) (header_size / MIN(header_low_bit, alignment)) * alignment;
+    /* The head must be big enough to be a free block on its own */
+    const U32 min_head_size = 2 * header_size;
 
-    if ((arena->alloc_context.failed == false)
-        && (!marena_would_overflow_stack_pointer(arena, sizeof_data_to_be_added)))
+    const U64 padded_size = (U64) alloc_size + period + min_head_size;
+    if (padded_size > (U64) (U32_MAX - header_size))
     {
-        if (marena_accomodate_for_size(arena, sizeof_data_to_be_added))
-        {
-            return true;
-        }
+        return NULL;
     }
-    return false;
-}
-
-
-bool
-marena_add(MArena *arena, U32 size, bool initialize_to_zero )
-{
-    assert_valid_marena(arena);
-    assert(arena->alloc_context.staging_size != 0);
 
-    if (!marena_ensure_add_operation_is_possible(arena, size))
+    U8 *payload = (U8*) mflist__alloc1(mflist, (U32) padded_size, false);
+    if (!payload)
     {
-        return marena_add_failure(arena);
+        return NULL;
     }
 
+    MFListBlock *block = mflist__get_block_from_user_addr(payload);
+    MFListChunk *const chunk = block->parent_chunk;
 
-    if (initialize_to_zero)
+    U32 head_size = 0;
+    while ((((usize) payload + head_size) & (alignment - 1))
+           || (head_size && head_size < min_head_size))
     {
-        memclr((U8*) arena->buffer + arena->alloc_context.staging_size, size);
+        head_size += header_size;
     }
-    arena->alloc_context.staging_size += size;
+    internal_assert((U64) head_size + alloc_size <= block->size);
 
-    return true;
-}
+    MFListBlock *aligned_block = block;
 
+    if (head_size)
+    {
+        aligned_block = (MFListBlock*) ((U8*) block + head_size);
+        aligned_block->parent_chunk = chunk;
+        aligned_block->prev_block   = block;
+        aligned_block->size         = block->size - head_size;
+        aligned_block->is_avail     = false;
 
-bool
-marena_add_data(MArena *arena, void *data, U32 sizeof_data )
-{
-    assert_valid_marena(arena);
-    assert(arena->alloc_context.staging_size != 0);
+        MFListBlock *following_block = mflist__next_block(chunk, aligned_block);
+        if (following_block)
+        {
+            following_block->prev_block = aligned_block;
+        }
 
-    if (!marena_ensure_add_operation_is_possible(arena, sizeof_data))
-    {
-        return marena_add_failure(arena);
+        block->size = head_size - header_size;
+        /* The header of `aligned_block` is not user memory */
+        mflist->total_user_memory_usage -= header_size;
     }
 
-    if (data)
+    /* Give back the tail first, the head may then merge with the previous free block */
+    const U32 kept_size = ALIGN(U32, alloc_size, header_size);
+    if ((chunk->categ != MFListAllocCateg_More)
+        && (aligned_block->size - kept_size >= MFLIST_SEGREGATED_MIN_SPLIT_SIZE))
     {
-        memcpy((U8*) arena->buffer + arena->alloc_context.staging_size,
-               data, sizeof_data);
-    }
+        MFListBlock *tail_block = (MFListBlock*) (aligned_block->payload + kept_size);
+        tail_block->parent_chunk = chunk;
+        tail_block->prev_block   = aligned_block;
+        tail_block->size         = aligned_block->size - kept_size - header_size;
+        tail_block->is_avail     = false;
 
-    arena->alloc_context.staging_size += sizeof_data;
+        MFListBlock *following_block = mflist__next_block(chunk, tail_block);
+        if (following_block)
+        {
+            following_block->prev_block = tail_block;
+        }
 
-    return true;
-}
+        aligned_block->size = kept_size;
+        mflist->total_user_memory_usage -= header_size;
+        mflist__free(mflist, tail_block->payload);
+    }
 
-bool
-marena_add_pointer(MArena *arena, void *pointer)
-{
-    assert_valid_marena(arena);
-    assert(arena->alloc_context.staging_size != 0);
+    if (head_size)
+    {
+        if (chunk->categ == MFListAllocCateg_More)
+        {
+            /* Freeing it would release the whole dedicated chunk */
+            block->is_avail = true;
+            mflist->total_user_memory_usage -= block->size;
+            if (!chunk->segregated)
+            {
+                mflist__update_max_contiguous_block_size_avail(chunk);
+            }
+        }
+        else
+        {
+            mflist__free(mflist, block->payload);
+        }
+    }
 
-    if (!marena_ensure_add_operation_is_possible(arena, (U32) sizeof(void*)))
+    __mflist_assert_integrity(chunk);
+    internal_assert(((usize) aligned_block->payload & (alignment - 1)) == 0);
+
+    if (zero_initialize)
     {
-        return marena_add_failure(arena);
+        memclr(aligned_block->payload, aligned_block->size);
     }
+    return aligned_block->payload;
+}
 
-    *((void **)arena->buffer + arena->alloc_context.staging_size) = pointer;
 
-    arena->alloc_context.staging_size += (U32) sizeof(void*);
-    return true;
+#if DPCRT_ALLOCATOR_STATS
+static inline void
+mflist__update_stats_usage(MFList *mflist)
+{
+    alloc_stats__update_usage(&mflist->stats,
+                              mflist->total_user_memory_usage,
+                              mflist->total_allocator_memory_usage,
+                              mflist->stats.chunk_count);
 }
 
-bool
-marena_add_byte(MArena *arena, byte_t b)
+AllocStats *
+mflist_stats(MFList *mflist)
 {
-    assert_valid_marena(arena);
-    assert(arena->alloc_context.staging_size != 0);
+    mflist__update_stats_usage(mflist);
+    return &mflist->stats;
+}
+#endif
 
-    if (!marena_ensure_add_operation_is_possible(arena, (U32) sizeof(byte_t)))
-    {
-        return marena_add_failure(arena);
-    }
 
-    *((byte_t*) arena->buffer + arena->alloc_context.staging_size) = b;
+void *
+mflist_alloc1(MFList *mflist, U32 alloc_size, bool zero_initialize)
+{
+#if DPCRT_ALLOCATOR_STATS
+    const U64 start = alloc_stats__timestamp();
+    void *result = mflist__alloc1(mflist, alloc_size, zero_initialize);
+    alloc_stats__record_alloc(&mflist->stats, alloc_size, result != NULL, start);
+    mflist__update_stats_usage(mflist);
+    return result;
+#else
+    return mflist__alloc1(mflist, alloc_size, zero_initialize);
+#endif
+}
 
-    arena->alloc_context.staging_size += (U32) sizeof(byte_t);
 
-    return true;
+void *
+mflist_alloc_aligned(MFList *mflist, U32 alloc_size, U32 alignment, bool zero_initialize)
+{
+#if DPCRT_ALLOCATOR_STATS
+    const U64 start = alloc_stats__timestamp();
+    void *result = mflist__alloc_aligned(mflist, alloc_size, alignment, zero_initialize);
+    alloc_stats__record_alloc(&mflist->stats, alloc_size, result != NULL, start);
+    mflist__update_stats_usage(mflist);
+    return result;
+#else
+    return mflist__alloc_aligned(mflist, alloc_size, alignment, zero_initialize);
+#endif
 }
 
-bool
-marena_add_char (MArena *arena, char c)
+
+void
+mflist_free(MFList *mflist, void *ptr)
 {
-    assert_valid_marena(arena);
-    assert(arena->alloc_context.staging_size != 0);
+#if DPCRT_ALLOCATOR_STATS
+    const U64 start = alloc_stats__timestamp();
+    mflist__free(mflist, ptr);
+    alloc_stats__record_free(&mflist->stats, start);
+    mflist__update_stats_usage(mflist);
+#else
+    mflist__free(mflist, ptr);
+#endif
+}
+
 
-    if (!marena_ensure_add_operation_is_possible(arena, (U32) sizeof(char)))
+void *
+mflist_realloc1(MFList *mflist, void *oldptr, U32 newsize, bool zero_initialize)
+{
+#if DPCRT_ALLOCATOR_STATS
+    void *result = mflist__realloc1(mflist, oldptr, newsize, zero_initialize);
+    mflist->stats.realloc_count++;
+    if (!result)
     {
-        return marena_add_failure(arena);
+        mflist->stats.failed_alloc_count++;
     }
+    mflist->stats.size_class_counts[alloc_stats__bucket(newsize)]++;
+    mflist__update_stats_usage(mflist);
+    return result;
+#else
+    return mflist__realloc1(mflist, oldptr, newsize, zero_initialize);
+#endif
+}
 
-    *((char*) arena->buffer + arena->alloc_context.staging_size) = c;
-    arena->alloc_context.staging_size += (U32) sizeof(char);
 
-    return true;
-}
 
 
+/* #############################################################################
+   MArena Implementation
+   #############################################################################
+*/
 
-bool
-marena_add_i8(MArena *arena, I8 i8)
-{
-    assert_valid_marena(arena);
-    assert(arena->alloc_context.staging_size != 0);
 
-    if (!marena_ensure_add_operation_is_possible(arena, (U32) sizeof(I8)))
-    {
-        return marena_add_failure(arena);
-    }
 
-    *((I8*) arena->buffer + arena->alloc_context.staging_size) = i8;
-    arena->alloc_context.staging_size += (U32) sizeof(I8);
 
-    return true;
-}
+#ifndef __DPCRT_MEM_LAYER__ARENA_ALWAYS_FORCE_REALLOC_AT_EVERY_PUSH
+#  define __DPCRT_MEM_LAYER__ARENA_ALWAYS_FORCE_REALLOC_AT_EVERY_PUSH 1
+#endif
 
+/* `MArena` and `MArena64` share the same implementation,
+   parameterised on the size of their references */
+#define MARENA_T         MArena
+#define MARENA_REF_T     MRef
+#define MARENA_SIZE_T    U32
+#define MARENA_FN(NAME)  marena_##NAME
+#include "dpcrt_marena_template_impl.h"
 
-bool
-marena_add_u8(MArena *arena, U8 u8)
-{
-    assert_valid_marena(arena);
-    assert(arena->alloc_context.staging_size != 0);
+#define MARENA_T         MArena64
+#define MARENA_REF_T     MRef64
+#define MARENA_SIZE_T    U64
+#define MARENA_FN(NAME)  marena64_##NAME
+#include "dpcrt_marena_template_impl.h"
 
-    if (!marena_ensure_add_operation_is_possible(arena, (U32) sizeof(U8)))
-    {
-        return marena_add_failure(arena);
-    }
 
-    *((U8*) arena->buffer + arena->alloc_context.staging_size) = u8;
-    arena->alloc_context.staging_size += (U32) sizeof(U8);
 
-    return true;
-}
+/* ##########################################################################
+   MArenaShared Implementation
+   ########################################################################## */
+
+typedef struct MArenaSharedRecordHeader
+{
+    U32 size;
+    /* One of `MArenaSharedRecordState`, the only field written atomically */
+    U32 state;
+} MArenaSharedRecordHeader;
 
+enum MArenaSharedRecordState
+{
+    MArenaSharedRecordState_Pending   = 0,
+    MArenaSharedRecordState_Committed = 1,
+    MArenaSharedRecordState_Dismissed = 2,
+};
 
+#define MARENA_SHARED_RECORD_ALIGNMENT (8)
+#define MARENA_SHARED_RECORD_TOTAL_SIZE(size) \
+    ALIGN(U64, (U64) sizeof(MArenaSharedRecordHeader) + (U64) (size), MARENA_SHARED_RECORD_ALIGNMENT)
 
 
 bool
-marena_add_i16(MArena *arena, I16 i16)
+marena_shared_init(MArenaShared *arena, U32 max_size)
 {
-    assert_valid_marena(arena);
-    assert(arena->alloc_context.staging_size != 0);
+    *arena = (MArenaShared) {0};
+
+    max_size = (U32) PAGE_ALIGN(max_size);
+    const U32 initial_size = (U32) MIN((size_t) max_size, 16 * G_pal.page_size);
 
-    if (!marena_ensure_add_operation_is_possible(arena, (U32) sizeof(I16)))
+    void *buffer = mem_alloc(AllocStrategy_ReserveAddrSpace, max_size, G_pal.page_size);
+    if (!buffer)
     {
-        return marena_add_failure(arena);
+        return false;
     }
 
-    *((I16*) arena->buffer + arena->alloc_context.staging_size) = i16;
-    arena->alloc_context.staging_size += (U32) sizeof(I16);
+    if (!mem_realloc(ReallocStrategy_CommitAddrSpace, buffer, 0, initial_size, G_pal.page_size))
+    {
+        mem_dealloc(DeallocStrategy_ReleaseAddrSpace, buffer, max_size);
+        return false;
+    }
 
+    arena->buffer         = buffer;
+    arena->reserved_size  = max_size;
+    arena->committed_size = initial_size;
+    /* Same as `MArena`, a zero `MRef` is never valid */
+    arena->data_size      = MARENA_MINIMUM_ALLOWED_STACK_POINTER_VALUE;
+    arena->watermark      = MARENA_MINIMUM_ALLOWED_STACK_POINTER_VALUE;
     return true;
 }
 
 
-bool
-marena_add_u16(MArena *arena, U16 u16)
+void
+marena_shared_del(MArenaShared *arena)
 {
-    assert_valid_marena(arena);
-    assert(arena->alloc_context.staging_size != 0);
-
-    if (!marena_ensure_add_operation_is_possible(arena, (U32) sizeof(U16)))
+    if (arena->buffer)
     {
-        return marena_add_failure(arena);
+        mem_dealloc(DeallocStrategy_ReleaseAddrSpace, arena->buffer, arena->reserved_size);
     }
-
-    *((U16*) arena->buffer + arena->alloc_context.staging_size) = u16;
-    arena->alloc_context.staging_size += (U32) sizeof(U16);
-
-    return true;
+    memclr(arena, sizeof(*arena));
 }
 
 
+void
+marena_shared_clear(MArenaShared *arena)
+{
+    /* The headers of the next records must read as pending */
+    const size_t used_size = (size_t) MIN(arena->data_size, (U64) arena->committed_size);
+    memclr(arena->buffer, used_size);
 
+    arena->data_size = MARENA_MINIMUM_ALLOWED_STACK_POINTER_VALUE;
+    arena->watermark = MARENA_MINIMUM_ALLOWED_STACK_POINTER_VALUE;
+}
 
 
-bool
-marena_add_i32(MArena *arena, I32 i32)
+/* Slow path of the writers, the only one that needs a lock */
+static bool
+marena_shared__commit_pages(MArenaShared *arena, U32 needed_size)
 {
-    assert_valid_marena(arena);
-    assert(arena->alloc_context.staging_size != 0);
+    bool result = true;
 
-    if (!marena_ensure_add_operation_is_possible(arena, (U32) sizeof(I32)))
+    spinlock_lock(&arena->commit_lock);
+
+    const U32 committed_size = arena->committed_size;
+    if (needed_size > committed_size)
     {
-        return marena_add_failure(arena);
-    }
+        size_t new_size = (size_t) committed_size + committed_size / 4 + 8 * G_pal.page_size;
+        new_size = PAGE_ALIGN(MAX(new_size, (size_t) needed_size));
+        new_size = MIN(new_size, (size_t) arena->reserved_size);
 
-    *((I32*) arena->buffer + arena->alloc_context.staging_size) = i32;
-    arena->alloc_context.staging_size += (U32) sizeof(I32);
+        if (mem_realloc(ReallocStrategy_CommitAddrSpace, arena->buffer, committed_size, new_size, G_pal.page_size))
+        {
+            atomic_store(&arena->committed_size, (U32) new_size);
+        }
+        else
+        {
+            result = false;
+        }
+    }
 
-    return true;
+    spinlock_unlock(&arena->commit_lock);
+    return result;
 }
 
 
-bool
-marena_add_u32(MArena *arena, U32 u32)
+static U32
+marena_shared__advance_watermark(MArenaShared *arena)
 {
-    assert_valid_marena(arena);
-    assert(arena->alloc_context.staging_size != 0);
+    U32 watermark = atomic_load(&arena->watermark);
 
-    if (!marena_ensure_add_operation_is_possible(arena, (U32) sizeof(U32)))
+    /* Any thread can push the watermark over the records that got committed */
+    while ((U64) watermark < atomic_load(&arena->data_size)
+           && watermark + sizeof(MArenaSharedRecordHeader) <= atomic_load(&arena->committed_size))
     {
-        return marena_add_failure(arena);
-    }
+        MArenaSharedRecordHeader *header = (MArenaSharedRecordHeader *) (arena->buffer + watermark);
+        if (atomic_load(&header->state) == MArenaSharedRecordState_Pending)
+        {
+            break;
+        }
 
-    *((U32*) arena->buffer + arena->alloc_context.staging_size) = u32;
-    arena->alloc_context.staging_size += (U32) sizeof(U32);
+        const U32 next = watermark + (U32) MARENA_SHARED_RECORD_TOTAL_SIZE(header->size);
+        /* On failure `watermark` gets the value set by another thread */
+        if (atomic_compare_exchange(&arena->watermark, &watermark, next))
+        {
+            watermark = next;
+        }
+    }
 
-    return true;
+    return watermark;
 }
 
 
+void *
+marena_shared_begin(MArenaShared *arena, U32 size, MRef *ref)
+{
+    const U64 total_size = MARENA_SHARED_RECORD_TOTAL_SIZE(size);
+    const U64 offset = atomic_fetch_add(&arena->data_size, total_size);
 
+    if (ref)
+    {
+        *ref = 0;
+    }
 
-bool
-marena_add_i64(MArena *arena, I64 i64)
-{
-    assert_valid_marena(arena);
-    assert(arena->alloc_context.staging_size != 0);
+    if (offset + total_size > arena->reserved_size)
+    {
+        return NULL;
+    }
 
-    if (!marena_ensure_add_operation_is_possible(arena, (U32) sizeof(I64)))
+    const U32 end = (U32) (offset + total_size);
+    if (end > atomic_load(&arena->committed_size))
     {
-        return marena_add_failure(arena);
+        if (!marena_shared__commit_pages(arena, end))
+        {
+            assert_msg(0, "Failed to commit pages of the reserved address space");
+            return NULL;
+        }
     }
 
-    *((I64*) arena->buffer + arena->alloc_context.staging_size) = i64;
-    arena->alloc_context.staging_size += (U32) sizeof(I64);
+    MArenaSharedRecordHeader *header = (MArenaSharedRecordHeader *) (arena->buffer + offset);
+    internal_assert(header->state == MArenaSharedRecordState_Pending);
+    header->size = size;
 
-    return true;
+    if (ref)
+    {
+        *ref = (MRef) (offset + sizeof(MArenaSharedRecordHeader));
+    }
+    return header + 1;
 }
 
 
-bool
-marena_add_u64(MArena *arena, U64 u64)
+static inline void
+marena_shared__end(MArenaShared *arena, void *record, enum MArenaSharedRecordState state)
 {
-    assert_valid_marena(arena);
-    assert(arena->alloc_context.staging_size != 0);
+    assert(record);
+    MArenaSharedRecordHeader *header = (MArenaSharedRecordHeader *) record - 1;
+    internal_assert(header->state == MArenaSharedRecordState_Pending);
 
-    if (!marena_ensure_add_operation_is_possible(arena, (U32) sizeof(U64)))
-    {
-        return marena_add_failure(arena);
-    }
+    /* Publishes the payload written by this thread */
+    atomic_store(&header->state, (U32) state);
+    marena_shared__advance_watermark(arena);
+}
 
-    *((U64*) arena->buffer + arena->alloc_context.staging_size) = u64;
-    arena->alloc_context.staging_size += (U32) sizeof(U64);
+void
+marena_shared_commit(MArenaShared *arena, void *record)
+{
+    marena_shared__end(arena, record, MArenaSharedRecordState_Committed);
+}
 
-    return true;
+void
+marena_shared_dismiss(MArenaShared *arena, void *record)
+{
+    marena_shared__end(arena, record, MArenaSharedRecordState_Dismissed);
 }
 
 
-bool
-marena_add_size_t(MArena *arena, size_t s)
+MRef
+marena_shared_push_data(MArenaShared *arena, const void *data, U32 size)
 {
-    assert_valid_marena(arena);
-    assert(arena->alloc_context.staging_size != 0);
-
-    if (!marena_ensure_add_operation_is_possible(arena, (U32) sizeof(size_t)))
+    MRef result = 0;
+    void *record = marena_shared_begin(arena, size, &result);
+    if (record)
     {
-        return marena_add_failure(arena);
+        memcpy(record, data, size);
+        marena_shared_commit(arena, record);
     }
+    return result;
+}
 
-    *((size_t*) arena->buffer + arena->alloc_context.staging_size) = s;
-    arena->alloc_context.staging_size += (U32) sizeof(size_t);
 
-    return true;
+U32
+marena_shared_watermark(MArenaShared *arena)
+{
+    return marena_shared__advance_watermark(arena);
 }
 
-bool
-marena_add_usize(MArena *arena, usize us)
+
+void *
+marena_shared_next_record(MArenaShared *arena, MRef *cursor, U32 *size)
 {
-    assert_valid_marena(arena);
-    assert(arena->alloc_context.staging_size != 0);
+    U32 offset = *cursor ? *cursor : MARENA_MINIMUM_ALLOWED_STACK_POINTER_VALUE;
+    const U32 watermark = marena_shared__advance_watermark(arena);
 
-    if (!marena_ensure_add_operation_is_possible(arena, (U32) sizeof(usize)))
+    while (offset < watermark)
     {
-        return marena_add_failure(arena);
-    }
+        MArenaSharedRecordHeader *header = (MArenaSharedRecordHeader *) (arena->buffer + offset);
+        const U32 record_size = header->size;
+        offset += (U32) MARENA_SHARED_RECORD_TOTAL_SIZE(record_size);
 
-    *((usize*) arena->buffer + arena->alloc_context.staging_size) = us;
-    arena->alloc_context.staging_size += (U32) sizeof(us);
+        if (header->state == MArenaSharedRecordState_Committed)
+        {
+            *cursor = offset;
+            if (size)
+            {
+                *size = record_size;
+            }
+            return header + 1;
+        }
+    }
 
-    return true;
+    *cursor = offset;
+    return NULL;
 }
 
-bool
-marena_add_cstr(MArena *arena, char *cstr)
-{
-    bool result = true;
-    assert_valid_marena(arena);
-    assert(arena->alloc_context.staging_size != 0);
 
-    for (char *s = cstr; *s; s++)
+
+/* ##########################################################################
+   Scratch Arena Implementation
+   ########################################################################## */
+
+static THREAD_LOCAL_STORAGE MArena S_scratch_arenas[SCRATCH_ARENA_COUNT_PER_THREAD];
+
+
+static inline bool
+scratch__is_conflicting(MArena *arena, MArena **conflicts, U32 num_conflicts)
+{
+    for (U32 i = 0; i < num_conflicts; i++)
     {
-        result = marena_add_char(arena, *s);
-        if (!result)
+        if (conflicts[i] == arena)
         {
-            break;
+            return true;
         }
     }
-    if (result)
-    {
-        // Add the null-terminator
-        result = marena_add_char(arena, '\0');
-    }
-    return result;
+    return false;
 }
 
 
+ScratchArena
+scratch_begin(MArena **conflicts, U32 num_conflicts)
+{
+    ScratchArena scratch = {0};
+    assert(num_conflicts == 0 || conflicts);
+
+    for (U32 i = 0; i < SCRATCH_ARENA_COUNT_PER_THREAD; i++)
+    {
+        MArena *arena = &S_scratch_arenas[i];
+        if (scratch__is_conflicting(arena, conflicts, num_conflicts))
+        {
+            continue;
+        }
 
+        if (!arena->buffer)
+        {
+            *arena = marena_new_reserved((U32) SCRATCH_ARENA_RESERVED_SIZE, (U32) (16 * G_pal.page_size));
+            if (!arena->buffer)
+            {
+                break;
+            }
+        }
 
-bool
-marena_add_pstr32( MArena *arena, PStr32 *pstr32 )
-{
-    assert_valid_marena(arena);
-    assert(arena->alloc_context.staging_size != 0);
+        scratch.arena = arena;
+        scratch.checkpoint = arena->data_size;
+        break;
+    }
 
-    return marena_add_data(arena, pstr32, (U32) sizeof(Str32Hdr) + (U32) pstr32->len + U32_LIT(1));
+    assert_msg(scratch.arena, "No scratch arena is available: too many conflicts or the reservation failed");
+    return scratch;
 }
 
 
-bool
-marena_add_str32_nodata( MArena *arena, Str32 str32 )
+void
+scratch_end(ScratchArena scratch)
 {
-    assert_valid_marena(arena);
-    assert(arena->alloc_context.staging_size != 0);
+    MArena *arena = scratch.arena;
+    assert(arena);
+    assert(arena >= S_scratch_arenas && arena < S_scratch_arenas + SCRATCH_ARENA_COUNT_PER_THREAD);
+    assert_msg(arena->data_size >= scratch.checkpoint, "Scratch arenas must be ended in LIFO order");
 
-    return marena_add_data(arena, &str32, (U32) sizeof(Str32Hdr));
+    if (arena->data_size > scratch.checkpoint)
+    {
+        marena_pop_upto(arena, scratch.checkpoint);
+    }
 }
 
 
-bool
-marena_add_str32_withdata( MArena *arena, Str32 str32 )
+void *
+scratch_push(ScratchArena *scratch, U32 size, bool initialize_to_zero)
 {
-    assert_valid_marena(arena);
-    assert(arena->alloc_context.staging_size != 0);
-    assert(str32.len >= 0);
+    MArena *arena = scratch->arena;
+    assert(arena && arena->buffer);
+    assert(size);
 
-    bool result = marena_add_data(arena, &str32, (U32) sizeof(Str32Hdr));
-    if (result)
+    /* The buffer is page aligned, aligning the offset is enough */
+    const U32 aligned_offset = POW2_ALIGN(U32, arena->data_size, SCRATCH_ARENA_DEFAULT_ALIGNMENT);
+    const U32 padding = aligned_offset - arena->data_size;
+    if (size > U32_MAX - padding)
     {
-        U8 *const string_data = (U8*) &str32 + sizeof(Str32Hdr);
-        result = marena_add_data(arena, string_data, (U32) str32.len + U32_LIT(1));
+        return NULL;
     }
-    return result;
+
+    MRef ref = marena_push(arena, padding + size, initialize_to_zero);
+    if (!ref)
+    {
+        return NULL;
+    }
+    return arena->buffer + aligned_offset;
 }
 
 
-bool
-marena_ask_alignment(MArena *arena, U32 alignment)
-{
-    assert(arena && (arena->data_size != 0));
-    const usize curr_addr = (usize) arena->buffer + arena->data_size;
-    const usize aligned_addr = (usize) ALIGN(usize, curr_addr, alignment);
-    const U32 required_bytes_for_alignment = (U32) (aligned_addr - curr_addr);
-    return marena_add(arena, required_bytes_for_alignment, true);
-}
-
-
-#define MARENA_PUSH_WRAPPER_DEF(...)            \
-    marena_begin(arena);                        \
-    __VA_ARGS__;                                \
-    return marena_commit(arena);                \
-
-
-/* @NOTE :: Those functions bundles a `marena_begin()` `marena_commit()`
-   calls for usage convenience */
-MRef marena_push                (MArena *arena, U32 size, bool initialize_to_zero )         { MARENA_PUSH_WRAPPER_DEF(marena_add                (arena, size, initialize_to_zero)) }
-MRef marena_push_data           (MArena *arena, void *data, U32 sizeof_data )               { MARENA_PUSH_WRAPPER_DEF(marena_add_data           (arena, data, sizeof_data)) }
-MRef marena_push_pointer        (MArena *arena, void *pointer)                              { MARENA_PUSH_WRAPPER_DEF(marena_add_pointer        (arena, pointer)) }
-MRef marena_push_byte           (MArena *arena, byte_t b )                                  { MARENA_PUSH_WRAPPER_DEF(marena_add_byte           (arena, b )) }
-MRef marena_push_char           (MArena *arena, char c )                                    { MARENA_PUSH_WRAPPER_DEF(marena_add_char           (arena, c )) }
-MRef marena_push_i8             (MArena *arena, I8 i8 )                                     { MARENA_PUSH_WRAPPER_DEF(marena_add_i8             (arena, i8 )) }
-MRef marena_push_u8             (MArena *arena, U8 u8 )                                     { MARENA_PUSH_WRAPPER_DEF(marena_add_u8             (arena, u8 )) }
-MRef marena_push_i16            (MArena *arena, I16 i16 )                                   { MARENA_PUSH_WRAPPER_DEF(marena_add_i16            (arena, i16 )) }
-MRef marena_push_u16            (MArena *arena, U16 u16 )                                   { MARENA_PUSH_WRAPPER_DEF(marena_add_u16            (arena, u16 )) }
-MRef marena_push_i32            (MArena *arena, I32 i32 )                                   { MARENA_PUSH_WRAPPER_DEF(marena_add_i32            (arena, i32 )) }
-MRef marena_push_u32            (MArena *arena, U32 u32 )                                   { MARENA_PUSH_WRAPPER_DEF(marena_add_u32            (arena, u32 )) }
-MRef marena_push_i64            (MArena *arena, I64 i64 )                                   { MARENA_PUSH_WRAPPER_DEF(marena_add_i64            (arena, i64 )) }
-MRef marena_push_u64            (MArena *arena, U64 u64 )                                   { MARENA_PUSH_WRAPPER_DEF(marena_add_u64            (arena, u64 )) }
-MRef marena_push_size_t         (MArena *arena, size_t s )                                  { MARENA_PUSH_WRAPPER_DEF(marena_add_size_t         (arena, s )) }
-MRef marena_push_usize          (MArena *arena, usize us )                                  { MARENA_PUSH_WRAPPER_DEF(marena_add_usize          (arena, us )) }
-MRef marena_push_cstr           (MArena *arena, char* cstr )                                { MARENA_PUSH_WRAPPER_DEF(marena_add_cstr           (arena, cstr )) }
-MRef marena_push_pstr32         (MArena *arena, PStr32 *pstr32 )                            { MARENA_PUSH_WRAPPER_DEF(marena_add_pstr32        (arena, pstr32 )) }
-MRef marena_push_str32_nodata   (MArena *arena, Str32 str32 )                               { MARENA_PUSH_WRAPPER_DEF(marena_add_str32_nodata   (arena, str32 )) }
-MRef marena_push_str32_withdata (MArena *arena, Str32 str32 )                               { MARENA_PUSH_WRAPPER_DEF(marena_add_str32_withdata (arena, str32 )) }
-MRef marena_push_alignment      (MArena *arena, U32 alignment)                              { MARENA_PUSH_WRAPPER_DEF(marena_ask_alignment      (arena, alignment)) }
+void
+scratch_thread_release(void)
+{
+    for (U32 i = 0; i < SCRATCH_ARENA_COUNT_PER_THREAD; i++)
+    {
+        if (S_scratch_arenas[i].buffer)
+        {
+            marena_del(&S_scratch_arenas[i]);
+        }
+    }
+}
@@ -25,6 +25,8 @@
 #include "dpcrt_types.h"
 #include "dpcrt_utils.h"
 #include "dpcrt_mem.h"
+#include "dpcrt_sync.h"
+#include <stdc/stdio.h>
 
 
 #if 0
@@ -72,6 +74,62 @@ typedef struct AllocationChunk
 #endif
 
 
+/* Opt-in instrumentation of `MPool`, `MFList`, `MArena` and `MArena64`.
+   Compile the library with `-DDPCRT_ALLOCATOR_STATS=1` and every allocator gets
+   a `stats` field, updated at every allocation and free. Without the define
+   the instrumentation costs nothing: the field and the functions below do not exist.
+   @EXAMPLE
+   ~~~~
+   #if DPCRT_ALLOCATOR_STATS
+       alloc_stats_dump(mpool_stats(&nodes), "nodes", stderr);
+   #endif
+   ~~~~
+   @NOTE :: Latencies are measured in CPU cycles (`rdtsc` on x86). `MArena` records
+   only counts and sizes: its `begin` / `commit` pairs are not meaningful to time. */
+#ifndef DPCRT_ALLOCATOR_STATS
+#  define DPCRT_ALLOCATOR_STATS 0
+#endif
+
+#if DPCRT_ALLOCATOR_STATS
+
+/* Bucket `i` of the histograms counts the values in the [2^i, 2^(i+1)) range
+   (bucket 0 counts the zeroes too). The last bucket is unbounded. */
+#define ALLOC_STATS_HISTOGRAM_BUCKET_COUNT (32)
+
+typedef struct AllocStats
+{
+    U64 alloc_count;
+    U64 free_count;
+    U64 realloc_count;
+    U64 failed_alloc_count;
+
+    /* Bytes handed out to the user (as accounted by the allocator, eg
+       the `MPool` accounts for whole blocks) */
+    U64 live_bytes;
+    U64 peak_live_bytes;
+
+    /* Bytes mapped by the allocator */
+    U64 reserved_bytes;
+    U64 peak_reserved_bytes;
+
+    U64 chunk_count;
+    U64 peak_chunk_count;
+
+    /* Histogram of the requested sizes */
+    U64 size_class_counts[ALLOC_STATS_HISTOGRAM_BUCKET_COUNT];
+    /* Histograms of the latency in cycles */
+    U64 alloc_latency_histogram[ALLOC_STATS_HISTOGRAM_BUCKET_COUNT];
+    U64 free_latency_histogram[ALLOC_STATS_HISTOGRAM_BUCKET_COUNT];
+} AllocStats;
+
+/* Ratio of the reserved memory not handed out to the user: `1 - live / reserved` */
+F64   alloc_stats_fragmentation (AllocStats *stats);
+void  alloc_stats_reset         (AllocStats *stats);
+void  alloc_stats_dump          (AllocStats *stats, const char *name, FILE *stream);
+
+#endif
+
+
 typedef struct MPoolBlock
 {
     /* Flag marking if ALL the following blocks up to the end of the
@@ -88,9 +146,30 @@ typedef struct MPoolBlock
 
 typedef struct MPoolChunk
 {
+    /* The pool this chunk was mapped for. It lives in the header page which
+       is never decommitted, so it can always be read to catch blocks freed to
+       the wrong pool. It is a cheap sanity check, not a guard: see `mpool_free` */
+    struct MPool      *owner;
     struct MPoolChunk *next_chunk;
     struct MPoolBlock *next_block;
 
+    /* Doubly linked chain of the chunks that still have at least one free block.
+       A chunk is unlinked as soon as its last block gets allocated and it is
+       linked back as soon as one of its blocks gets freed. This allows
+       `mpool_alloc` to find a usable chunk in O(1) regardless of how many
+       full chunks the pool accumulated. */
+    struct MPoolChunk *prev_avail_chunk;
+    struct MPoolChunk *next_avail_chunk;
+
+    U32    used_block_count;
+    /* The pages of this (empty) chunk past its first one were given back
+       to the OS, see `mpool_set_max_warm_chunks` */
+    bool32 decommitted;
+
+    /* Offset of the first block from the start of this chunk,
+       it differs from chunk to chunk when colouring is enabled */
+    U32    first_block_offset;
+
     /* ---- */
     U8 payload[];
 } MPoolChunk;
@@ -103,14 +182,49 @@ typedef struct MPool
     U16   block_size;
     bool8 allocate_more_chunks_on_demand;
 
+    /* Every chunk is mapped at an address multiple of this value (the
+       power of 2 greater or equal to `chunk_size`). The owning chunk
+       of a block can thus be found by simply masking its address. */
+    U32   chunk_alignment;
+
+    /* Chunks are backed by 2MB huge pages, see `mpool_init_huge_pages` */
+    bool8 huge_pages;
+
+    /* Offset of the first block from the start of its chunk. It is a
+       multiple of the block alignment, see `mpool_init_aligned` */
+    U32   first_block_offset;
+
+    /* Chunk colouring, see `mpool_init_cache_aware`. Each new chunk shifts its
+       first block by `next_colour` cache lines past `first_block_offset`,
+       cycling through `colour_count` different offsets (1 means no colouring) */
+    U32   colour_count;
+    U32   next_colour;
+
     size_t total_allocator_memory_usage;
     size_t total_user_memory_usage;
 
     MPoolChunk *first_chunk;
+    MPoolChunk *first_avail_chunk;
+
+    /* Empty chunks are never unmapped (except by `mpool_del`). Up to `max_warm_chunks`
+       of them are kept committed, the pages of any other empty chunk are given back
+       to the OS while keeping the address range mapped for later reuse. */
+    U32 max_warm_chunks;
+    U32 warm_chunk_count;
+
+#if DPCRT_ALLOCATOR_STATS
+    AllocStats stats;
+#endif
 } MPool;
 
 
 
+/* Number of empty chunks an `MPool` or an `MFList` keeps committed by default */
+#ifndef ALLOCATOR_DEFAULT_MAX_WARM_CHUNKS
+#  define ALLOCATOR_DEFAULT_MAX_WARM_CHUNKS (4)
+#endif
+
+
 /* Simple MPool Allocator
    The block size determines the maximum possible
    allocatable size ( a high block_size value may
@@ -126,18 +240,231 @@ typedef struct MPool
        void *q = mpool_alloc(mpool, 1024);         // returns NULL, the allocator cannot fit 1024 bytes of data
        mpool_free(mpool, p);                       // frees the block associated to pointer q
        mpool_clear(mpool);                         // frees EVERY BLOCK, but the actual memory is not unmapped, and it will be reused in subsequent `_alloc` calls
+                                                   //    (the pages of the chunks exceeding the warm chunks limit are given back to the OS)
        mpool_del(mpool);                           // Invalidates the mpool, unmaps the memory letting the OS reclaim it
    }
 */
 
 /* @NOTE :: `allocate_more_chunks_on_demand` allows the arena to try ask the OS to map more memory
-   if it is required in order to fit a new allocation request. */
+   if it is required in order to fit a new allocation request.
+   @NOTE :: Every chunk records the address of its `MPool`: once initialized an `MPool`
+   must not be moved (or copied) for as long as it is in use. */
 bool  mpool_init_aux (MPool *mpool, U32 chunk_size, U16 block_size, bool8 allocate_more_chunks_on_demand );
 bool  mpool_init     (MPool *mpool, U16 block_size);
+/* Same as `mpool_init_aux` but the chunks are backed by explicit 2MB huge pages
+   (or transparent huge pages as a fallback, see `mem_mmap_huge`), which cuts the TLB
+   misses of pools with many live blocks. `chunk_size` is rounded up to `MEM_HUGE_PAGE_SIZE`. */
+bool  mpool_init_huge_pages (MPool *mpool, U32 chunk_size, U16 block_size, bool8 allocate_more_chunks_on_demand );
+/* Same as `mpool_init_aux` but every block is aligned to `block_alignment` (a power of 2
+   up to the page size), eg 64 for cache line aligned blocks or 32 for AVX vectors.
+   `block_size` is rounded up to a multiple of `block_alignment`. */
+bool  mpool_init_aligned (MPool *mpool, U32 chunk_size, U16 block_size, U16 block_alignment, bool8 allocate_more_chunks_on_demand );
+/* Meant for objects written by different cores (eg per connection state): every block
+   is padded to a multiple of `CACHE_LINE_SIZE` so that no two blocks share a cache line.
+   The first block of each chunk is also shifted by a different number of cache lines
+   (chunk colouring), otherwise the first blocks of every chunk, all mapped at the same
+   offset from a `chunk_alignment` boundary, would compete for the same cache sets.
+   Colouring uses the slack at the end of the chunk, possibly giving up one block per chunk. */
+bool  mpool_init_cache_aware (MPool *mpool, U32 chunk_size, U16 block_size, bool8 allocate_more_chunks_on_demand );
 void* mpool_alloc    (MPool *mpool, U16 size);
+/* @NOTE :: `ptr` must be a block handed out by this `mpool` (and not freed yet).
+   The owning chunk is found by masking `ptr`, freeing any other pointer is undefined
+   behaviour: it may be ignored, or it may read unmapped memory. */
 void  mpool_free     (MPool *mpool, void *ptr);
+/* Bulk versions of `mpool_alloc` and `mpool_free`, meant for building or tearing down
+   whole trees and graphs. `mpool_alloc_batch` fills `out` with up to `count` (zeroed) blocks
+   and returns how many it could allocate: runs of never used blocks are carved out of a chunk
+   in one step. `mpool_free_batch` splices every run of `ptrs` belonging to the same chunk
+   back into its free list at once (frees are cheaper when `ptrs` are grouped by chunk,
+   eg in allocation order). Every pointer in `ptrs` has the same requirements of `mpool_free`. */
+U32   mpool_alloc_batch (MPool *mpool, U32 count, void **out);
+void  mpool_free_batch  (MPool *mpool, U32 count, void **ptrs);
 void  mpool_clear    (MPool *mpool);
 void  mpool_del      (MPool *mpool);
+/* Sets how many empty chunks are kept committed (`ALLOCATOR_DEFAULT_MAX_WARM_CHUNKS` by default).
+   When a free empties a chunk past this limit its pages are given back to the OS
+   (`pal_uncommit_addr_space`), the chunk stays mapped and is refilled on demand.
+   The hysteresis avoids paying a page fault storm on workloads that repeatedly
+   fill and drain the pool. `U32_MAX` never gives back memory.
+   @NOTE :: Chunks backed by huge pages are never decommitted */
+void  mpool_set_max_warm_chunks (MPool *mpool, U32 max_warm_chunks);
+#if DPCRT_ALLOCATOR_STATS
+AllocStats* mpool_stats (MPool *mpool);
+#endif
+
+
+
+/* Thread safe front-end of an `MPool`.
+   Every thread keeps a small magazine (a stack of free blocks) for each
+   `MPoolShared` it touches. Allocations and frees are served from the
+   magazine without any locking, only when the magazine runs empty (or full)
+   the thread takes the lock of the shared depot and refills (or drains)
+   half a magazine worth of blocks in one go.
+   Blocks are interchangeable, thus a block allocated from a thread
+   can be freed from any other thread: it will simply end up in the magazine
+   of the freeing thread.
+
+   @NOTE :: A thread exiting (or done using the pool) should call
+   `mpool_shared_flush_thread_cache` to give back the blocks cached in its
+   magazine to the depot, otherwise those blocks are leaked until `mpool_shared_del`.
+   `mpool_shared_init` and `mpool_shared_del` are NOT thread safe.
+
+   @EXAMPLE USAGE:
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+   static MPoolShared nodes;
+   mpool_shared_init(&nodes, sizeof(Node));
+   ...
+   // From any thread
+   Node *n = mpool_shared_alloc(&nodes, sizeof(Node));
+   ...
+   mpool_shared_free(&nodes, n);
+   ...
+   // Before the worker thread exits
+   mpool_shared_flush_thread_cache(&nodes);
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+*/
+
+/* Number of blocks each thread can cache for every `MPoolShared` */
+#define MPOOL_SHARED_MAGAZINE_SIZE         (64)
+/* Maximum number of `MPoolShared` a single thread can cache blocks for.
+   Additional pools still work but they always go through the depot lock. */
+#define MPOOL_SHARED_MAX_POOLS_PER_THREAD  (8)
+/* Maximum number of `MPoolShared` alive at the same time that can make use of
+   the thread caches. Additional pools still work but they always go through
+   the depot lock. Must be a power of 2. */
+#define MPOOL_SHARED_MAX_LIVE_POOLS        (1024)
+
+typedef struct MPoolShared
+{
+    SpinLock depot_lock;
+    /* Unique identifier of the pool, used by the thread
+       caches to find their magazine for this pool.
+       0 if the pool could not be registered (no thread caching) */
+    U32      id;
+    MPool    depot;
+} MPoolShared;
+
+bool  mpool_shared_init_aux           (MPoolShared *shared, U32 chunk_size, U16 block_size);
+bool  mpool_shared_init               (MPoolShared *shared, U16 block_size);
+void* mpool_shared_alloc              (MPoolShared *shared, U16 size);
+void  mpool_shared_free               (MPoolShared *shared, void *ptr);
+void  mpool_shared_flush_thread_cache (MPoolShared *shared);
+void  mpool_shared_del                (MPoolShared *shared);
+
+
+
+/* Typed object pool handing out 32 bit generational handles instead of pointers.
+   Live objects are kept densely packed (freeing an object moves the last one
+   in its place), so that all of them can be iterated as a plain C array.
+   A handle is made of a slot index (`MSLAB_HANDLE_INDEX_BITS` low bits) and the
+   generation of that slot (high bits): freeing an object bumps the generation
+   of its slot, so stale handles are detected and resolve to NULL.
+   The handle `0` is never handed out and can be used as the NULL handle.
+   Storage is reserved upfront for `max_objects` and committed on demand: the
+   objects never relocate, but a pointer resolved from a handle is only valid up
+   to the next `mslab_free` (which may move an object in the freed place).
+
+   @EXAMPLE USAGE:
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+   MSlab entities;
+   MSLAB_INIT(&entities, Entity, 100000);
+
+   MSlabHandle h = mslab_alloc(&entities);    // Zero initialized
+   MSLAB_GET(Entity, &entities, h)->hp = 100;
+   ...
+   Entity *it = MSLAB_ITEMS(Entity, &entities);
+   for (U32 i = 0; i < entities.count; i++)
+   {
+       update(&it[i]);
+   }
+   ...
+   mslab_free(&entities, h);
+   assert(MSLAB_GET(Entity, &entities, h) == NULL);
+   mslab_del(&entities);
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+*/
+#ifndef MSLAB_HANDLE_INDEX_BITS
+#  define MSLAB_HANDLE_INDEX_BITS (20)
+#endif
+#define MSLAB_HANDLE_INDEX_MASK       ((U32) ((1u << MSLAB_HANDLE_INDEX_BITS) - 1))
+#define MSLAB_HANDLE_GENERATION_MASK  ((U32) (U32_MAX >> MSLAB_HANDLE_INDEX_BITS))
+/* Maximum number of live objects a single `MSlab` can hold */
+#define MSLAB_MAX_OBJECTS             (MSLAB_HANDLE_INDEX_MASK + 1)
+
+typedef U32 MSlabHandle;
+
+typedef struct MSlabSlot
+{
+    /* Position of the object in the dense array while the slot is used,
+       otherwise the next slot of the free list */
+    U32 index;
+    /* Odd while the slot holds an object, even while it is in the free list.
+       Thus a live handle never has a 0 generation */
+    U32 generation;
+} MSlabSlot;
+
+typedef struct MSlab
+{
+    /* Dense array of `count` live objects, `object_size` bytes each */
+    U8          *objects;
+    /* For every object, the slot owning it */
+    U32         *object_slots;
+    /* Sparse table indexed by the handles */
+    MSlabSlot   *slots;
+
+    U32          object_size;
+    U32          count;
+    U32          max_objects;
+    /* Number of slots ever handed out, slots past it were never used */
+    U32          slot_count;
+    /* Head of the free list of the slots, `U32_MAX` if empty */
+    U32          first_free_slot;
+    /* Number of objects (and slots) the committed memory can hold */
+    U32          committed_count;
+} MSlab;
+
+#define MSLAB_INIT(slab, TYPE, max_objects)  mslab_init((slab), (U32) sizeof(TYPE), (max_objects))
+#define MSLAB_ITEMS(TYPE, slab)              ((TYPE *) (slab)->objects)
+#define MSLAB_GET(TYPE, slab, handle)        ((TYPE *) mslab_get((slab), (handle)))
+
+bool         mslab_init   (MSlab *slab, U32 object_size, U32 max_objects);
+void         mslab_del    (MSlab *slab);
+/* Returns 0 if the slab is full */
+MSlabHandle  mslab_alloc  (MSlab *slab);
+void         mslab_free   (MSlab *slab, MSlabHandle handle);
+/* Frees every object, every handle handed out so far becomes stale */
+void         mslab_clear  (MSlab *slab);
+
+static inline void *
+mslab_get(MSlab *slab, MSlabHandle handle)
+{
+    const U32 slot_index = handle & MSLAB_HANDLE_INDEX_MASK;
+    const U32 generation = handle >> MSLAB_HANDLE_INDEX_BITS;
+
+    /* An even generation is the one of a free slot, whose `index` is a free list link */
+    if ((slot_index >= slab->slot_count)
+        || ((generation & 1) == 0)
+        || (slab->slots[slot_index].generation != generation))
+    {
+        return NULL;
+    }
+    return slab->objects + (size_t) slab->slots[slot_index].index * slab->object_size;
+}
+
+static inline bool
+mslab_is_valid(MSlab *slab, MSlabHandle handle)
+{
+    return mslab_get(slab, handle) != NULL;
+}
+
+/* Handle of the object at position `index` of the dense array */
+static inline MSlabHandle
+mslab_handle_at(MSlab *slab, U32 index)
+{
+    assert(index < slab->count);
+    const U32 slot_index = slab->object_slots[index];
+    return (slab->slots[slot_index].generation << MSLAB_HANDLE_INDEX_BITS) | slot_index;
+}
 
 
 
@@ -190,11 +517,76 @@ typedef struct MFListChunk
        is full and there's no available block for allocation. */
     U32 max_contiguous_block_size_avail;
     U8 categ;
+    /* The free blocks of this chunk are tracked from the `MFListSizeClassIndex`
+       instead of the `max_contiguous_block_size_avail` field */
+    bool8 segregated;
+    /* The chunk is made of a single free block */
+    bool8 empty;
+    /* The pages of this (empty) chunk past its first one were given back
+       to the OS, see `mflist_set_max_warm_chunks` */
+    bool8 decommitted;
     /* ---- */
     /* U8 payload[]; */
 } MFListChunk;
 
 
+/* Compact mode (see `mflist_init_compact`): allocations up to `MFLIST_COMPACT_MAX_SIZE`
+   bytes carry no `MFListBlock` header. They are served from fixed size chunks holding
+   blocks of a single size class, all carved from one reserved address range.
+   The owning chunk of a block is found by masking its address, and whether a block
+   is in use is only recorded in the bitmap of its chunk. */
+#define MFLIST_COMPACT_MAX_SIZE         (64)
+#define MFLIST_COMPACT_GRANULARITY      (16)
+#define MFLIST_COMPACT_CLASS_COUNT      (MFLIST_COMPACT_MAX_SIZE / MFLIST_COMPACT_GRANULARITY)
+#define MFLIST_COMPACT_CHUNK_SIZE       ((U32) KILOBYTES(64))
+#define MFLIST_COMPACT_BITMAP_WORDS     (MFLIST_COMPACT_CHUNK_SIZE / MFLIST_COMPACT_GRANULARITY / 64)
+/* Address space reserved up front for the compact chunks. Once it is exhausted
+   small allocations fall back to regular blocks. */
+#ifndef MFLIST_COMPACT_REGION_SIZE
+#  define MFLIST_COMPACT_REGION_SIZE    ((size_t) GIGABYTES(1))
+#endif
+
+typedef struct MFListCompactChunk
+{
+    /* Chain of the chunks of the same size class having at least one free block,
+       or of the empty chunks (`next_chunk` only) */
+    struct MFListCompactChunk *prev_chunk;
+    struct MFListCompactChunk *next_chunk;
+
+    U32    block_size;
+    U32    block_count;
+    U32    used_block_count;
+    /* No bitmap word before this one has a free block */
+    U32    first_free_word;
+    /* The pages of this (empty) chunk past its first one were given back to the OS */
+    bool32 decommitted;
+
+    /* One bit per block, set when the block is in use */
+    U64    used_bitmap[MFLIST_COMPACT_BITMAP_WORDS];
+    /* ---- */
+    /* U8 blocks[]; */
+} MFListCompactChunk;
+
+
+
+/* Number of second level subdivisions (log2) of every power of 2 size class */
+#define MFLIST_SL_INDEX_COUNT_LOG2 (2)
+#define MFLIST_SL_INDEX_COUNT      (1 << MFLIST_SL_INDEX_COUNT_LOG2)
+#define MFLIST_FL_INDEX_COUNT      (32)
+
+/* Two level segregated fit index (TLSF).
+   Free blocks are binned into size classes: the first level is the power of 2
+   of the block size, the second level linearly splits every power of 2 range into
+   `MFLIST_SL_INDEX_COUNT` sub ranges. Every size class has its own free list,
+   and the bitmaps record which free lists are non empty, so that the smallest
+   size class able to satisfy a request can be found with 2 bit scans. */
+typedef struct MFListSizeClassIndex
+{
+    U32                 fl_bitmap;
+    U32                 sl_bitmap[MFLIST_FL_INDEX_COUNT];
+    struct MFListBlock *free_blocks[MFLIST_FL_INDEX_COUNT][MFLIST_SL_INDEX_COUNT];
+} MFListSizeClassIndex;
+
 
 /* @NOTE :: The `mflist` uses internal assertion for
    verifying correctness. If an internal
@@ -217,6 +609,34 @@ typedef struct MFList
        - index 6: Contains unbounded allocations that do not fit in the previous categories (More than 512K).
                   These allocations gets dedicated new chunks per allocation (eg 1 mmap per allocation) */
     MFListChunk *chunks[6];
+
+    /* When set the free blocks of all the categories (except the unbounded one)
+       are tracked with the `size_classes` index. Allocations and frees
+       become O(1) instead of scanning chunks and blocks linearly.
+       See `mflist_init_aux`. */
+    bool8                segregated;
+    MFListSizeClassIndex size_classes;
+
+    /* Chunks are backed by 2MB huge pages, see `mflist_init_aux` */
+    bool8                huge_pages;
+
+    /* Header-free small allocations, see `mflist_init_compact` */
+    bool8                compact;
+    U8                  *compact_region;
+    U32                  compact_region_used;
+    MFListCompactChunk  *compact_chunks[MFLIST_COMPACT_CLASS_COUNT];
+    MFListCompactChunk  *compact_empty_chunks;
+    U32                  compact_warm_chunk_count;
+
+    /* Limit of empty chunks kept committed, see `mflist_set_max_warm_chunks`.
+       It is stored biased by one so that a zero initialized MFList
+       selects `ALLOCATOR_DEFAULT_MAX_WARM_CHUNKS`. */
+    U32                  warm_chunks_limit;
+    U32                  warm_chunk_count;
+
+#if DPCRT_ALLOCATOR_STATS
+    AllocStats           stats;
+#endif
 } MFList;
 
 
@@ -274,11 +694,49 @@ typedef struct MFList
 
  */
 static inline bool mflist_init(MFList *mflist) { memclr(mflist, sizeof(MFList)); return true; }
+
+/* Allows to opt in the segregated fit allocation mode (`segregated = true`).
+   It is meant for mixed size workloads with many live allocations: finding a fitting
+   free block and coalescing freed blocks is done in constant time using a TLSF index
+   of size classes (powers of 2 with `MFLIST_SL_INDEX_COUNT` sub-steps each).
+   The mode cannot be changed once the MFList started allocating.
+   With `huge_pages = true` every chunk gets backed by explicit 2MB huge pages (or transparent
+   huge pages as a fallback, see `mem_mmap_huge`): chunk sizes are rounded up to `MEM_HUGE_PAGE_SIZE`. */
+static inline bool mflist_init_aux(MFList *mflist, bool segregated, bool huge_pages)
+{
+    memclr(mflist, sizeof(MFList));
+    mflist->segregated = segregated;
+    mflist->huge_pages = huge_pages;
+    return true;
+}
+/* Same as `mflist_init_aux` with the compact mode enabled: allocations up to
+   `MFLIST_COMPACT_MAX_SIZE` bytes are rounded to a multiple of `MFLIST_COMPACT_GRANULARITY`
+   and served from per size class chunks without any per block header, halving
+   the memory used by workloads made of many tiny objects (16~64 bytes).
+   The metadata of these blocks lives in a per chunk bitmap, their chunk is
+   found by masking the address. Compact blocks are 16 bytes aligned. */
+static inline bool mflist_init_compact(MFList *mflist, bool segregated, bool huge_pages)
+{
+    mflist_init_aux(mflist, segregated, huge_pages);
+    mflist->compact = true;
+    return true;
+}
 void* mflist_alloc1   (MFList *mflist, U32 alloc_size, bool zero_initialize);
+/* The returned payload is aligned to `alignment` (any power of 2), eg 64 for cache lines
+   or 32 for AVX vectors. Release it with `mflist_free` as any other allocation.
+   @NOTE :: `mflist_realloc` does not preserve the alignment */
+void* mflist_alloc_aligned (MFList *mflist, U32 alloc_size, U32 alignment, bool zero_initialize);
 void  mflist_free     (MFList *mflist, void *ptr);
 void* mflist_realloc1 (MFList *mflist, void *oldptr, U32 newsize, bool zero_initialize);
 void  mflist_clear    (MFList *mflist);
 void  mflist_del      (MFList *mflist);
+/* Same policy of `mpool_set_max_warm_chunks`: up to `max_warm_chunks` empty chunks
+   are kept committed, the pages of the other empty chunks are given back to the OS.
+   Dedicated chunks of unbounded allocations are still unmapped as soon as they get freed. */
+void  mflist_set_max_warm_chunks (MFList *mflist, U32 max_warm_chunks);
+#if DPCRT_ALLOCATOR_STATS
+AllocStats* mflist_stats (MFList *mflist);
+#endif
 static inline void* mflist_alloc    (MFList *mflist, U32 size) { return mflist_alloc1(mflist, size, true); }
 static inline void* mflist_realloc  (MFList *mflist, void *ptr, U32 newsize) { return mflist_realloc1(mflist, ptr, newsize, true); }
 
@@ -299,146 +757,177 @@ typedef U32 MRef;
 
 
 
-typedef struct MArenaAtomicAllocationContext
-{
-    bool32 failed;
-    U32    staging_size;
-} MArenaAtomicAllocationContext;
-
 #define MARENA_MINIMUM_ALLOWED_STACK_POINTER_VALUE (16)
 
-typedef struct MArena {
-    /* For internal usage only */
-    MArenaAtomicAllocationContext alloc_context;
-    enum AllocStrategy   alloc_strategy;
-    enum ReallocStrategy realloc_strategy;
-    enum DeallocStrategy dealloc_strategy;
-    /* ------------------- */
-
-    U32                   data_size;
-    U32                   data_max_size;
-
-    U8* buffer;
-} MArena;
-
-
-MArena           marena_new_aux        ( enum AllocStrategy alloc_strategy,
-                                         enum ReallocStrategy realloc_strategy,
-                                         enum DeallocStrategy dealloc_strategy,
-                                         U32 size );
-MArena           marena_new            ( U32 size, bool may_grow );
-void             marena_del            ( MArena *arena );
-
-void             marena_pop_upto       ( MArena *arena, MRef ref );
-void             marena_fetch          ( MArena *arena, MRef ref, void *output, U32 sizeof_elem );
-void             marena_clear          ( MArena *arena );
-
-
-/* Beging an atomic allocation context, you can start building up data incrementally
-   directly on the arena. When calling `marena_commit` the data built up to that
-   moment if there wasn't any error is going to be commited updating the `stack_pointer`
-   and making the data actually ""visible"" to the user by returning a valid `MRef` to
-   it.
-   If you want to abort an atomic allocation context call `marena_dismiss`
-   The `marena_add_xxxx` functionality allows you to construct data incrementally. They
-   all return a bool saying if the request successed. You can choose to handle
-   the failure right away by calling `marena_dismiss`, or just pretend
-   nothing happened and keep pushing to it, once you will call `marena_commit`
-   the function will return you a `MRef = 0` since one of the allocation failed.
-
-   Between `marena_add_xxx` calls no alignment will be performed from the stack allocator,
-   if you want alignment for performance reasons you must ask it explicitly.
-*/
-void             marena_begin              (MArena *arena);
+/* Stack like arena handing out `MRef` offsets to its data. Every function of
+   `MArena` and of its 64 bit variant `MArena64` is generated from the same
+   template, see `dpcrt_marena_template.h` for the documented API. */
+#define MARENA_T         MArena
+#define MARENA_CTX_T     MArenaAtomicAllocationContext
+#define MARENA_REF_T     MRef
+#define MARENA_SIZE_T    U32
+#define MARENA_FN(NAME)  marena_##NAME
+#include "dpcrt_marena_template.h"
 
-bool             marena_add                (MArena *arena, U32 sizeof_data, bool initialize_to_zero );
-bool             marena_add_data           (MArena *arena, void *data, U32 sizeof_data );
-bool             marena_add_pointer        (MArena *arena, void *pointer);
-bool             marena_add_byte           (MArena *arena, byte_t b );
-bool             marena_add_char           (MArena *arena, char c );
-bool             marena_add_i8             (MArena *arena, I8 i8 );
-bool             marena_add_u8             (MArena *arena, U8 u8 );
-bool             marena_add_i16            (MArena *arena, I16 i16 );
-bool             marena_add_u16            (MArena *arena, U16 u16 );
-bool             marena_add_i32            (MArena *arena, I32 i32 );
-bool             marena_add_u32            (MArena *arena, U32 u32 );
-bool             marena_add_i64            (MArena *arena, I64 i64 );
-bool             marena_add_u64            (MArena *arena, U64 u64 );
-bool             marena_add_size_t         (MArena *arena, size_t s );
-bool             marena_add_usize          (MArena *arena, usize us );
-bool             marena_add_cstr           (MArena *arena, char* cstr );
-bool             marena_add_pstr32         (MArena *arena, PStr32 *pstr32 );
-bool             marena_add_str32_nodata   (MArena *arena, Str32 str32 );
-bool             marena_add_str32_withdata (MArena *arena, Str32 str32 );
-bool             marena_ask_alignment      (MArena *arena, U32 alignment);
 
-void             marena_dismiss            (MArena *arena);
-MRef             marena_commit             (MArena *arena);
 
 
 
+/* Multi producer append only arena.
+   Any number of threads can append records concurrently without taking any lock:
+   space for a record is reserved with an atomic fetch-add on the stack pointer,
+   then each thread writes its own record and commits it.
+   Readers only see the records below the committed watermark: the watermark
+   stops at the first record that is still being written, so every record below it
+   is guaranteed to be fully written (even if it was committed after the records following it).
+   Every record is prefixed by a small header and starts at an 8 bytes aligned offset.
+   The address space is reserved up front (see `marena_new_reserved`) and committed on demand,
+   so the records never move. Only committing more pages takes a lock.
 
+   @NOTE :: Every record returned by `marena_shared_begin` must be either committed or
+   dismissed, a pending record holds back the watermark.
+   `marena_shared_init`, `marena_shared_clear` and `marena_shared_del` are NOT thread safe.
 
-MRef marena_push                (MArena *arena, U32 sizeof_data, bool initialize_to_zero );
-MRef marena_push_data           (MArena *arena, void *data, U32 sizeof_data );
-MRef marena_push_pointer        (MArena *arena, void *pointer);
-MRef marena_push_byte           (MArena *arena, byte_t b );
-MRef marena_push_char           (MArena *arena, char c );
-MRef marena_push_i8             (MArena *arena, I8 i8 );
-MRef marena_push_u8             (MArena *arena, U8 u8 );
-MRef marena_push_i16            (MArena *arena, I16 i16 );
-MRef marena_push_u16            (MArena *arena, U16 u16 );
-MRef marena_push_i32            (MArena *arena, I32 i32 );
-MRef marena_push_u32            (MArena *arena, U32 u32 );
-MRef marena_push_i64            (MArena *arena, I64 i64 );
-MRef marena_push_u64            (MArena *arena, U64 u64 );
-MRef marena_push_size_t         (MArena *arena, size_t s );
-MRef marena_push_usize          (MArena *arena, usize us );
-MRef marena_push_cstr           (MArena *arena, char* cstr );
-MRef marena_push_pstr32         (MArena *arena, PStr32 *pstr32 );
-MRef marena_push_str32_nodata   (MArena *arena, Str32 str32 );
-MRef marena_push_str32_withdata (MArena *arena, Str32 str32 );
-MRef marena_push_alignment      (MArena *arena, U32 alignment);
+   @EXAMPLE USAGE:
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+   // From any writer thread
+   LogRecord *r = marena_shared_begin(&log, sizeof(LogRecord), NULL);
+   if (r)
+   {
+       r->timestamp = now;
+       ...
+       marena_shared_commit(&log, r);
+   }
 
+   // From a reader thread
+   MRef cursor = 0;
+   U32 size;
+   LogRecord *r;
+   while ((r = marena_shared_next_record(&log, &cursor, &size)))
+   {
+       ...
+   }
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+*/
+typedef struct MArenaShared
+{
+    U8       *buffer;
+    U32       reserved_size;
+    /* Committed part of the reserved address space, it only grows */
+    U32       committed_size;
+    SpinLock  commit_lock;
+    /* Every record below this offset is fully written */
+    U32       watermark;
+    /* Stack pointer bumped by the writers. It is 64 bits wide so that it cannot
+       wrap around while writers keep failing on a full arena */
+    U64       data_size;
+} MArenaShared;
+
+bool  marena_shared_init        (MArenaShared *arena, U32 max_size);
+void  marena_shared_del         (MArenaShared *arena);
+void  marena_shared_clear       (MArenaShared *arena);
+
+/* Reserves a record of `size` bytes, returns NULL if the arena is full.
+   The optional `ref` receives the `MRef` of the record payload */
+void* marena_shared_begin       (MArenaShared *arena, U32 size, MRef *ref);
+void  marena_shared_commit      (MArenaShared *arena, void *record);
+/* Gives up the record: it is skipped by the readers */
+void  marena_shared_dismiss     (MArenaShared *arena, void *record);
+MRef  marena_shared_push_data   (MArenaShared *arena, const void *data, U32 size);
+
+/* Offset up to which every record is fully written */
+U32   marena_shared_watermark   (MArenaShared *arena);
+/* Iterates the committed records. `cursor` must be initialized to 0, returns NULL
+   when no more committed records are available (more records may show up later
+   on: calling it again with the same cursor resumes the iteration). */
+void* marena_shared_next_record (MArenaShared *arena, MRef *cursor, U32 *size);
+
+
+
+
+/* 64 bit variant of `MArena`.
+   Same semantics and same begin/add/commit API of `MArena` (every function
+   is prefixed with `marena64_` instead of `marena_`), but sizes and references
+   are 64 bits wide. Meant for single pass workloads that do not fit in the 4 GiB
+   that an `MRef` can address.
+   @NOTE :: For multi gigabytes arenas prefer `marena64_new_reserved`, growing
+   an arena of that size through `mremap` (or worse `realloc`) is going to be expensive.
+*/
+typedef U64 MRef64;
 
+#define MARENA_T         MArena64
+#define MARENA_CTX_T     MArena64AtomicAllocationContext
+#define MARENA_REF_T     MRef64
+#define MARENA_SIZE_T    U64
+#define MARENA_FN(NAME)  marena64_##NAME
+#include "dpcrt_marena_template.h"
 
 
 
 
 
-static inline void *
-marena_unpack_ref__unsafe(MArena *arena, MRef ref)
-{
-    assert(arena->buffer);
-    assert(arena->data_size);
-    assert(ref && ref >= MARENA_MINIMUM_ALLOWED_STACK_POINTER_VALUE && ref < arena->data_size);
+/* Per thread scratch arenas for short lived temporaries.
+   Every thread owns `SCRATCH_ARENA_COUNT_PER_THREAD` arenas, lazily created on
+   first use with `marena_new_reserved`: pointers handed out never move.
+   `scratch_begin` takes a checkpoint of one of them, `scratch_end` rewinds
+   the arena to that checkpoint freeing everything allocated in between.
 
+   Pass to `scratch_begin` the arenas that are already in use by your caller
+   (eg an arena received as a parameter, where you are going to return the
+   result) and a different one is picked, so that callee temporaries never
+   clobber caller data.
+   @EXAMPLE
+   ~~~~
+       char *
+       f(MArena *out)
+       {
+           ScratchArena scratch = scratch_begin(&out, 1);
+           char *tmp = SCRATCH_PUSH_ARRAY(&scratch, char, 4096);
+           // ... use tmp, write the result in `out`
+           scratch_end(scratch);
+       }
+   ~~~~
+   @NOTE :: Scratch arenas are thread local, a `ScratchArena` must not cross
+   threads and each `scratch_begin` must be matched by a `scratch_end`, in LIFO order
+   on the same arena. */
+#define SCRATCH_ARENA_COUNT_PER_THREAD (2)
+
+#ifndef SCRATCH_ARENA_RESERVED_SIZE
+#  define SCRATCH_ARENA_RESERVED_SIZE (GIGABYTES(1))
+#endif
 
-    {
-        /* @NOTE(dparo) [Mon Nov 26 22:05:28 CET 2018]
-
-           It is not very polite to ask to access a raw pointer
-           while in the middle of a `marena_begin` call.
-           Accessing a pointer in the middle of `marena_begin` `marena_commit`
-           pair can potentially be very unsafe due to the fact that the stack
-           is not guaranteed to maintain the same address due to the fact
-           that it may grow.
-           Make sure to commit or discard before accessing raw pointers.
-           If you fill that this restriction is too severe remove this assert.
-        */
-        assert(arena->alloc_context.staging_size == 0);
-    }
+#define SCRATCH_ARENA_DEFAULT_ALIGNMENT (16)
 
-    if (ref && ref >= MARENA_MINIMUM_ALLOWED_STACK_POINTER_VALUE && ref < arena->data_size)
-    {
-        return (void*) ((U8*) arena->buffer + ref);
-    }
-    else
+typedef struct ScratchArena {
+    MArena *arena;
+    MRef    checkpoint;
+} ScratchArena;
+
+ScratchArena     scratch_begin             ( MArena **conflicts, U32 num_conflicts );
+void             scratch_end               ( ScratchArena scratch );
+/* Returns a pointer to `size` bytes aligned to `SCRATCH_ARENA_DEFAULT_ALIGNMENT`,
+   valid until the matching `scratch_end`. NULL on failure */
+void*            scratch_push              ( ScratchArena *scratch, U32 size, bool initialize_to_zero );
+/* Releases the scratch arenas of the calling thread, call it before a thread exits.
+   They are going to be recreated on the next `scratch_begin` */
+void             scratch_thread_release    ( void );
+
+/* Same as `scratch_push` for an array of `count` elements of `elem_size` bytes.
+   NULL if the size of the whole array does not fit in a `U32` */
+static inline void *
+scratch_push_array(ScratchArena *scratch, U32 elem_size, U64 count, bool initialize_to_zero)
+{
+    assert(elem_size);
+    if (count > U32_MAX / elem_size)
     {
-        return 0;
+        return NULL;
     }
+    return scratch_push(scratch, elem_size * (U32) count, initialize_to_zero);
 }
 
+#define SCRATCH_PUSH_ARRAY(scratch, TYPE, CNT)                          \
+    ((TYPE*) scratch_push_array((scratch), (U32) sizeof(TYPE), (U64) (CNT), false))
+
 
 __END_DECLS
 
@@ -162,6 +162,9 @@ __BEGIN_DECLS
 #define ATTRIB_WEAK __attribute__((weak))
 #define ATTRIB_TLS __thread
 #define ATTRIB_ALWAYS_INLINE __attribute__((always_inline))
+/* Compiles the function for an instruction set extension (eg "avx2") regardless of the
+   target of the translation unit. Only call it after checking that the CPU supports it */
+#define ATTRIB_TARGET(...) __attribute__((target(__VA_ARGS__)))
 
 #define ATTRIB_ANNOTATE(...) __attribute__((annotate(__VA_ARGS__)))
 
@@ -202,6 +205,7 @@ __BEGIN_DECLS
 #define ATTRIB_WEAK __declspec(selectany)
 #define ATTRIB_TLS __declspec(thread)
 #define ATTRIB_ALWAYS_INLINE __forceinline
+#define ATTRIB_TARGET(...)
 
 #define ATTRIB_ANNOTATE(...)
 
@@ -267,7 +271,7 @@ __BEGIN_DECLS
 // Usefull macro from the Linux Kernel. This macro returns the
 //
 #define container_of(type, ptr, member) \
-    ((type *)((char *)(((type *)0)->member) - offsetof(type, member)))
+    ((type *)((char *)(ptr) - offsetof(type, member)))
 
 /* ===================================
    Static Assertion
@@ -1,4 +1,5 @@
 #include "dpcrt_data_structures.h"
+#include "dpcrt_hash.h"
 
 
 void *
@@ -7,3 +8,479 @@ Insert()
     
     return NULL;
 }
+
+
+
+/* ##########################################################################
+   HMap Implementation
+   ########################################################################## */
+
+#if defined(__SSE2__)
+#  include <emmintrin.h>
+#endif
+
+#define HMAP_CTRL_EMPTY   ((U8) 0x80)
+#define HMAP_CTRL_DELETED ((U8) 0xFE)
+/* A full slot stores the 7 low bits of its hash, the empty and deleted ones have the high bit set */
+#define HMAP_CTRL_IS_FULL(c) (((c) & 0x80) == 0)
+
+/* Load factor of 7/8 */
+#define HMAP_MAX_GROWTH(capacity) ((capacity) - (capacity) / 8)
+
+DPCRT_STATIC_ASSERT(HMAP_GROUP_WIDTH == 16, "The group matching assumes 16 control bytes per group");
+
+
+/* Each bit `i` of the returned masks tells if the control byte `i` of the group matches */
+
+static inline U32
+hmap__group_match(const U8 *group, U8 h2)
+{
+#if defined(__SSE2__)
+    const __m128i ctrl = _mm_loadu_si128((const __m128i *) group);
+    return (U32) _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char) h2)));
+#else
+    U32 result = 0;
+    for (U32 i = 0; i < HMAP_GROUP_WIDTH; i++)
+    {
+        result |= (U32) (group[i] == h2) << i;
+    }
+    return result;
+#endif
+}
+
+static inline U32
+hmap__group_match_empty(const U8 *group)
+{
+    return hmap__group_match(group, HMAP_CTRL_EMPTY);
+}
+
+static inline U32
+hmap__group_match_empty_or_deleted(const U8 *group)
+{
+#if defined(__SSE2__)
+    return (U32) _mm_movemask_epi8(_mm_loadu_si128((const __m128i *) group));
+#else
+    U32 result = 0;
+    for (U32 i = 0; i < HMAP_GROUP_WIDTH; i++)
+    {
+        result |= (U32) (group[i] >> 7) << i;
+    }
+    return result;
+#endif
+}
+
+
+U64
+hmap_hash_bytes(const void *key, size_t key_size, U64 seed)
+{
+    return hash64_seed(key, key_size, seed);
+}
+
+bool
+hmap_eq_bytes(const void *a, const void *b, size_t key_size)
+{
+    return memcmp(a, b, key_size) == 0;
+}
+
+U64
+hmap_hash_cstr(const void *key, size_t key_size, U64 seed)
+{
+    (void) key_size;
+    const char *s = *(const char * const *) key;
+    return hmap_hash_bytes(s, strlen(s), seed);
+}
+
+bool
+hmap_eq_cstr(const void *a, const void *b, size_t key_size)
+{
+    (void) key_size;
+    return strcmp(*(const char * const *) a, *(const char * const *) b) == 0;
+}
+
+
+static inline U8 *
+hmap__key(const HMap *map, const HMapTable *t, U32 slot)
+{
+    return t->keys + (size_t) slot * map->key_size;
+}
+
+static inline U8 *
+hmap__value(const HMap *map, const HMapTable *t, U32 slot)
+{
+    /* Sets have no values, hand back the key */
+    return map->value_size ? t->values + (size_t) slot * map->value_size : hmap__key(map, t, slot);
+}
+
+static inline U8
+hmap__h2(U64 hash)
+{
+    return (U8) (hash & 0x7F);
+}
+
+/* Index of the first group of the probe sequence, the following ones are visited
+   with a triangular probing, which visits every group once when their number is a power of 2 */
+static inline U32
+hmap__h1(const HMapTable *t, U64 hash)
+{
+    return (U32) (hash >> 7) & (t->capacity / HMAP_GROUP_WIDTH - 1);
+}
+
+
+static void
+hmap__table_alloc(HMap *map, HMapTable *t, U32 capacity)
+{
+    assert(capacity >= HMAP_GROUP_WIDTH && IS_POW2(capacity));
+    const size_t keys_offset   = POW2_ALIGN(size_t, capacity, 16);
+    const size_t values_offset = POW2_ALIGN(size_t, keys_offset + (size_t) capacity * map->key_size, 16);
+    t->alloc_size  = values_offset + (size_t) capacity * map->value_size;
+    t->ctrl        = buf__alloc_realloc(&map->allocator, NULL, 0, t->alloc_size);
+    t->keys        = t->ctrl + keys_offset;
+    t->values      = map->value_size ? t->ctrl + values_offset : NULL;
+    t->capacity    = capacity;
+    t->count       = 0;
+    t->growth_left = HMAP_MAX_GROWTH(capacity);
+    memset(t->ctrl, HMAP_CTRL_EMPTY, capacity);
+}
+
+static void
+hmap__table_free(HMap *map, HMapTable *t)
+{
+    if (t->ctrl)
+    {
+        buf__alloc_realloc(&map->allocator, t->ctrl, t->alloc_size, 0);
+    }
+    zero_struct(t);
+}
+
+/* Returns the slot holding `key`, U32_MAX if not found */
+static U32
+hmap__find(const HMap *map, const HMapTable *t, const void *key, U64 hash)
+{
+    if (t->count == 0)
+    {
+        return U32_MAX;
+    }
+
+    const U32 group_mask = t->capacity / HMAP_GROUP_WIDTH - 1;
+    const U8 h2 = hmap__h2(hash);
+    U32 group = hmap__h1(t, hash);
+
+    /* Terminates since the load factor always leaves at least an empty slot */
+    for (U32 probe = 1; ; probe++)
+    {
+        const U8 *ctrl = t->ctrl + (size_t) group * HMAP_GROUP_WIDTH;
+        for (U32 match = hmap__group_match(ctrl, h2); match; match &= match - 1)
+        {
+            const U32 slot = group * HMAP_GROUP_WIDTH + bit_scan_forward_u32(match);
+            if (map->eq(key, hmap__key(map, t, slot), map->key_size))
+            {
+                return slot;
+            }
+        }
+        if (hmap__group_match_empty(ctrl))
+        {
+            return U32_MAX;
+        }
+        group = (group + probe) & group_mask;
+    }
+}
+
+/* Returns the first empty or deleted slot of the probe sequence of `hash` */
+static U32
+hmap__find_insert_slot(const HMapTable *t, U64 hash)
+{
+    const U32 group_mask = t->capacity / HMAP_GROUP_WIDTH - 1;
+    U32 group = hmap__h1(t, hash);
+    for (U32 probe = 1; ; probe++)
+    {
+        const U32 match = hmap__group_match_empty_or_deleted(t->ctrl + (size_t) group * HMAP_GROUP_WIDTH);
+        if (match)
+        {
+            return group * HMAP_GROUP_WIDTH + bit_scan_forward_u32(match);
+        }
+        group = (group + probe) & group_mask;
+    }
+}
+
+/* Takes a slot for a key known not to be in `t`. `t` must have some growth left */
+static U32
+hmap__table_insert(const HMap *map, HMapTable *t, const void *key, U64 hash)
+{
+    assert(t->growth_left > 0);
+    const U32 slot = hmap__find_insert_slot(t, hash);
+    if (t->ctrl[slot] == HMAP_CTRL_EMPTY)
+    {
+        t->growth_left--;
+    }
+    t->ctrl[slot] = hmap__h2(hash);
+    t->count++;
+    memcpy(hmap__key(map, t, slot), key, map->key_size);
+    return slot;
+}
+
+static void
+hmap__table_erase(HMapTable *t, U32 slot)
+{
+    /* When the group of the slot still has an empty slot no probe sequence ever went past it,
+       so the slot can become empty again instead of a tombstone */
+    const U8 *group = t->ctrl + (slot & ~(U32) (HMAP_GROUP_WIDTH - 1));
+    if (hmap__group_match_empty(group))
+    {
+        t->ctrl[slot] = HMAP_CTRL_EMPTY;
+        t->growth_left++;
+    }
+    else
+    {
+        t->ctrl[slot] = HMAP_CTRL_DELETED;
+    }
+    t->count--;
+}
+
+
+static void
+hmap__migrate(HMap *map, U32 group_count)
+{
+    HMapTable *old = &map->old_table;
+    const U32 old_group_count = old->capacity / HMAP_GROUP_WIDTH;
+    const U32 end = MIN(old_group_count, map->migrate_group + group_count);
+
+    for (; map->migrate_group < end; map->migrate_group++)
+    {
+        const U32 first_slot = map->migrate_group * HMAP_GROUP_WIDTH;
+        for (U32 slot = first_slot; slot < first_slot + HMAP_GROUP_WIDTH; slot++)
+        {
+            if (HMAP_CTRL_IS_FULL(old->ctrl[slot]))
+            {
+                const U8 *key = hmap__key(map, old, slot);
+                const U32 new_slot = hmap__table_insert(map, &map->table, key,
+                                                        map->hash(key, map->key_size, map->seed));
+                memcpy(hmap__value(map, &map->table, new_slot), hmap__value(map, old, slot), map->value_size);
+                /* A tombstone, the probe sequences of the entries still to migrate go through it */
+                old->ctrl[slot] = HMAP_CTRL_DELETED;
+                old->count--;
+            }
+        }
+    }
+
+    if (map->migrate_group == old_group_count)
+    {
+        assert(old->count == 0);
+        hmap__table_free(map, old);
+        map->migrate_group = 0;
+    }
+}
+
+static inline void
+hmap__migrate_all(HMap *map)
+{
+    if (map->old_table.ctrl)
+    {
+        hmap__migrate(map, U32_MAX);
+    }
+}
+
+/* Starts the migration of `table` into a new table of `capacity` slots */
+static void
+hmap__resize(HMap *map, U32 capacity)
+{
+    hmap__migrate_all(map);
+    map->old_table = map->table;
+    map->migrate_group = 0;
+    hmap__table_alloc(map, &map->table, capacity);
+    if (map->old_table.count == 0)
+    {
+        hmap__table_free(map, &map->old_table);
+    }
+}
+
+static void
+hmap__grow(HMap *map)
+{
+    /* The migration may complete before the new table fills up, finishing it
+       frees the room taken by the tombstones in the meantime */
+    if (map->old_table.ctrl)
+    {
+        hmap__migrate_all(map);
+        if (map->table.growth_left)
+        {
+            return;
+        }
+    }
+
+    const U32 capacity = map->table.capacity;
+    if (capacity == 0)
+    {
+        hmap__table_alloc(map, &map->table, HMAP_GROUP_WIDTH);
+    }
+    else if (map->table.count <= HMAP_MAX_GROWTH(capacity) / 2)
+    {
+        /* Mostly tombstones, purge them in a table of the same size */
+        hmap__resize(map, capacity);
+    }
+    else
+    {
+        assert_msg(capacity <= U32_MAX / 2, "HMap: too many entries");
+        hmap__resize(map, capacity * 2);
+    }
+}
+
+
+void
+hmap_init(HMap *map, U32 key_size, U32 value_size,
+          HMapHashFn hash, HMapEqFn eq, BufAllocator allocator)
+{
+    assert(key_size > 0);
+    zero_struct(map);
+    map->key_size   = key_size;
+    map->value_size = value_size;
+    map->hash       = hash ? hash : hmap_hash_bytes;
+    map->eq         = eq ? eq : hmap_eq_bytes;
+    map->allocator  = allocator;
+}
+
+void
+hmap_del(HMap *map)
+{
+    hmap__table_free(map, &map->old_table);
+    hmap__table_free(map, &map->table);
+    map->migrate_group = 0;
+}
+
+void
+hmap_clear(HMap *map)
+{
+    hmap__table_free(map, &map->old_table);
+    map->migrate_group = 0;
+    HMapTable *t = &map->table;
+    if (t->ctrl)
+    {
+        memset(t->ctrl, HMAP_CTRL_EMPTY, t->capacity);
+        t->count = 0;
+        t->growth_left = HMAP_MAX_GROWTH(t->capacity);
+    }
+}
+
+void
+hmap_reserve(HMap *map, U32 count)
+{
+    hmap__migrate_all(map);
+    if (count <= map->table.count + map->table.growth_left)
+    {
+        return;
+    }
+    U32 capacity = MAX(map->table.capacity, HMAP_GROUP_WIDTH);
+    while (HMAP_MAX_GROWTH(capacity) < count)
+    {
+        assert_msg(capacity <= U32_MAX / 2, "HMap: too many entries");
+        capacity *= 2;
+    }
+    hmap__resize(map, capacity);
+    hmap__migrate_all(map);
+}
+
+void *
+hmap_get(const HMap *map, const void *key)
+{
+    if (hmap_count(map) == 0)
+    {
+        return NULL;
+    }
+    const U64 hash = map->hash(key, map->key_size, map->seed);
+    U32 slot = hmap__find(map, &map->table, key, hash);
+    if (slot != U32_MAX)
+    {
+        return hmap__value(map, &map->table, slot);
+    }
+    slot = hmap__find(map, &map->old_table, key, hash);
+    if (slot != U32_MAX)
+    {
+        return hmap__value(map, &map->old_table, slot);
+    }
+    return NULL;
+}
+
+void *
+hmap_put(HMap *map, const void *key, bool8 *__OUT__ inserted)
+{
+    if (map->old_table.ctrl)
+    {
+        hmap__migrate(map, HMAP_MIGRATE_GROUPS_PER_OP);
+    }
+
+    const U64 hash = map->hash(key, map->key_size, map->seed);
+    U32 slot = hmap__find(map, &map->table, key, hash);
+    if (slot != U32_MAX)
+    {
+        if (inserted) { *inserted = false; }
+        return hmap__value(map, &map->table, slot);
+    }
+    slot = hmap__find(map, &map->old_table, key, hash);
+    if (slot != U32_MAX)
+    {
+        if (inserted) { *inserted = false; }
+        return hmap__value(map, &map->old_table, slot);
+    }
+
+    if (map->table.growth_left == 0)
+    {
+        hmap__grow(map);
+    }
+    slot = hmap__table_insert(map, &map->table, key, hash);
+    U8 *value = hmap__value(map, &map->table, slot);
+    if (map->value_size)
+    {
+        memset(value, 0, map->value_size);
+    }
+    if (inserted) { *inserted = true; }
+    return value;
+}
+
+bool
+hmap_remove(HMap *map, const void *key)
+{
+    if (map->old_table.ctrl)
+    {
+        hmap__migrate(map, HMAP_MIGRATE_GROUPS_PER_OP);
+    }
+    if (hmap_count(map) == 0)
+    {
+        return false;
+    }
+
+    const U64 hash = map->hash(key, map->key_size, map->seed);
+    U32 slot = hmap__find(map, &map->table, key, hash);
+    if (slot != U32_MAX)
+    {
+        hmap__table_erase(&map->table, slot);
+        return true;
+    }
+    slot = hmap__find(map, &map->old_table, key, hash);
+    if (slot != U32_MAX)
+    {
+        hmap__table_erase(&map->old_table, slot);
+        return true;
+    }
+    return false;
+}
+
+bool
+hmap_iter_next(const HMap *map, HMapIter *it)
+{
+    /* The entries still in the old table first, then the ones of the current table */
+    const HMapTable *tables[2] = { &map->old_table, &map->table };
+    for (; it->table_index < ARRAY_LEN(tables); it->table_index++, it->slot = 0)
+    {
+        const HMapTable *t = tables[it->table_index];
+        for (; it->slot < t->capacity; it->slot++)
+        {
+            if (HMAP_CTRL_IS_FULL(t->ctrl[it->slot]))
+            {
+                it->key   = hmap__key(map, t, it->slot);
+                it->value = hmap__value(map, t, it->slot);
+                it->slot++;
+                return true;
+            }
+        }
+    }
+    return false;
+}
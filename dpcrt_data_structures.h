@@ -4,13 +4,27 @@
 #include "dpcrt_types.h"
 #include "dpcrt_utils.h"
 #include "dpcrt_mem.h"
+#include "dpcrt_allocators.h"
+#include <stdc/malloc.h>
+#include <stdc/stdarg.h>
+#include <stdc/stdio.h>
 
 __BEGIN_DECLS
 
 
+/* Allocator backing a stretchy buffer. `realloc` follows the `realloc` semantics
+   except that it is also given the old size, and that a `new_size` of 0 frees `old_ptr`.
+   A zero initialized `BufAllocator` selects the heap (`xrealloc` / `free`). */
+typedef struct BufAllocator {
+    void* (*realloc)(void *ctx, void *old_ptr, size_t old_size, size_t new_size);
+    void  *ctx;
+} BufAllocator;
+
 typedef struct BufHdr {
     size_t len;
     size_t cap;
+    /* Every growth (and the final free) of the buffer goes through it */
+    BufAllocator allocator;
     char buf[];
 } BufHdr;
 
@@ -36,22 +50,61 @@ the intententions more clear
 #define BUF_END(b) ((b) + BUF_LEN(b))
 #define BUF_SIZEOF(b) ((b) ? BUF_LEN(b)*sizeof(*b) : 0)
 
-#define BUF_FREE(b) ((b) ? (free(BUF__HDR(b)), (b) = NULL) : 0)
-#define BUF_FIT(b, n) ((n) <= BUF_CAP(b) ? 0 : ((b) = buf__grow((b), (n), sizeof(*(b)))))
+#define BUF_FREE(b) ((b) ? (buf__free((b), sizeof(*(b))), (b) = NULL) : 0)
+#define BUF_FIT(b, n) ((n) <= BUF_CAP(b) ? 0 : ((b) = buf__grow((b), (n), sizeof(*(b)), NULL)))
 #define BUF_PUSH(b, ...) (BUF_FIT((b), 1 + BUF_LEN(b)), (b)[BUF__HDR(b)->len++] = (__VA_ARGS__))
 #define BUF_POP(b, ...) ((b)[BUF__HDR(b)->len--])
 #define BUF_PRINTF(b, ...) ((b) = buf__printf((b), __VA_ARGS__))
 #define BUF_CLEAR(b) ((b) ? BUF__HDR(b)->len = 0 : 0)
  
-#define BUF_NEW(TYPE, CNT) (((TYPE)*) __buf_new__((CNT), sizeof(TYPE)))
-void *__buf_new__(size_t cnt, size_t elem_size)
+/* Makes `b` (which must be NULL) an empty buffer with room for `n` elements, whose memory
+   comes from `allocator` (see `buf_allocator_marena` and `buf_allocator_mflist`).
+   All the other `BUF_xxx` macros keep using that allocator for the buffer lifetime.
+
+   @EXAMPLE USAGE:
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+   MArena scratch = marena_new_reserved((U32) GIGABYTES(1), (U32) MEGABYTES(1));
+   ...
+   MRef frame = marena_push_alignment(&scratch, 16);
+   BUF(U32) ids = NULL;
+   BUF_INIT_WITH(ids, 64, buf_allocator_marena(&scratch));
+   for (...) { BUF_PUSH(ids, id); }   // Bump allocated, grows in place while it is on top
+   ...
+   marena_pop_upto(&scratch, frame);  // Releases every buffer of the frame at once
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+*/
+#define BUF_INIT_WITH(b, n, allocator) ((b) = buf__init_with((n), sizeof(*(b)), (allocator)))
+
+#define BUF_NEW(TYPE, CNT) ((TYPE*) buf__new((CNT), sizeof(TYPE)))
+
+
+static inline void *
+buf__alloc_realloc(BufAllocator *allocator, void *old_ptr, size_t old_size, size_t new_size)
 {
-    void *b = NULL;
-    ((cnt) <= BUF_CAP(b) ? 0 : ((b) = buf__grow((b), (n), elem_size)));
-    return b;
+    void *result = NULL;
+    if (allocator->realloc)
+    {
+        result = allocator->realloc(allocator->ctx, old_ptr, old_size, new_size);
+        if (!result && new_size)
+        {
+            perror("BUF: Failed to grow the buffer with its allocator");
+            pal_abort();
+        }
+    }
+    else if (new_size)
+    {
+        result = old_ptr ? xrealloc(old_ptr, new_size) : xmalloc(new_size);
+    }
+    else
+    {
+        free(old_ptr);
+    }
+    return result;
 }
 
-static void *buf__grow(const void *buf, size_t new_len, size_t elem_size)
+/* `allocator` is only used when creating the buffer (NULL for the heap),
+   afterwards the one recorded in the header is used */
+static void *buf__grow(const void *buf, size_t new_len, size_t elem_size, BufAllocator *allocator)
 {
     assert(BUF_CAP(buf) <= (SIZE_MAX - 1)/2);
     size_t new_cap = CLAMP_MIN(2*BUF_CAP(buf), MAX(new_len, 16));
@@ -60,15 +113,171 @@ static void *buf__grow(const void *buf, size_t new_len, size_t elem_size)
     size_t new_size = offsetof(BufHdr, buf) + new_cap*elem_size;
     BufHdr *new_hdr;
     if (buf) {
-        new_hdr = xrealloc(BUF__HDR(buf), new_size);
+        BufHdr *hdr = BUF__HDR(buf);
+        new_hdr = buf__alloc_realloc(&hdr->allocator, hdr,
+                                     offsetof(BufHdr, buf) + hdr->cap*elem_size, new_size);
     } else {
-        new_hdr = xmalloc(new_size);
+        BufAllocator a = allocator ? *allocator : (BufAllocator) {0};
+        new_hdr = buf__alloc_realloc(&a, NULL, 0, new_size);
         new_hdr->len = 0;
+        new_hdr->allocator = a;
     }
     new_hdr->cap = new_cap;
     return new_hdr->buf;
 }
 
+static inline void buf__free(void *buf, size_t elem_size)
+{
+    BufHdr *hdr = BUF__HDR(buf);
+    buf__alloc_realloc(&hdr->allocator, hdr, offsetof(BufHdr, buf) + hdr->cap*elem_size, 0);
+}
+
+static inline void *buf__new(size_t cnt, size_t elem_size)
+{
+    return buf__grow(NULL, cnt, elem_size, NULL);
+}
+
+static inline void *buf__init_with(size_t cnt, size_t elem_size, BufAllocator allocator)
+{
+    return buf__grow(NULL, cnt, elem_size, &allocator);
+}
+
+
+static inline void *
+buf__marena_realloc(void *ctx, void *old_ptr, size_t old_size, size_t new_size)
+{
+    MArena *arena = ctx;
+    const bool on_top = old_ptr && ((U8*) old_ptr + old_size == arena->buffer + arena->data_size);
+
+    if (new_size == 0)
+    {
+        /* Only the buffer on top of the arena can be given back,
+           the others are released in bulk with the arena */
+        if (on_top)
+        {
+            marena_pop_upto(arena, (MRef) ((U8*) old_ptr - arena->buffer));
+        }
+        return NULL;
+    }
+
+    assert(new_size <= U32_MAX);
+    if (on_top && (new_size > old_size))
+    {
+        /* Grow in place */
+        return marena_push(arena, (U32) (new_size - old_size), false) ? old_ptr : NULL;
+    }
+
+    marena_push_alignment(arena, (U32) sizeof(void*) * 2);
+    MRef ref = marena_push(arena, (U32) new_size, false);
+    if (!ref)
+    {
+        return NULL;
+    }
+    void *result = arena->buffer + ref;
+    if (old_ptr)
+    {
+        memcpy(result, old_ptr, MIN(old_size, new_size));
+    }
+    return result;
+}
+
+/* Stretchy buffers bump allocated from `arena`, which must never move
+   (eg `marena_new_reserved` or `marena_new(size, false)`). The buffer on top of the arena
+   grows in place, the others are copied on top of it. Release them in bulk with
+   `marena_pop_upto` or `marena_clear`. */
+static inline BufAllocator
+buf_allocator_marena(MArena *arena)
+{
+    assert_msg((arena->realloc_strategy != ReallocStrategy_MRemap_MayMove)
+               && (arena->realloc_strategy != ReallocStrategy_Realloc)
+               && (arena->realloc_strategy != ReallocStrategy_Xrealloc),
+               "The arena buffer may move, invalidating the stretchy buffers");
+    return (BufAllocator) { buf__marena_realloc, arena };
+}
+
+
+static inline void *
+buf__mflist_realloc(void *ctx, void *old_ptr, size_t old_size, size_t new_size)
+{
+    (void) old_size;
+    MFList *mflist = ctx;
+    assert(new_size <= U32_MAX);
+    if (new_size == 0)
+    {
+        mflist_free(mflist, old_ptr);
+        return NULL;
+    }
+    return old_ptr
+        ? mflist_realloc1(mflist, old_ptr, (U32) new_size, false)
+        : mflist_alloc1(mflist, (U32) new_size, false);
+}
+
+/* Stretchy buffers backed by `mflist`, eg a per thread MFList
+   to keep the buffers growth off the global malloc */
+static inline BufAllocator
+buf_allocator_mflist(MFList *mflist)
+{
+    return (BufAllocator) { buf__mflist_realloc, mflist };
+}
+
+
+/* Small buffer optimization: the first `N` elements of the buffer live in an inline
+   storage (on the stack or embedded in a struct), the buffer only spills to the heap
+   (or to the `BufAllocator` given to `BUF_INLINE_INIT`) once it outgrows them.
+   The inline storage is never freed, `BUF_FREE` simply forgets about it.
+   @NOTE :: The inline storage must outlive the buffer and must not be moved
+   (eg by copying the struct embedding it) while the buffer is still inline.
+   @NOTE :: Element types must not require an alignment bigger than `BufHdr` (8 bytes).
+
+   @EXAMPLE USAGE:
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+   BUF_INLINE(Attrib, attribs, 8);       // BUF(Attrib) attribs, with room for 8 elements on the stack
+   for (...) { BUF_PUSH(attribs, a); }   // No allocation at all up to 8 elements
+   BUF_FREE(attribs);                    // Only frees the heap buffer (if it spilled)
+
+   typedef struct Token {
+       BUF_INLINE_STORAGE(U32, 4) flags_storage;
+       BUF(U32) flags;
+   } Token;
+   BUF_INLINE_INIT(token->flags, token->flags_storage, NULL);
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+*/
+/* `BufHdr` ends with a flexible array member so it can't be embedded in a struct,
+   the storage is raw bytes laid out exactly like a heap buffer: the header then `N` elements */
+#define BUF_INLINE_STORAGE(type, N) \
+    struct { _Alignas(BufHdr) char bytes[offsetof(BufHdr, buf) + (N)*sizeof(type)]; }
+
+#define BUF_INLINE_INIT(b, storage, spill_allocator)                    \
+    (*(BufHdr *) (storage).bytes = (BufHdr) {                           \
+        .len = 0, .cap = (sizeof((storage).bytes) - offsetof(BufHdr, buf)) / sizeof(*(b)), \
+        .allocator = { buf__inline_realloc, (spill_allocator) } },      \
+     (b) = (void *) ((BufHdr *) (storage).bytes)->buf)
+
+#define BUF_INLINE(type, name, N)                                       \
+    BUF_INLINE_STORAGE(type, N) name##__inline_storage;                 \
+    BUF(type) name = NULL;                                              \
+    BUF_INLINE_INIT(name, name##__inline_storage, NULL)
+
+#define BUF_IS_INLINE(b) ((b) && (BUF__HDR(b)->allocator.realloc == buf__inline_realloc))
+
+
+/* Allocator of the inline storages, `ctx` points to the `BufAllocator`
+   to spill to (NULL for the heap) */
+static inline void *
+buf__inline_realloc(void *ctx, void *old_ptr, size_t old_size, size_t new_size)
+{
+    if (new_size == 0)
+    {
+        return NULL;
+    }
+
+    BufAllocator spill_allocator = ctx ? *(BufAllocator *) ctx : (BufAllocator) {0};
+    BufHdr *result = buf__alloc_realloc(&spill_allocator, NULL, 0, new_size);
+    memcpy(result, old_ptr, MIN(old_size, new_size));
+    result->allocator = spill_allocator;
+    return result;
+}
+
 static char *buf__printf(char *buf, const char *fmt, ...)
 {
     va_list args;
@@ -91,37 +300,169 @@ static char *buf__printf(char *buf, const char *fmt, ...)
 
 typedef BUF(char) STR;
 
-#define STR_SIZE(b)   ((BUF_LEN(s)))
+#define STR_SIZE(s)   ((BUF_LEN(s)))
 #define STR_LEN(s)    ((BUF_LEN(s)) - 1) /* Do not count the null terminator */
 #define STR_CAP(s)    (BUF_CAP(s))
 #define STR_END(s)    (BUF_END(s))
 
 #define STR_FREE(s)   (BUF_FREE(s))
-#define STR_FIT(s, n) (((n) + 1) <= STR_CAP(b) ? 0 : ((s) = str__grow((s), (n + 1))))
-#define STR_PUSH(s, ...) (STR_FIT((s), 1 + STR_LEN(s)), (s)[BUF__HDR(s)->len] = (__VA_ARGS__), (s)[++(BUF__HDR(s)->len)] = 0)
-#define STR_POP(s, ...) ((s)[BUF__HDR(b)->len - 1] ? (s)[BUF__HDR(b)->len--] : '\0')
+#define STR_FIT(s, n) (((n) + 1) <= STR_CAP(s) ? 0 : ((s) = str__grow((s), (n + 1), NULL)))
+/* The pushed char overwrites the null terminator, which moves one byte further:
+   `STR_FIT` of the new length reserves `BUF_LEN(s) + 1` bytes */
+#define STR_PUSH(s, ...) (STR_FIT((s), STR_SIZE(s)), (s)[BUF__HDR(s)->len - 1] = (__VA_ARGS__), (s)[BUF__HDR(s)->len++] = 0)
+#define STR_POP(s, ...) (str__pop(s))
 #define STR_PRINTF(s, ...) ((s) = buf__printf((s), __VA_ARGS__))
 #define STR_CLEAR(s) ((s) ? (BUF__HDR(s)->len = 1, s[0] = '\0') : 0)
+/* Same as `BUF_INIT_WITH`, `s` becomes an empty string */
+#define STR_INIT_WITH(s, n, allocator) ((s) = str__init_with((n) + 1, (allocator)))
 
-static void *str__grow(const void *buf, size_t new_len)
+static void *str__grow(const void *buf, size_t new_len, BufAllocator *allocator)
 {
-    assert(BUF_CAP(buf) <= (SIZE_MAX - 1)/2);
-    size_t new_cap = CLAMP_MIN(2*BUF_CAP(buf), MAX(new_len, 16));
-    assert(new_len <= new_cap);
-    assert(new_cap <= (SIZE_MAX - offsetof(BufHdr, buf)));
-    size_t new_size = offsetof(BufHdr, buf) + new_cap;
-    BufHdr *new_hdr;
+    char *result;
     if (buf) {
-        new_hdr = xrealloc(BUF__HDR(buf), new_size);
+        result = buf__grow(buf, new_len, 1, NULL);
     } else {
-        new_hdr = xmalloc(new_size);
-        *((char * )new_hdr) = '\0';
-        new_hdr->len = 1;
+        result = buf__grow(NULL, new_len, 1, allocator);
+        result[0] = '\0';
+        BUF__HDR(result)->len = 1;
     }
-    new_hdr->cap = new_cap;
-    return new_hdr->buf;
+    return result;
+}
+
+static inline char *str__init_with(size_t len, BufAllocator allocator)
+{
+    return str__grow(NULL, len, &allocator);
+}
+
+/* Removes the last char of `s` and returns it, '\0' if `s` is empty */
+static inline char str__pop(char *s)
+{
+    if (STR_SIZE(s) <= 1) return '\0';
+    BufHdr *hdr = BUF__HDR(s);
+    hdr->len--;
+    char c = s[hdr->len - 1];
+    s[hdr->len - 1] = '\0';
+    return c;
+}
+
+
+
+/* ##########################################################################
+   HMap
+   ########################################################################## */
+
+/* Open addressing hash map (Swiss table like) with a flat SoA layout:
+   one control byte per slot followed by the array of the keys and the array of the values.
+   The control bytes are probed a group (`HMAP_GROUP_WIDTH` slots) at a time with SIMD
+   (SSE2 when available), each full slot stores the 7 low bits of its hash
+   so that a key comparison is almost only ever made on a real match.
+
+   Keys and values are plain bytes of the sizes given to `hmap_init`. Keys are hashed
+   and compared with `hash` / `eq` (by default with `hash64_seed` of their bytes, see `hmap_hash_cstr`
+   and `hmap_eq_cstr` for keys which are `const char*`). A `value_size` of 0 makes it a set.
+   The tables are allocated with a `BufAllocator` (heap, `buf_allocator_mflist`, `buf_allocator_marena`).
+
+   The map never rehashes all at once: when a table fills up a new one is allocated and
+   the entries of the old one are migrated a couple of groups at a time by the
+   following `hmap_put` / `hmap_remove`, lookups meanwhile search both tables.
+
+   @NOTE :: The pointers to the keys and values returned by the map are only valid
+   until the next `hmap_put` / `hmap_remove` / `hmap_reserve`.
+
+   @EXAMPLE USAGE:
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+   HMap ids;
+   HMAP_INIT(&ids, U64, U32, (BufAllocator) {0});
+   HMAP_SET(&ids, U64, U32, entity_id, index);
+   U32 *index = HMAP_GET(&ids, U64, U32, entity_id);  // NULL if not found
+
+   HMap names;
+   hmap_init(&names, sizeof(char*), sizeof(Symbol), hmap_hash_cstr, hmap_eq_cstr, buf_allocator_mflist(&mflist));
+   const char *name = "foo";
+   bool8 inserted;
+   Symbol *sym = hmap_put(&names, &name, &inserted);
+   ...
+   HMapIter it = {0};
+   while (hmap_iter_next(&names, &it)) { char *key = *(char**) it.key; Symbol *sym = it.value; }
+   hmap_del(&names);
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+*/
+
+#define HMAP_GROUP_WIDTH (16)
+/* Number of groups of the old table migrated by each `hmap_put` / `hmap_remove` */
+#define HMAP_MIGRATE_GROUPS_PER_OP (2)
+
+typedef U64  (*HMapHashFn) (const void *key, size_t key_size, U64 seed);
+typedef bool (*HMapEqFn)   (const void *a, const void *b, size_t key_size);
+
+typedef struct HMapTable {
+    U8    *ctrl;
+    U8    *keys;
+    U8    *values;
+    U32    capacity;      // Number of slots, a power of 2 multiple of `HMAP_GROUP_WIDTH`
+    U32    count;         // Number of full slots
+    U32    growth_left;   // Number of empty slots that can still be filled before the table is full
+    size_t alloc_size;
+} HMapTable;
+
+typedef struct HMap {
+    HMapTable   table;
+    HMapTable   old_table;   // Table being migrated into `table`, zeroed when no migration is pending
+    U32         migrate_group;
+
+    U32         key_size;
+    U32         value_size;
+    U64         seed;        // Given to `hash`, set it after `hmap_init` for per map hashes
+    HMapHashFn  hash;
+    HMapEqFn    eq;
+    BufAllocator allocator;
+} HMap;
+
+typedef struct HMapIter {
+    U32   table_index;
+    U32   slot;
+    void *key;
+    void *value;
+} HMapIter;
+
+
+U64  hmap_hash_bytes (const void *key, size_t key_size, U64 seed);
+bool hmap_eq_bytes   (const void *a, const void *b, size_t key_size);
+/* For keys which are `const char*` to null terminated strings */
+U64  hmap_hash_cstr  (const void *key, size_t key_size, U64 seed);
+bool hmap_eq_cstr    (const void *a, const void *b, size_t key_size);
+
+/* `hash` and `eq` can be NULL to hash and compare the bytes of the keys */
+void  hmap_init      (HMap *map, U32 key_size, U32 value_size,
+                      HMapHashFn hash, HMapEqFn eq, BufAllocator allocator);
+void  hmap_del       (HMap *map);
+void  hmap_clear     (HMap *map);
+/* Makes room for `count` entries, completing any pending migration */
+void  hmap_reserve   (HMap *map, U32 count);
+
+/* Returns the value associated to `key` (the key itself for sets), NULL if not found */
+void* hmap_get       (const HMap *map, const void *key);
+/* Returns the value associated to `key`, inserting `key` with a zeroed value if it was not found */
+void* hmap_put       (HMap *map, const void *key, bool8 *__OUT__ inserted);
+bool  hmap_remove    (HMap *map, const void *key);
+
+/* Visits every entry, `it` must be zero initialized. The map must not be modified during the iteration */
+bool  hmap_iter_next (const HMap *map, HMapIter *it);
+
+static inline U32 hmap_count(const HMap *map) { return map->table.count + map->old_table.count; }
+
+static inline void *
+hmap_set(HMap *map, const void *key, const void *value)
+{
+    void *result = hmap_put(map, key, NULL);
+    memcpy(result, value, map->value_size);
+    return result;
 }
 
+#define HMAP_INIT(map, K, V, allocator) hmap_init((map), sizeof(K), sizeof(V), NULL, NULL, (allocator))
+#define HMAP_GET(map, K, V, key) ((V *) hmap_get((map), &(K) {key}))
+#define HMAP_SET(map, K, V, key, value) (*(V *) hmap_put((map), &(K) {key}, NULL) = (value))
+
 __END_DECLS
 
 #endif /* HGUARD_d5c911ad5a844c18b81fe434e9fe5f42 */
@@ -19,3 +19,469 @@
  * THE SOFTWARE.
  */
 #include "dpcrt_hash.h"
+
+
+void
+hash64_init(Hash64State *state, U64 seed)
+{
+    zero_struct(state);
+    state->seed = hash64__init_seed(seed);
+    state->lanes[0] = state->lanes[1] = state->lanes[2] = state->seed;
+}
+
+void
+hash64_update(Hash64State *state, const void *data, size_t len)
+{
+    const U8 *p = data;
+    U8 *pending = state->buffer + 16;
+    state->total_len += len;
+
+    while (len)
+    {
+        /* A full stripe is only consumed once more bytes follow it,
+           the last (up to 48) bytes of the input go through `hash64__finish` */
+        if (state->pending == HASH64_STRIPE_SIZE)
+        {
+            hash64__stripe(state->lanes, pending);
+            memcpy(state->buffer, pending + HASH64_STRIPE_SIZE - 16, 16);
+            state->pending = 0;
+        }
+
+        if (state->pending == 0 && len > HASH64_STRIPE_SIZE)
+        {
+            /* Consume the input in place, without buffering it */
+            do
+            {
+                hash64__stripe(state->lanes, p);
+                p += HASH64_STRIPE_SIZE;
+                len -= HASH64_STRIPE_SIZE;
+            } while (len > HASH64_STRIPE_SIZE);
+            memcpy(state->buffer, p - 16, 16);
+        }
+
+        const size_t n = MIN(len, (size_t) (HASH64_STRIPE_SIZE - state->pending));
+        memcpy(pending + state->pending, p, n);
+        state->pending += (U32) n;
+        p += n;
+        len -= n;
+    }
+}
+
+U64
+hash64_final(const Hash64State *state)
+{
+    const U64 seed = (state->total_len > HASH64_STRIPE_SIZE)
+        ? state->lanes[0] ^ state->lanes[1] ^ state->lanes[2]
+        : state->seed;
+    return hash64__finish(seed, state->buffer + 16, state->pending, state->total_len);
+}
+
+
+
+/* ##########################################################################
+   Adler32
+   ########################################################################## */
+
+#if (defined(__x86_64__) || defined(__i386__)) && (__GNUC__ || __clang__)
+#  define HASH_X86_KERNELS 1
+#  include <immintrin.h>
+#else
+#  define HASH_X86_KERNELS 0
+#endif
+
+typedef uint32 (*Adler32UpdateFn)(uint32 adler, const U8 *p, size_t len);
+
+static uint32
+adler32__update_scalar(uint32 adler, const U8 *p, size_t len)
+{
+    uint32 a = adler & 0xFFFF;
+    uint32 b = adler >> 16;
+
+    while (len)
+    {
+        size_t n = MIN(len, (size_t) ADLER32_NMAX);
+        len -= n;
+        for (; n >= 8; n -= 8, p += 8)
+        {
+            a += p[0]; b += a;
+            a += p[1]; b += a;
+            a += p[2]; b += a;
+            a += p[3]; b += a;
+            a += p[4]; b += a;
+            a += p[5]; b += a;
+            a += p[6]; b += a;
+            a += p[7]; b += a;
+        }
+        for (; n; n--, p++)
+        {
+            a += *p; b += a;
+        }
+        a %= ADLER32_BASE;
+        b %= ADLER32_BASE;
+    }
+    return (b << 16) | a;
+}
+
+#if HASH_X86_KERNELS
+
+static inline uint32
+adler32__hsum_epi32(__m128i v)
+{
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+    return (uint32) _mm_cvtsi128_si32(v);
+}
+
+/* Both kernels sum blocks of `W` bytes. For each block, at the start `a` (its running sum)
+   is known, so:  b += W * a + sum((W - i) * p[i]),  a += sum(p[i]).
+   The `W * a` terms are accumulated in `v_ps` (the sum of `a` at the start of each block)
+   and applied once per `ADLER32_NMAX` chunk, together with the modulo. */
+
+ATTRIB_TARGET("sse2") static uint32
+adler32__update_sse2(uint32 adler, const U8 *p, size_t len)
+{
+    uint32 a = adler & 0xFFFF;
+    uint32 b = adler >> 16;
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i weights_lo = _mm_setr_epi16(16, 15, 14, 13, 12, 11, 10, 9);
+    const __m128i weights_hi = _mm_setr_epi16(8, 7, 6, 5, 4, 3, 2, 1);
+
+    while (len >= 16)
+    {
+        size_t blocks = MIN(len, (size_t) ADLER32_NMAX) / 16;
+        len -= blocks * 16;
+        U64 b64 = b + (U64) a * (blocks * 16);
+
+        __m128i v_ps = zero, v_s1 = zero, v_s2 = zero;
+        for (; blocks; blocks--, p += 16)
+        {
+            const __m128i x = _mm_loadu_si128((const __m128i *) p);
+            v_ps = _mm_add_epi32(v_ps, v_s1);
+            v_s1 = _mm_add_epi32(v_s1, _mm_sad_epu8(x, zero));
+            v_s2 = _mm_add_epi32(v_s2, _mm_madd_epi16(_mm_unpacklo_epi8(x, zero), weights_lo));
+            v_s2 = _mm_add_epi32(v_s2, _mm_madd_epi16(_mm_unpackhi_epi8(x, zero), weights_hi));
+        }
+
+        b64 += 16 * (U64) adler32__hsum_epi32(v_ps) + adler32__hsum_epi32(v_s2);
+        a = (a + adler32__hsum_epi32(v_s1)) % ADLER32_BASE;
+        b = (uint32) (b64 % ADLER32_BASE);
+    }
+    return adler32__update_scalar((b << 16) | a, p, len);
+}
+
+ATTRIB_TARGET("avx2") static uint32
+adler32__update_avx2(uint32 adler, const U8 *p, size_t len)
+{
+    uint32 a = adler & 0xFFFF;
+    uint32 b = adler >> 16;
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i ones = _mm256_set1_epi16(1);
+    const __m256i weights = _mm256_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17,
+                                             16, 15, 14, 13, 12, 11, 10,  9,  8,  7,  6,  5,  4,  3,  2,  1);
+
+    while (len >= 32)
+    {
+        size_t blocks = MIN(len, (size_t) ADLER32_NMAX) / 32;
+        len -= blocks * 32;
+        U64 b64 = b + (U64) a * (blocks * 32);
+
+        __m256i v_ps = zero, v_s1 = zero, v_s2 = zero;
+        for (; blocks; blocks--, p += 32)
+        {
+            const __m256i x = _mm256_loadu_si256((const __m256i *) p);
+            v_ps = _mm256_add_epi32(v_ps, v_s1);
+            v_s1 = _mm256_add_epi32(v_s1, _mm256_sad_epu8(x, zero));
+            v_s2 = _mm256_add_epi32(v_s2, _mm256_madd_epi16(_mm256_maddubs_epi16(x, weights), ones));
+        }
+
+        const __m128i ps = _mm_add_epi32(_mm256_castsi256_si128(v_ps), _mm256_extracti128_si256(v_ps, 1));
+        const __m128i s1 = _mm_add_epi32(_mm256_castsi256_si128(v_s1), _mm256_extracti128_si256(v_s1, 1));
+        const __m128i s2 = _mm_add_epi32(_mm256_castsi256_si128(v_s2), _mm256_extracti128_si256(v_s2, 1));
+        b64 += 32 * (U64) adler32__hsum_epi32(ps) + adler32__hsum_epi32(s2);
+        a = (a + adler32__hsum_epi32(s1)) % ADLER32_BASE;
+        b = (uint32) (b64 % ADLER32_BASE);
+    }
+    return adler32__update_sse2((b << 16) | a, p, len);
+}
+
+#endif
+
+static void hash__init(void);
+static uint32 adler32__update_resolve(uint32 adler, const U8 *p, size_t len);
+static Adler32UpdateFn adler32__update_impl = adler32__update_resolve;
+
+/* Picks the kernel, called once by `hash__init` */
+static void
+adler32__init(void)
+{
+    Adler32UpdateFn impl = adler32__update_scalar;
+#if HASH_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        impl = adler32__update_avx2;
+    }
+    else if (__builtin_cpu_supports("sse2"))
+    {
+        impl = adler32__update_sse2;
+    }
+#endif
+    adler32__update_impl = impl;
+}
+
+static uint32
+adler32__update_resolve(uint32 adler, const U8 *p, size_t len)
+{
+    hash__init();
+    return adler32__update_impl(adler, p, len);
+}
+
+uint32
+adler32_update(uint32 adler, const void *data, size_t len)
+{
+    /* Short buffers are not worth the SIMD setup */
+    if (len < 64)
+    {
+        return adler32__update_scalar(adler, data, len);
+    }
+    return adler32__update_impl(adler, data, len);
+}
+
+uint32
+adler32_combine(uint32 adler1, uint32 adler2, U64 len2)
+{
+    const uint32 rem = (uint32) (len2 % ADLER32_BASE);
+    uint32 sum1 = adler1 & 0xFFFF;
+    uint32 sum2 = (rem * sum1) % ADLER32_BASE;
+    sum1 += (adler2 & 0xFFFF) + ADLER32_BASE - 1;
+    sum2 += (adler1 >> 16) + (adler2 >> 16) + ADLER32_BASE - rem;
+    if (sum1 >= ADLER32_BASE)     { sum1 -= ADLER32_BASE; }
+    if (sum1 >= ADLER32_BASE)     { sum1 -= ADLER32_BASE; }
+    if (sum2 >= 2 * ADLER32_BASE) { sum2 -= 2 * ADLER32_BASE; }
+    if (sum2 >= ADLER32_BASE)     { sum2 -= ADLER32_BASE; }
+    return (sum2 << 16) | sum1;
+}
+
+
+
+/* ##########################################################################
+   CRC32C
+   ########################################################################## */
+
+#define CRC32C_POLY ((uint32) 0x82F63B78)
+/* Length of each of the 3 interleaved streams of the SSE4.2 kernel. The long blocks hide the
+   latency of the `crc32` instruction (3 cycles, 1 per cycle throughput), the short ones
+   cover the medium sized buffers */
+#define CRC32C_LONG_BLOCK  8192
+#define CRC32C_SHORT_BLOCK 256
+
+typedef uint32 (*Crc32cUpdateFn)(uint32 crc, const U8 *p, size_t len);
+
+static uint32 crc32c__table[8][256];
+/* Multiply the CRC register by x^(8 * CRC32C_xxx_BLOCK) mod P, that is append that
+   many zero bytes to it, one table for each byte of the register */
+static uint32 crc32c__long_shift[4][256];
+static uint32 crc32c__short_shift[4][256];
+
+
+/* a * b mod P, with the bits in reflected order (x^0 is the bit 31) */
+static uint32
+crc32c__multmodp(uint32 a, uint32 b)
+{
+    uint32 m = (uint32) 1 << 31;
+    uint32 p = 0;
+    for (;;)
+    {
+        if (a & m)
+        {
+            p ^= b;
+            if ((a & (m - 1)) == 0)
+            {
+                break;
+            }
+        }
+        m >>= 1;
+        b = (b & 1) ? (b >> 1) ^ CRC32C_POLY : b >> 1;
+    }
+    return p;
+}
+
+/* x^(8 * n) mod P */
+static uint32
+crc32c__xpow8n(U64 n)
+{
+    uint32 p = (uint32) 1 << 31;        /* x^0 */
+    uint32 x2k = (uint32) 1 << 23;      /* x^8 */
+    for (; n; n >>= 1)
+    {
+        if (n & 1)
+        {
+            p = crc32c__multmodp(x2k, p);
+        }
+        x2k = crc32c__multmodp(x2k, x2k);
+    }
+    return p;
+}
+
+static void
+crc32c__init_shift_table(uint32 table[4][256], U64 len)
+{
+    const uint32 k = crc32c__xpow8n(len);
+    for (U32 i = 0; i < 4; i++)
+    {
+        for (uint32 b = 0; b < 256; b++)
+        {
+            table[i][b] = crc32c__multmodp(k, b << (8 * i));
+        }
+    }
+}
+
+static inline uint32
+crc32c__shift(const uint32 table[4][256], uint32 crc)
+{
+    return table[0][crc & 0xFF] ^ table[1][(crc >> 8) & 0xFF]
+        ^ table[2][(crc >> 16) & 0xFF] ^ table[3][crc >> 24];
+}
+
+
+/* The kernels work on the raw CRC register, `crc32c_update` takes care of the inversions */
+
+static uint32
+crc32c__update_table(uint32 crc, const U8 *p, size_t len)
+{
+    for (; len && ((usize) p & 7); len--, p++)
+    {
+        crc = crc32c__table[0][(crc ^ *p) & 0xFF] ^ (crc >> 8);
+    }
+    for (; len >= 8; len -= 8, p += 8)
+    {
+        const uint32 lo = crc ^ (uint32) hash64__r4(p);
+        const uint32 hi = (uint32) hash64__r4(p + 4);
+        crc = crc32c__table[7][lo & 0xFF] ^ crc32c__table[6][(lo >> 8) & 0xFF]
+            ^ crc32c__table[5][(lo >> 16) & 0xFF] ^ crc32c__table[4][lo >> 24]
+            ^ crc32c__table[3][hi & 0xFF] ^ crc32c__table[2][(hi >> 8) & 0xFF]
+            ^ crc32c__table[1][(hi >> 16) & 0xFF] ^ crc32c__table[0][hi >> 24];
+    }
+    for (; len; len--, p++)
+    {
+        crc = crc32c__table[0][(crc ^ *p) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#if HASH_X86_KERNELS && defined(__x86_64__)
+
+/* Runs 3 independent CRCs over 3 consecutive blocks of `block_len` bytes,
+   then merges them shifting each one past the blocks following it */
+#define CRC32C__INTERLEAVE(c0, p, len, block_len, shift_table)          \
+    while ((len) >= 3 * (block_len))                                    \
+    {                                                                   \
+        U64 c1 = 0, c2 = 0;                                             \
+        for (const U8 *end = (p) + (block_len); (p) < end; (p) += 8)    \
+        {                                                               \
+            c0 = _mm_crc32_u64(c0, hash64__r8(p));                      \
+            c1 = _mm_crc32_u64(c1, hash64__r8((p) + (block_len)));      \
+            c2 = _mm_crc32_u64(c2, hash64__r8((p) + 2 * (block_len)));  \
+        }                                                               \
+        c0 = crc32c__shift(shift_table, (uint32) c0) ^ (uint32) c1;     \
+        c0 = crc32c__shift(shift_table, (uint32) c0) ^ (uint32) c2;     \
+        (p) += 2 * (block_len);                                         \
+        (len) -= 3 * (block_len);                                       \
+    }
+
+ATTRIB_TARGET("sse4.2") static uint32
+crc32c__update_sse42(uint32 crc, const U8 *p, size_t len)
+{
+    U64 c0 = crc;
+    for (; len && ((usize) p & 7); len--, p++)
+    {
+        c0 = _mm_crc32_u8((uint32) c0, *p);
+    }
+
+    CRC32C__INTERLEAVE(c0, p, len, CRC32C_LONG_BLOCK, crc32c__long_shift);
+    CRC32C__INTERLEAVE(c0, p, len, CRC32C_SHORT_BLOCK, crc32c__short_shift);
+
+    for (; len >= 8; len -= 8, p += 8)
+    {
+        c0 = _mm_crc32_u64(c0, hash64__r8(p));
+    }
+    for (; len; len--, p++)
+    {
+        c0 = _mm_crc32_u8((uint32) c0, *p);
+    }
+    return (uint32) c0;
+}
+
+#undef CRC32C__INTERLEAVE
+
+#endif
+
+static uint32 crc32c__update_resolve(uint32 crc, const U8 *p, size_t len);
+static Crc32cUpdateFn crc32c__update_impl = crc32c__update_resolve;
+
+/* Builds the tables and picks the kernel, called once by `hash__init` */
+static void
+crc32c__init(void)
+{
+    for (uint32 n = 0; n < 256; n++)
+    {
+        uint32 c = n;
+        for (U32 k = 0; k < 8; k++)
+        {
+            c = (c & 1) ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+        }
+        crc32c__table[0][n] = c;
+    }
+    for (uint32 n = 0; n < 256; n++)
+    {
+        uint32 c = crc32c__table[0][n];
+        for (U32 k = 1; k < 8; k++)
+        {
+            c = crc32c__table[0][c & 0xFF] ^ (c >> 8);
+            crc32c__table[k][n] = c;
+        }
+    }
+    crc32c__init_shift_table(crc32c__long_shift, CRC32C_LONG_BLOCK);
+    crc32c__init_shift_table(crc32c__short_shift, CRC32C_SHORT_BLOCK);
+
+    Crc32cUpdateFn impl = crc32c__update_table;
+#if HASH_X86_KERNELS && defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2"))
+    {
+        impl = crc32c__update_sse42;
+    }
+#endif
+    crc32c__update_impl = impl;
+}
+
+static uint32
+crc32c__update_resolve(uint32 crc, const U8 *p, size_t len)
+{
+    hash__init();
+    return crc32c__update_impl(crc, p, len);
+}
+
+static void hash__init(void) ATTRIB_CONSTRUCT(hash__init);
+
+/* Every SIMD kernel is resolved here, before `main` and thus before any other
+   thread can race on the dispatch pointers. The lazy resolvers only cover the
+   calls made from other constructors running before this one */
+static void
+hash__init(void)
+{
+    adler32__init();
+    crc32c__init();
+}
+
+uint32
+crc32c_update(uint32 crc, const void *data, size_t len)
+{
+    return ~crc32c__update_impl(~crc, data, len);
+}
+
+uint32
+crc32c_combine(uint32 crc1, uint32 crc2, U64 len2)
+{
+    return crc32c__multmodp(crc32c__xpow8n(len2), crc1) ^ crc2;
+}
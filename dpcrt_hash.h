@@ -24,6 +24,7 @@
 
 #include "dpcrt_utils.h"
 #include "dpcrt_types.h"
+#include "dpcrt_endian.h"
 
 __BEGIN_DECLS
 
@@ -45,27 +46,228 @@ static inline uint32 simple_hash(U8 *buffer, size_t len)
 //   Can be used as a checksum or as a hash_function
 //    to index on 32 bit sized hashmaps
 // @NOTE :: https://en.wikipedia.org/wiki/Adler-32
+#define ADLER32_BASE ((uint32) 65521)
+/* Largest number of bytes that can be summed before `b` may overflow 32 bits,
+   the modulo is only taken once every `ADLER32_NMAX` bytes */
+#define ADLER32_NMAX 5552
+#define ADLER32_INIT ((uint32) 1)
+
+/* Continues the checksum `adler` (`ADLER32_INIT` for a new one) over `len` more bytes.
+   Picks at runtime the best kernel the CPU supports (AVX2, SSE2, or portable). */
+uint32 adler32_update(uint32 adler, const void *data, size_t len);
+
+/* Checksum of the concatenation of two buffers, given the checksum of each
+   of them and the length of the second one. Eg to merge the checksums of
+   the pieces of a buffer computed by different threads. */
+uint32 adler32_combine(uint32 adler1, uint32 adler2, U64 len2);
+
 static inline uint32 adler32(U8* buffer, const size_t len)
 {
-#define MOD_ADLER ((uint32) 65521)
-    uint32 a = 1, b = 0;
-    size_t index;
+    return adler32_update(ADLER32_INIT, buffer, len);
+}
+
+
+/* CRC32C (Castagnoli, reflected polynomial 0x82F63B78), the CRC of iSCSI, ext4, ...
+   Uses the SSE4.2 `crc32` instruction over 3 interleaved streams when the CPU supports it,
+   a slicing-by-8 table otherwise. Same conventions as zlib `crc32`: the checksum
+   of an empty buffer is 0 and `crc32c_update` continues a finished checksum.
+
+   @EXAMPLE USAGE:
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+   U32 crc = crc32c(record, record_size);
+
+   U32 crc = 0;
+   while ((n = pal_readfile(fh, buf, sizeof(buf))) > 0) { crc = crc32c_update(crc, buf, n); }
+
+   // Each thread checksums a piece, then:
+   U32 crc = crc32c_combine(crc_piece0, crc_piece1, piece1_len);
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+*/
+uint32 crc32c_update(uint32 crc, const void *data, size_t len);
+
+/* CRC32C of the concatenation of two buffers, given the CRC32C of each of them
+   and the length of the second one */
+uint32 crc32c_combine(uint32 crc1, uint32 crc2, U64 len2);
+
+static inline uint32 crc32c(const void *data, size_t len) { return crc32c_update(0, data, len); }
+
+
+/* ##########################################################################
+   hash64: fast non cryptographic 64 bit hash (wyhash construction)
+   ##########################################################################
+
+   Reads the input 48 bytes (3 independent 16 byte lanes) at a time, keys up to 16 bytes
+   take a branch light path made of at most 4 loads and 2 multiplies.
+   The result only depends on the bytes, the length and the seed: it is the same on
+   every platform and the same whether it is computed in one shot or streamed.
+   Pick a random seed for tables exposed to untrusted keys.
+
+   @EXAMPLE USAGE:
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+   U64 h = hash64(key, key_len);
+   U64 s = hash64_seed(key, key_len, table_seed);
+
+   Hash64State st;
+   hash64_init(&st, 0);
+   while ((n = read_some(buf, sizeof(buf)))) { hash64_update(&st, buf, n); }
+   U64 fingerprint = hash64_final(&st);   // == hash64 of the whole content
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+*/
+
+#define HASH64_SECRET0 0x2d358dccaa6c78a5ULL
+#define HASH64_SECRET1 0x8bb84b93962eacc9ULL
+#define HASH64_SECRET2 0x4b33a62ed433d4a3ULL
+#define HASH64_SECRET3 0x4d5a2da51de1aa47ULL
+
+#define HASH64_STRIPE_SIZE 48
+
+/* Full 64x64 -> 128 multiply, `*a` receives the low half and `*b` the high one */
+static inline void
+hash64__mum(U64 *a, U64 *b)
+{
+#if defined(__SIZEOF_INT128__)
+    __uint128_t r = (__uint128_t) *a * *b;
+    *a = (U64) r;
+    *b = (U64) (r >> 64);
+#else
+    const U64 ha = *a >> 32, hb = *b >> 32, la = (U32) *a, lb = (U32) *b;
+    const U64 rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    const U64 t = rl + (rm0 << 32);
+    U64 lo = t + (rm1 << 32);
+    U64 hi = rh + (rm0 >> 32) + (rm1 >> 32) + (t < rl) + (lo < t);
+    *a = lo;
+    *b = hi;
+#endif
+}
+
+static inline U64
+hash64__mix(U64 a, U64 b)
+{
+    hash64__mum(&a, &b);
+    return a ^ b;
+}
+
+static inline U64 hash64__r8(const U8 *p) { U64LE v; memcpy(&v, p, sizeof(v)); return u64le_to_u64(v); }
+static inline U64 hash64__r4(const U8 *p) { U32LE v; memcpy(&v, p, sizeof(v)); return u32le_to_u32(v); }
+/* 1 to 3 bytes */
+static inline U64 hash64__r3(const U8 *p, size_t k) { return ((U64) p[0] << 16) | ((U64) p[k >> 1] << 8) | p[k - 1]; }
+
+static inline U64
+hash64__init_seed(U64 seed)
+{
+    return seed ^ hash64__mix(seed ^ HASH64_SECRET0, HASH64_SECRET1);
+}
+
+/* Consumes one stripe, `lanes` holds the 3 lane accumulators */
+static inline void
+hash64__stripe(U64 lanes[3], const U8 *p)
+{
+    lanes[0] = hash64__mix(hash64__r8(p)      ^ HASH64_SECRET1, hash64__r8(p + 8)  ^ lanes[0]);
+    lanes[1] = hash64__mix(hash64__r8(p + 16) ^ HASH64_SECRET2, hash64__r8(p + 24) ^ lanes[1]);
+    lanes[2] = hash64__mix(hash64__r8(p + 32) ^ HASH64_SECRET3, hash64__r8(p + 40) ^ lanes[2]);
+}
 
+/* Hashes the last `len` (1 to 48) bytes ending at `p + len`, `total_len` bytes in all.
+   When the input is longer than 16 bytes the 16 bytes before `p + len` must be readable. */
+static inline U64
+hash64__finish(U64 seed, const U8 *p, size_t len, U64 total_len)
+{
+    U64 a, b;
+    if (total_len <= 16)
+    {
+        if (len >= 4)
+        {
+            a = (hash64__r4(p) << 32) | hash64__r4(p + ((len >> 3) << 2));
+            b = (hash64__r4(p + len - 4) << 32) | hash64__r4(p + len - 4 - ((len >> 3) << 2));
+        }
+        else if (len > 0)
+        {
+            a = hash64__r3(p, len);
+            b = 0;
+        }
+        else
+        {
+            a = b = 0;
+        }
+    }
+    else
+    {
+        while (len > 16)
+        {
+            seed = hash64__mix(hash64__r8(p) ^ HASH64_SECRET1, hash64__r8(p + 8) ^ seed);
+            p += 16;
+            len -= 16;
+        }
+        a = hash64__r8(p + len - 16);
+        b = hash64__r8(p + len - 8);
+    }
+    a ^= HASH64_SECRET1;
+    b ^= seed;
+    hash64__mum(&a, &b);
+    return hash64__mix(a ^ HASH64_SECRET0 ^ total_len, b ^ HASH64_SECRET1);
+}
 
-    // @NOTE :: Can be made much more efficient by using SIMD,
-    //   or simply by pulling the buffer with a `size_t*` and
-    //   then handling the remainder
-    // Process each byte of the buffer in order
-    for (index = 0; index < len; ++index)
+static inline U64
+hash64_seed(const void *data, size_t len, U64 seed)
+{
+    const U8 *p = data;
+    size_t i = len;
+    seed = hash64__init_seed(seed);
+    if (i > HASH64_STRIPE_SIZE)
     {
-        a = (a + buffer[index]) % MOD_ADLER;
-        b = (b + a) % MOD_ADLER;
+        U64 lanes[3] = { seed, seed, seed };
+        do
+        {
+            hash64__stripe(lanes, p);
+            p += HASH64_STRIPE_SIZE;
+            i -= HASH64_STRIPE_SIZE;
+        } while (i > HASH64_STRIPE_SIZE);
+        seed = lanes[0] ^ lanes[1] ^ lanes[2];
     }
+    return hash64__finish(seed, p, i, len);
+}
+
+static inline U64 hash64(const void *data, size_t len) { return hash64_seed(data, len, 0); }
+
+/* Same as `hash64_seed` on the 8 (4) little endian bytes of `x` */
+static inline U64
+hash64_u64(U64 x, U64 seed)
+{
+    U64 a = ((x & 0xFFFFFFFF) << 32) | (x >> 32);
+    U64 b = x;
+    a ^= HASH64_SECRET1;
+    b ^= hash64__init_seed(seed);
+    hash64__mum(&a, &b);
+    return hash64__mix(a ^ HASH64_SECRET0 ^ 8, b ^ HASH64_SECRET1);
+}
 
-    return (b << 16) | a;
-#undef MOD_ADLER
+static inline U64
+hash64_u32(U32 x, U64 seed)
+{
+    U64 a = ((U64) x << 32) | x;
+    U64 b = a;
+    a ^= HASH64_SECRET1;
+    b ^= hash64__init_seed(seed);
+    hash64__mum(&a, &b);
+    return hash64__mix(a ^ HASH64_SECRET0 ^ 4, b ^ HASH64_SECRET1);
 }
 
+
+/* Streaming state, the bytes are buffered up to a stripe. `buffer` keeps the last 16 bytes
+   already consumed in front of the pending ones, since the final block may overlap them. */
+typedef struct Hash64State {
+    U64   lanes[3];
+    U64   seed;
+    U64   total_len;
+    U32   pending;
+    U8    buffer[16 + HASH64_STRIPE_SIZE];
+} Hash64State;
+
+void hash64_init   (Hash64State *state, U64 seed);
+void hash64_update (Hash64State *state, const void *data, size_t len);
+U64  hash64_final  (const Hash64State *state);
+
+
 __END_DECLS
 
 #endif  /* HGUARD_27b30011b22943b69d0a4062f38d2698 */
@@ -0,0 +1,238 @@
+/*
+ * Copyright (C) 2018  Davide Paro
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* Declarations of the `MArena` family, shared by `MArena` and `MArena64`.
+   @NOTE :: There's intentionally no include guard: this file is included once
+   per arena flavour by `dpcrt_allocators.h`, after defining
+      - `MARENA_T`        the arena type name
+      - `MARENA_CTX_T`    the atomic allocation context type name
+      - `MARENA_REF_T`    the type of the references handed out
+      - `MARENA_SIZE_T`   the type used for sizes and offsets
+      - `MARENA_FN(NAME)` the name of the function `NAME` (eg `marena_##NAME`)
+   Every parameter is undefined at the end of this file.
+   The documentation refers to the `MArena` names, `MArena64` mirrors them. */
+
+#if !defined(MARENA_T) || !defined(MARENA_CTX_T) || !defined(MARENA_REF_T) \
+    || !defined(MARENA_SIZE_T) || !defined(MARENA_FN)
+#  error "Define the MArena template parameters before including this file"
+#endif
+
+
+typedef struct MARENA_CTX_T
+{
+    bool32        failed;
+    MARENA_SIZE_T staging_size;
+    /* Size of the span handed out by `marena_reserve_span`, 0 if none is pending */
+    MARENA_SIZE_T span_size;
+} MARENA_CTX_T;
+
+typedef struct MARENA_T {
+    /* For internal usage only */
+    MARENA_CTX_T         alloc_context;
+    enum AllocStrategy   alloc_strategy;
+    enum ReallocStrategy realloc_strategy;
+    enum DeallocStrategy dealloc_strategy;
+    /* ------------------- */
+
+    MARENA_SIZE_T         data_size;
+    MARENA_SIZE_T         data_max_size;
+    /* Size of the address space reserved up front by `marena_new_reserved`,
+       0 for any other kind of arena. `data_max_size` is the committed part of it. */
+    MARENA_SIZE_T         data_reserved_size;
+
+    U8* buffer;
+
+#if DPCRT_ALLOCATOR_STATS
+    AllocStats            stats;
+#endif
+} MARENA_T;
+
+
+MARENA_T         MARENA_FN(new_aux)        ( enum AllocStrategy alloc_strategy,
+                                             enum ReallocStrategy realloc_strategy,
+                                             enum DeallocStrategy dealloc_strategy,
+                                             MARENA_SIZE_T size );
+MARENA_T         MARENA_FN(new)            ( MARENA_SIZE_T size, bool may_grow );
+/* Fixed size arena (it never grows) backed by explicit 2MB huge pages, or by transparent
+   huge pages as a fallback (see `mem_mmap_huge`). `size` is rounded up to `MEM_HUGE_PAGE_SIZE`.
+   Custom huge pages arenas can be made with `marena_new_aux(AllocStrategy_MmapHugePages, ...)` */
+MARENA_T         MARENA_FN(new_huge_pages) ( MARENA_SIZE_T size );
+/* Reserves `max_size` bytes of address space once and commits only `initial_size`
+   bytes of it. When the arena grows further pages get committed in place:
+   the buffer never moves and its data is never copied, thus raw pointers inside
+   the arena stay valid for its whole lifetime (even between `marena_begin` and
+   `marena_commit`). The arena fails to grow past `max_size`.
+   Reserving address space is cheap, it is fine to ask for a very large `max_size`. */
+MARENA_T         MARENA_FN(new_reserved)   ( MARENA_SIZE_T max_size, MARENA_SIZE_T initial_size );
+void             MARENA_FN(del)            ( MARENA_T *arena );
+
+void             MARENA_FN(pop_upto)       ( MARENA_T *arena, MARENA_REF_T ref );
+void             MARENA_FN(fetch)          ( MARENA_T *arena, MARENA_REF_T ref, void *output, MARENA_SIZE_T sizeof_elem );
+void             MARENA_FN(clear)          ( MARENA_T *arena );
+#if DPCRT_ALLOCATOR_STATS
+AllocStats*      MARENA_FN(stats)          ( MARENA_T *arena );
+#endif
+
+
+/* Beging an atomic allocation context, you can start building up data incrementally
+   directly on the arena. When calling `marena_commit` the data built up to that
+   moment if there wasn't any error is going to be commited updating the `stack_pointer`
+   and making the data actually ""visible"" to the user by returning a valid `MRef` to
+   it.
+   If you want to abort an atomic allocation context call `marena_dismiss`
+   The `marena_add_xxxx` functionality allows you to construct data incrementally. They
+   all return a bool saying if the request successed. You can choose to handle
+   the failure right away by calling `marena_dismiss`, or just pretend
+   nothing happened and keep pushing to it, once you will call `marena_commit`
+   the function will return you a `MRef = 0` since one of the allocation failed.
+
+   Between `marena_add_xxx` calls no alignment will be performed from the stack allocator,
+   if you want alignment for performance reasons you must ask it explicitly.
+*/
+void             MARENA_FN(begin)              (MARENA_T *arena);
+
+bool             MARENA_FN(add)                (MARENA_T *arena, MARENA_SIZE_T sizeof_data, bool initialize_to_zero );
+bool             MARENA_FN(add_data)           (MARENA_T *arena, void *data, MARENA_SIZE_T sizeof_data );
+bool             MARENA_FN(add_pointer)        (MARENA_T *arena, void *pointer);
+bool             MARENA_FN(add_byte)           (MARENA_T *arena, byte_t b );
+bool             MARENA_FN(add_char)           (MARENA_T *arena, char c );
+bool             MARENA_FN(add_i8)             (MARENA_T *arena, I8 i8 );
+bool             MARENA_FN(add_u8)             (MARENA_T *arena, U8 u8 );
+bool             MARENA_FN(add_i16)            (MARENA_T *arena, I16 i16 );
+bool             MARENA_FN(add_u16)            (MARENA_T *arena, U16 u16 );
+bool             MARENA_FN(add_i32)            (MARENA_T *arena, I32 i32 );
+bool             MARENA_FN(add_u32)            (MARENA_T *arena, U32 u32 );
+bool             MARENA_FN(add_i64)            (MARENA_T *arena, I64 i64 );
+bool             MARENA_FN(add_u64)            (MARENA_T *arena, U64 u64 );
+bool             MARENA_FN(add_size_t)         (MARENA_T *arena, size_t s );
+bool             MARENA_FN(add_usize)          (MARENA_T *arena, usize us );
+bool             MARENA_FN(add_cstr)           (MARENA_T *arena, char* cstr );
+bool             MARENA_FN(add_pstr32)         (MARENA_T *arena, PStr32 *pstr32 );
+bool             MARENA_FN(add_str32_nodata)   (MARENA_T *arena, Str32 str32 );
+bool             MARENA_FN(add_str32_withdata) (MARENA_T *arena, Str32 str32 );
+bool             MARENA_FN(ask_alignment)      (MARENA_T *arena, MARENA_SIZE_T alignment);
+
+/* Bulk version of the `marena_add_xxx` functions, meant for serialization hot loops.
+   `marena_reserve_span` checks (and makes room for) `max_size` bytes once and returns
+   a raw pointer to them, which can then be filled with plain stores (or SIMD).
+   `marena_commit_span` appends the first `used_size` bytes to the atomic allocation
+   context, the rest of the span is given back.
+   On failure NULL is returned and the context is marked as failed like any other add.
+   @NOTE :: No other `marena_add_xxx` call is allowed while a span is pending, and the
+   returned pointer is only valid until `marena_commit_span` since growing the arena may move it.
+
+   @EXAMPLE USAGE:
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+   marena_begin(arena);
+   U32 *span = marena_reserve_span(arena, count * sizeof(U32));
+   if (span)
+   {
+       for (U32 i = 0; i < count; i++) { span[i] = values[i]; }
+       marena_commit_span(arena, count * sizeof(U32));
+   }
+   MRef ref = marena_commit(arena);
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+*/
+void*            MARENA_FN(reserve_span)       (MARENA_T *arena, MARENA_SIZE_T max_size);
+void             MARENA_FN(commit_span)        (MARENA_T *arena, MARENA_SIZE_T used_size);
+
+void             MARENA_FN(dismiss)            (MARENA_T *arena);
+MARENA_REF_T     MARENA_FN(commit)             (MARENA_T *arena);
+
+
+
+
+
+MARENA_REF_T MARENA_FN(push)                (MARENA_T *arena, MARENA_SIZE_T sizeof_data, bool initialize_to_zero );
+MARENA_REF_T MARENA_FN(push_data)           (MARENA_T *arena, void *data, MARENA_SIZE_T sizeof_data );
+MARENA_REF_T MARENA_FN(push_pointer)        (MARENA_T *arena, void *pointer);
+MARENA_REF_T MARENA_FN(push_byte)           (MARENA_T *arena, byte_t b );
+MARENA_REF_T MARENA_FN(push_char)           (MARENA_T *arena, char c );
+MARENA_REF_T MARENA_FN(push_i8)             (MARENA_T *arena, I8 i8 );
+MARENA_REF_T MARENA_FN(push_u8)             (MARENA_T *arena, U8 u8 );
+MARENA_REF_T MARENA_FN(push_i16)            (MARENA_T *arena, I16 i16 );
+MARENA_REF_T MARENA_FN(push_u16)            (MARENA_T *arena, U16 u16 );
+MARENA_REF_T MARENA_FN(push_i32)            (MARENA_T *arena, I32 i32 );
+MARENA_REF_T MARENA_FN(push_u32)            (MARENA_T *arena, U32 u32 );
+MARENA_REF_T MARENA_FN(push_i64)            (MARENA_T *arena, I64 i64 );
+MARENA_REF_T MARENA_FN(push_u64)            (MARENA_T *arena, U64 u64 );
+MARENA_REF_T MARENA_FN(push_size_t)         (MARENA_T *arena, size_t s );
+MARENA_REF_T MARENA_FN(push_usize)          (MARENA_T *arena, usize us );
+MARENA_REF_T MARENA_FN(push_cstr)           (MARENA_T *arena, char* cstr );
+MARENA_REF_T MARENA_FN(push_pstr32)         (MARENA_T *arena, PStr32 *pstr32 );
+MARENA_REF_T MARENA_FN(push_str32_nodata)   (MARENA_T *arena, Str32 str32 );
+MARENA_REF_T MARENA_FN(push_str32_withdata) (MARENA_T *arena, Str32 str32 );
+MARENA_REF_T MARENA_FN(push_alignment)      (MARENA_T *arena, MARENA_SIZE_T alignment);
+
+
+
+
+
+
+
+/* Returns true if the arena buffer is guaranteed to never change address when growing */
+static inline bool
+MARENA_FN(has_stable_addr)(MARENA_T *arena)
+{
+    return (arena->realloc_strategy == ReallocStrategy_None)
+        || (arena->realloc_strategy == ReallocStrategy_CommitAddrSpace);
+}
+
+static inline void *
+MARENA_FN(unpack_ref__unsafe)(MARENA_T *arena, MARENA_REF_T ref)
+{
+    assert(arena->buffer);
+    assert(arena->data_size);
+    assert(ref && ref >= MARENA_MINIMUM_ALLOWED_STACK_POINTER_VALUE && ref < arena->data_size);
+
+
+    {
+        /* @NOTE(dparo) [Mon Nov 26 22:05:28 CET 2018]
+
+           It is not very polite to ask to access a raw pointer
+           while in the middle of a `marena_begin` call.
+           Accessing a pointer in the middle of `marena_begin` `marena_commit`
+           pair can potentially be very unsafe due to the fact that the stack
+           is not guaranteed to maintain the same address due to the fact
+           that it may grow.
+           Make sure to commit or discard before accessing raw pointers.
+           If you fill that this restriction is too severe remove this assert.
+           Arenas that never move (eg `marena_new_reserved`) are exempt.
+        */
+        assert(arena->alloc_context.staging_size == 0 || MARENA_FN(has_stable_addr)(arena));
+    }
+
+    if (ref && ref >= MARENA_MINIMUM_ALLOWED_STACK_POINTER_VALUE && ref < arena->data_size)
+    {
+        return (void*) ((U8*) arena->buffer + ref);
+    }
+    else
+    {
+        return 0;
+    }
+}
+
+
+#undef MARENA_T
+#undef MARENA_CTX_T
+#undef MARENA_REF_T
+#undef MARENA_SIZE_T
+#undef MARENA_FN
@@ -0,0 +1,615 @@
+/*
+ * Copyright (C) 2018  Davide Paro
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* Implementation of the `MArena` family, see `dpcrt_marena_template.h`.
+   @NOTE :: There's intentionally no include guard: this file is included once
+   per arena flavour by `dpcrt_allocators.c`, with the same template parameters
+   used for the declarations. Every parameter is undefined at the end of this file. */
+
+#if !defined(MARENA_T) || !defined(MARENA_REF_T) \
+    || !defined(MARENA_SIZE_T) || !defined(MARENA_FN)
+#  error "Define the MArena template parameters before including this file"
+#endif
+
+/* Largest value that fits in the size type of the arena */
+#define MARENA__SIZE_MAX ((MARENA_SIZE_T) ~(MARENA_SIZE_T) 0)
+
+
+
+static inline bool
+MARENA_FN(_can_realloc)(MARENA_T *arena)
+{
+    return (arena->realloc_strategy != ReallocStrategy_None);
+}
+
+
+static inline bool
+MARENA_FN(_realloc)(MARENA_T *arena,
+                    MARENA_SIZE_T newsize)
+{
+    bool success = false;
+    assert(MARENA_FN(_can_realloc)(arena));
+
+    const size_t alignment = 128;
+
+    void *buffer = mem_realloc (arena->realloc_strategy,
+                                arena->buffer,
+                                (size_t) arena->data_max_size,
+                                (size_t) newsize,
+                                alignment);
+    if ( buffer )
+    {
+        arena->buffer = buffer;
+        arena->data_max_size = newsize;
+        success = true;
+    }
+    return success;
+}
+
+/* Grows the arena so that it can hold at least `needed_size` bytes */
+static inline bool
+MARENA_FN(_grow)(MARENA_T *arena, U64 needed_size)
+{
+    /* Cannot grow past what the size type can address (or what fits in memory) */
+    U64 max_size = MIN((U64) MARENA__SIZE_MAX, (U64) SIZE_MAX - G_pal.page_size);
+    if (arena->realloc_strategy == ReallocStrategy_CommitAddrSpace)
+    {
+        /* Cannot commit past the reserved address space */
+        max_size = arena->data_reserved_size;
+    }
+
+    U64 newsize = (U64) arena->data_max_size + arena->data_max_size / 4 + 8 * (U64) G_pal.page_size;
+    if (newsize < arena->data_max_size)
+    {
+        /* Wrapped around */
+        newsize = max_size;
+    }
+    newsize = MIN(MAX(newsize, needed_size), max_size);
+    /* Keep the size page aligned, mmap based strategies deal only with whole pages */
+    newsize = MIN((U64) PAGE_ALIGN(newsize), max_size);
+
+    assert_msg(newsize > arena->data_max_size && newsize >= needed_size, "Assert that the arena was able to grow, eg we didn't hit the maximum memory usage");
+    if (newsize <= arena->data_max_size || newsize < needed_size)
+    {
+        /* Finished the space addressable by the arena (or the reserved address space) */
+        return false;
+    }
+
+    return MARENA_FN(_realloc)(arena, (MARENA_SIZE_T) newsize);
+}
+
+
+static bool
+MARENA_FN(_accomodate_for_size)(MARENA_T *arena, MARENA_SIZE_T size)
+{
+    bool success = false;
+    assert(arena);
+    bool can_realloc = MARENA_FN(_can_realloc)(arena);
+
+    /* Inside an atomic allocation context the top of the stack is the staging size */
+    const U64 stack_top = arena->alloc_context.staging_size
+        ? arena->alloc_context.staging_size
+        : arena->data_size;
+    const U64 needed_data_size = stack_top + size;
+
+    if ( needed_data_size >= arena->data_max_size)
+    {
+        // needs to grow
+        if ( !can_realloc )
+        {
+            return false;
+        }
+        else
+        {
+            success = MARENA_FN(_grow)(arena, needed_data_size + 1);
+        }
+    }
+#if __DEBUG
+    else if (__DPCRT_MEM_LAYER__ARENA_ALWAYS_FORCE_REALLOC_AT_EVERY_PUSH & can_realloc)
+    {
+        // If the arena didn't really need to grow, and the macro
+        //    is defined we're going to force a new grow
+        return MARENA_FN(_realloc)(arena, arena->data_max_size);
+    }
+#endif
+    else
+    {
+        success = true;
+    }
+    return success;
+}
+
+
+
+MARENA_T
+MARENA_FN(new_aux) ( enum AllocStrategy alloc_strategy,
+                     enum ReallocStrategy realloc_strategy,
+                     enum DeallocStrategy dealloc_strategy,
+                     MARENA_SIZE_T size )
+{
+    assert(size);
+    MARENA_T marena = {0};
+    const MARENA_SIZE_T alignment = 128;
+    size = ALIGN(MARENA_SIZE_T, size, MARENA_MINIMUM_ALLOWED_STACK_POINTER_VALUE);
+    size = ALIGN(MARENA_SIZE_T, size, alignment);
+    if (alloc_strategy == AllocStrategy_MmapHugePages)
+    {
+        /* Huge pages mappings can be unmapped only in whole huge pages */
+        size = (MARENA_SIZE_T) MEM_HUGE_PAGE_ALIGN(size);
+    }
+
+    void *buffer = mem_alloc( alloc_strategy, (size_t) size, (size_t) alignment);
+
+    if (buffer)
+    {
+        marena.buffer = buffer;
+        // We're going to reserve the first bytes
+        // so we can return references (indices to the buffer)
+        // that do not start at zero
+        marena.data_size = MARENA_MINIMUM_ALLOWED_STACK_POINTER_VALUE;
+        marena.data_max_size = size;
+        marena.alloc_strategy = alloc_strategy;
+        marena.realloc_strategy = realloc_strategy;
+        marena.dealloc_strategy = dealloc_strategy;
+    }
+    return marena;
+}
+
+
+MARENA_T
+MARENA_FN(new)( MARENA_SIZE_T size, bool buffer_may_change_addr )
+{
+    const enum AllocStrategy alloc_strategy = AllocStrategy_Mmap;
+    const enum ReallocStrategy realloc_strategy =  buffer_may_change_addr
+        ? ReallocStrategy_MRemap_MayMove
+        : ReallocStrategy_MRemap_KeepAddr;
+    const enum DeallocStrategy dealloc_strategy = DeallocStrategy_Munmap;
+
+    return MARENA_FN(new_aux) ( alloc_strategy, realloc_strategy, dealloc_strategy, size );
+}
+
+
+MARENA_T
+MARENA_FN(new_huge_pages)( MARENA_SIZE_T size )
+{
+    const enum AllocStrategy alloc_strategy = AllocStrategy_MmapHugePages;
+    const enum ReallocStrategy realloc_strategy = ReallocStrategy_None;
+    const enum DeallocStrategy dealloc_strategy = DeallocStrategy_Munmap;
+
+    return MARENA_FN(new_aux) ( alloc_strategy, realloc_strategy, dealloc_strategy, size );
+}
+
+
+MARENA_T
+MARENA_FN(new_reserved)( MARENA_SIZE_T max_size, MARENA_SIZE_T initial_size )
+{
+    assert(initial_size && initial_size <= max_size);
+    MARENA_T marena = {0};
+
+    max_size     = (MARENA_SIZE_T) PAGE_ALIGN(max_size);
+    initial_size = (MARENA_SIZE_T) PAGE_ALIGN(MAX(initial_size, MARENA_MINIMUM_ALLOWED_STACK_POINTER_VALUE));
+
+    void *buffer = mem_alloc(AllocStrategy_ReserveAddrSpace, (size_t) max_size, G_pal.page_size);
+    if (!buffer)
+    {
+        return marena;
+    }
+
+    if (!mem_realloc(ReallocStrategy_CommitAddrSpace, buffer, 0, (size_t) initial_size, G_pal.page_size))
+    {
+        mem_dealloc(DeallocStrategy_ReleaseAddrSpace, buffer, (size_t) max_size);
+        return marena;
+    }
+
+    marena.buffer             = buffer;
+    marena.data_size          = MARENA_MINIMUM_ALLOWED_STACK_POINTER_VALUE;
+    marena.data_max_size      = initial_size;
+    marena.data_reserved_size = max_size;
+    marena.alloc_strategy     = AllocStrategy_ReserveAddrSpace;
+    marena.realloc_strategy   = ReallocStrategy_CommitAddrSpace;
+    marena.dealloc_strategy   = DeallocStrategy_ReleaseAddrSpace;
+    return marena;
+}
+
+
+void
+MARENA_FN(del)(MARENA_T *arena)
+{
+    assert(arena);
+    if ( arena )
+    {
+        const MARENA_SIZE_T buffer_size = (arena->dealloc_strategy == DeallocStrategy_ReleaseAddrSpace)
+            ? arena->data_reserved_size
+            : arena->data_max_size;
+        mem_dealloc(arena->dealloc_strategy, arena->buffer, (size_t) buffer_size);
+        arena->buffer = NULL;
+    }
+    memclr(arena, sizeof(*arena));
+}
+
+
+static inline void
+MARENA_FN(_assert_valid)(MARENA_T *arena)
+{
+    (void) arena;
+    assert(arena && arena->buffer && (arena->data_size != 0) && arena->data_max_size);
+}
+
+
+#if DPCRT_ALLOCATOR_STATS
+static inline void
+MARENA_FN(_update_stats_usage)(MARENA_T *arena)
+{
+    alloc_stats__update_usage(&arena->stats,
+                              arena->data_size - MARENA_MINIMUM_ALLOWED_STACK_POINTER_VALUE,
+                              arena->data_max_size,
+                              1);
+}
+
+AllocStats *
+MARENA_FN(stats)(MARENA_T *arena)
+{
+    MARENA_FN(_assert_valid)(arena);
+    MARENA_FN(_update_stats_usage)(arena);
+    return &arena->stats;
+}
+#endif
+
+
+void
+MARENA_FN(clear)(MARENA_T *arena)
+{
+    MARENA_FN(_assert_valid)(arena);
+    assert(arena->alloc_context.staging_size == 0);
+    memclr(&arena->alloc_context, sizeof(arena->alloc_context));
+    arena->data_size = MARENA_MINIMUM_ALLOWED_STACK_POINTER_VALUE;
+    ALLOC_STATS_ONLY(alloc_stats__record_free(&arena->stats, 0));
+    ALLOC_STATS_ONLY(MARENA_FN(_update_stats_usage)(arena));
+}
+
+
+void
+MARENA_FN(pop_upto)(MARENA_T *arena, MARENA_REF_T ref)
+{
+    MARENA_FN(_assert_valid)(arena);
+    assert(arena->alloc_context.staging_size == 0);
+
+    assert(ref >= MARENA_MINIMUM_ALLOWED_STACK_POINTER_VALUE);
+
+    assert(ref < arena->data_size);
+    if (ref < arena->data_size)
+    {
+        arena->data_size = ref;
+        ALLOC_STATS_ONLY(alloc_stats__record_free(&arena->stats, 0));
+        ALLOC_STATS_ONLY(MARENA_FN(_update_stats_usage)(arena));
+    }
+    else
+    {
+        assert_msg(0, "You're using a reference that is possibly invalid, since it points to buffer that does not currently exist\n");
+    }
+}
+
+void
+MARENA_FN(fetch)( MARENA_T *arena, MARENA_REF_T ref, void *output, MARENA_SIZE_T sizeof_elem )
+{
+    void *ptr = MARENA_FN(unpack_ref__unsafe)(arena, ref);
+    assert(ptr);
+    if (ptr)
+    {
+        memcpy(output, ptr, (size_t) sizeof_elem);
+    }
+    else
+    {
+        memclr(output, (size_t) sizeof_elem);
+    }
+}
+
+
+void
+MARENA_FN(begin) (MARENA_T *arena)
+{
+    MARENA_FN(_assert_valid)(arena);
+    assert_msg(arena->alloc_context.staging_size == 0, "Previous push begins must finish");
+    arena->alloc_context.staging_size = (arena->data_size);
+}
+
+
+void
+MARENA_FN(dismiss) (MARENA_T *arena)
+{
+    MARENA_FN(_assert_valid)(arena);
+    /* @NOTE :: Copied from pop_upto function */
+    assert(arena && (arena->data_size != 0));
+    assert(arena->alloc_context.staging_size >= arena->data_size);
+
+    memclr(&arena->alloc_context, sizeof(arena->alloc_context));
+}
+
+
+MARENA_REF_T
+MARENA_FN(commit) (MARENA_T *arena)
+{
+    MARENA_REF_T ref = 0;
+
+    MARENA_FN(_assert_valid)(arena);
+    assert(arena->alloc_context.staging_size >= arena->data_size);
+
+    ALLOC_STATS_ONLY(alloc_stats__record_alloc(&arena->stats,
+                                               arena->alloc_context.staging_size - arena->data_size,
+                                               !arena->alloc_context.failed, 0));
+
+    if (!arena->alloc_context.failed)
+    {
+        ref = arena->data_size;
+        arena->data_size = arena->alloc_context.staging_size;
+    }
+
+    ALLOC_STATS_ONLY(MARENA_FN(_update_stats_usage)(arena));
+    MARENA_FN(dismiss)(arena);
+
+    return ref;
+}
+
+
+static bool
+MARENA_FN(_add_failure)(MARENA_T *arena)
+{
+    MARENA_FN(_assert_valid)(arena);
+    assert(arena->alloc_context.staging_size != 0);
+    arena->alloc_context.failed = true;
+    return false;
+}
+
+static inline bool
+MARENA_FN(_would_overflow_stack_pointer)(MARENA_T *arena,
+                                         MARENA_SIZE_T sizeof_data)
+{
+    /* Keep one byte of headroom: growing asks for the stack top plus one */
+    return (sizeof_data >= MARENA__SIZE_MAX - arena->alloc_context.staging_size);
+}
+
+
+static inline bool
+MARENA_FN(_ensure_add_operation_is_possible)(MARENA_T *arena,
+                                             MARENA_SIZE_T sizeof_data_to_be_added)
+{
+    MARENA_FN(_assert_valid)(arena);
+    assert(arena->alloc_context.staging_size != 0);
+    assert_msg(arena->alloc_context.span_size == 0, "The pending span must be committed first");
+
+    if ((arena->alloc_context.failed == false)
+        && (!MARENA_FN(_would_overflow_stack_pointer)(arena, sizeof_data_to_be_added)))
+    {
+        if (MARENA_FN(_accomodate_for_size)(arena, sizeof_data_to_be_added))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+/* Shared by `marena_add_data` and the scalar adds: once inlined the copy
+   of the scalars becomes a plain (unaligned) store */
+static inline bool
+MARENA_FN(_add_bytes)(MARENA_T *arena, const void *data, MARENA_SIZE_T sizeof_data)
+{
+    MARENA_FN(_assert_valid)(arena);
+    assert(arena->alloc_context.staging_size != 0);
+
+    if (!MARENA_FN(_ensure_add_operation_is_possible)(arena, sizeof_data))
+    {
+        return MARENA_FN(_add_failure)(arena);
+    }
+
+    if (data)
+    {
+        memcpy(arena->buffer + arena->alloc_context.staging_size,
+               data, (size_t) sizeof_data);
+    }
+
+    arena->alloc_context.staging_size += sizeof_data;
+
+    return true;
+}
+
+
+bool
+MARENA_FN(add)(MARENA_T *arena, MARENA_SIZE_T size, bool initialize_to_zero )
+{
+    MARENA_FN(_assert_valid)(arena);
+    assert(arena->alloc_context.staging_size != 0);
+
+    if (!MARENA_FN(_ensure_add_operation_is_possible)(arena, size))
+    {
+        return MARENA_FN(_add_failure)(arena);
+    }
+
+    if (initialize_to_zero)
+    {
+        memclr(arena->buffer + arena->alloc_context.staging_size, (size_t) size);
+    }
+    arena->alloc_context.staging_size += size;
+
+    return true;
+}
+
+
+bool
+MARENA_FN(add_data)(MARENA_T *arena, void *data, MARENA_SIZE_T sizeof_data )
+{
+    return MARENA_FN(_add_bytes)(arena, data, sizeof_data);
+}
+
+
+/* The staging offset is not required to be aligned to the type being added */
+#define MARENA__ADD_SCALAR_DEF(NAME, TYPE)                                      \
+    bool                                                                        \
+    MARENA_FN(add_##NAME)(MARENA_T *arena, TYPE value)                          \
+    {                                                                           \
+        return MARENA_FN(_add_bytes)(arena, &value, (MARENA_SIZE_T) sizeof(TYPE)); \
+    }
+
+MARENA__ADD_SCALAR_DEF(pointer, void*)
+MARENA__ADD_SCALAR_DEF(byte,    byte_t)
+MARENA__ADD_SCALAR_DEF(char,    char)
+MARENA__ADD_SCALAR_DEF(i8,      I8)
+MARENA__ADD_SCALAR_DEF(u8,      U8)
+MARENA__ADD_SCALAR_DEF(i16,     I16)
+MARENA__ADD_SCALAR_DEF(u16,     U16)
+MARENA__ADD_SCALAR_DEF(i32,     I32)
+MARENA__ADD_SCALAR_DEF(u32,     U32)
+MARENA__ADD_SCALAR_DEF(i64,     I64)
+MARENA__ADD_SCALAR_DEF(u64,     U64)
+MARENA__ADD_SCALAR_DEF(size_t,  size_t)
+MARENA__ADD_SCALAR_DEF(usize,   usize)
+
+#undef MARENA__ADD_SCALAR_DEF
+
+
+bool
+MARENA_FN(add_cstr)(MARENA_T *arena, char *cstr)
+{
+    MARENA_FN(_assert_valid)(arena);
+    assert(arena->alloc_context.staging_size != 0);
+
+    // Include the null-terminator
+    const size_t len = strlen(cstr) + 1;
+    if (len > MARENA__SIZE_MAX)
+    {
+        return MARENA_FN(_add_failure)(arena);
+    }
+    return MARENA_FN(_add_bytes)(arena, cstr, (MARENA_SIZE_T) len);
+}
+
+
+bool
+MARENA_FN(add_pstr32)( MARENA_T *arena, PStr32 *pstr32 )
+{
+    MARENA_FN(_assert_valid)(arena);
+    assert(arena->alloc_context.staging_size != 0);
+
+    return MARENA_FN(_add_bytes)(arena, pstr32, (MARENA_SIZE_T) sizeof(Str32Hdr) + (MARENA_SIZE_T) pstr32->len + 1);
+}
+
+
+bool
+MARENA_FN(add_str32_nodata)( MARENA_T *arena, Str32 str32 )
+{
+    MARENA_FN(_assert_valid)(arena);
+    assert(arena->alloc_context.staging_size != 0);
+
+    return MARENA_FN(_add_bytes)(arena, &str32, (MARENA_SIZE_T) sizeof(Str32Hdr));
+}
+
+
+bool
+MARENA_FN(add_str32_withdata)( MARENA_T *arena, Str32 str32 )
+{
+    MARENA_FN(_assert_valid)(arena);
+    assert(arena->alloc_context.staging_size != 0);
+    assert(str32.len >= 0);
+
+    bool result = MARENA_FN(_add_bytes)(arena, &str32, (MARENA_SIZE_T) sizeof(Str32Hdr));
+    if (result)
+    {
+        result = MARENA_FN(_add_bytes)(arena, str32.data, (MARENA_SIZE_T) str32.len + 1);
+    }
+    return result;
+}
+
+
+bool
+MARENA_FN(ask_alignment)(MARENA_T *arena, MARENA_SIZE_T alignment)
+{
+    assert(arena && (arena->data_size != 0));
+    /* Align the top of the atomic allocation context, not the last committed data */
+    const usize curr_addr = (usize) arena->buffer + arena->alloc_context.staging_size;
+    const usize aligned_addr = (usize) ALIGN(usize, curr_addr, alignment);
+    return MARENA_FN(add)(arena, (MARENA_SIZE_T) (aligned_addr - curr_addr), true);
+}
+
+
+void*
+MARENA_FN(reserve_span)(MARENA_T *arena, MARENA_SIZE_T max_size)
+{
+    MARENA_FN(_assert_valid)(arena);
+    assert(arena->alloc_context.staging_size != 0);
+
+    if (!MARENA_FN(_ensure_add_operation_is_possible)(arena, max_size))
+    {
+        MARENA_FN(_add_failure)(arena);
+        return NULL;
+    }
+
+    arena->alloc_context.span_size = max_size;
+    return arena->buffer + arena->alloc_context.staging_size;
+}
+
+
+void
+MARENA_FN(commit_span)(MARENA_T *arena, MARENA_SIZE_T used_size)
+{
+    MARENA_FN(_assert_valid)(arena);
+    assert_msg(used_size <= arena->alloc_context.span_size, "Committing more than the reserved span");
+
+    arena->alloc_context.staging_size += MIN(used_size, arena->alloc_context.span_size);
+    arena->alloc_context.span_size = 0;
+}
+
+
+#define MARENA__PUSH_WRAPPER_DEF(...)           \
+    MARENA_FN(begin)(arena);                    \
+    __VA_ARGS__;                                \
+    return MARENA_FN(commit)(arena);            \
+
+
+/* @NOTE :: Those functions bundles a `marena_begin()` `marena_commit()`
+   calls for usage convenience */
+MARENA_REF_T MARENA_FN(push)                (MARENA_T *arena, MARENA_SIZE_T size, bool initialize_to_zero ) { MARENA__PUSH_WRAPPER_DEF(MARENA_FN(add)                (arena, size, initialize_to_zero)) }
+MARENA_REF_T MARENA_FN(push_data)           (MARENA_T *arena, void *data, MARENA_SIZE_T sizeof_data )       { MARENA__PUSH_WRAPPER_DEF(MARENA_FN(add_data)           (arena, data, sizeof_data)) }
+MARENA_REF_T MARENA_FN(push_pointer)        (MARENA_T *arena, void *pointer)                                { MARENA__PUSH_WRAPPER_DEF(MARENA_FN(add_pointer)        (arena, pointer)) }
+MARENA_REF_T MARENA_FN(push_byte)           (MARENA_T *arena, byte_t b )                                    { MARENA__PUSH_WRAPPER_DEF(MARENA_FN(add_byte)           (arena, b )) }
+MARENA_REF_T MARENA_FN(push_char)           (MARENA_T *arena, char c )                                      { MARENA__PUSH_WRAPPER_DEF(MARENA_FN(add_char)           (arena, c )) }
+MARENA_REF_T MARENA_FN(push_i8)             (MARENA_T *arena, I8 i8 )                                       { MARENA__PUSH_WRAPPER_DEF(MARENA_FN(add_i8)             (arena, i8 )) }
+MARENA_REF_T MARENA_FN(push_u8)             (MARENA_T *arena, U8 u8 )                                       { MARENA__PUSH_WRAPPER_DEF(MARENA_FN(add_u8)             (arena, u8 )) }
+MARENA_REF_T MARENA_FN(push_i16)            (MARENA_T *arena, I16 i16 )                                     { MARENA__PUSH_WRAPPER_DEF(MARENA_FN(add_i16)            (arena, i16 )) }
+MARENA_REF_T MARENA_FN(push_u16)            (MARENA_T *arena, U16 u16 )                                     { MARENA__PUSH_WRAPPER_DEF(MARENA_FN(add_u16)            (arena, u16 )) }
+MARENA_REF_T MARENA_FN(push_i32)            (MARENA_T *arena, I32 i32 )                                     { MARENA__PUSH_WRAPPER_DEF(MARENA_FN(add_i32)            (arena, i32 )) }
+MARENA_REF_T MARENA_FN(push_u32)            (MARENA_T *arena, U32 u32 )                                     { MARENA__PUSH_WRAPPER_DEF(MARENA_FN(add_u32)            (arena, u32 )) }
+MARENA_REF_T MARENA_FN(push_i64)            (MARENA_T *arena, I64 i64 )                                     { MARENA__PUSH_WRAPPER_DEF(MARENA_FN(add_i64)            (arena, i64 )) }
+MARENA_REF_T MARENA_FN(push_u64)            (MARENA_T *arena, U64 u64 )                                     { MARENA__PUSH_WRAPPER_DEF(MARENA_FN(add_u64)            (arena, u64 )) }
+MARENA_REF_T MARENA_FN(push_size_t)         (MARENA_T *arena, size_t s )                                    { MARENA__PUSH_WRAPPER_DEF(MARENA_FN(add_size_t)         (arena, s )) }
+MARENA_REF_T MARENA_FN(push_usize)          (MARENA_T *arena, usize us )                                    { MARENA__PUSH_WRAPPER_DEF(MARENA_FN(add_usize)          (arena, us )) }
+MARENA_REF_T MARENA_FN(push_cstr)           (MARENA_T *arena, char* cstr )                                  { MARENA__PUSH_WRAPPER_DEF(MARENA_FN(add_cstr)           (arena, cstr )) }
+MARENA_REF_T MARENA_FN(push_pstr32)         (MARENA_T *arena, PStr32 *pstr32 )                              { MARENA__PUSH_WRAPPER_DEF(MARENA_FN(add_pstr32)         (arena, pstr32 )) }
+MARENA_REF_T MARENA_FN(push_str32_nodata)   (MARENA_T *arena, Str32 str32 )                                 { MARENA__PUSH_WRAPPER_DEF(MARENA_FN(add_str32_nodata)   (arena, str32 )) }
+MARENA_REF_T MARENA_FN(push_str32_withdata) (MARENA_T *arena, Str32 str32 )                                 { MARENA__PUSH_WRAPPER_DEF(MARENA_FN(add_str32_withdata) (arena, str32 )) }
+MARENA_REF_T MARENA_FN(push_alignment)      (MARENA_T *arena, MARENA_SIZE_T alignment)                      { MARENA__PUSH_WRAPPER_DEF(MARENA_FN(ask_alignment)      (arena, alignment)) }
+
+#undef MARENA__PUSH_WRAPPER_DEF
+
+
+#undef MARENA__SIZE_MAX
+#undef MARENA_T
+#undef MARENA_REF_T
+#undef MARENA_SIZE_T
+#undef MARENA_FN
@@ -25,6 +25,56 @@
 
 
 
+/* `malloc` honoring any power of 2 `alignment`, the result can be released with `free` */
+static void *
+heap_alloc_aligned(size_t size, size_t alignment)
+{
+    if (alignment <= MEM_MALLOC_ALIGNMENT)
+    {
+        return malloc(size);
+    }
+
+    assert(IS_POW2(alignment));
+    void *result = NULL;
+    if (posix_memalign(&result, alignment, size) != 0)
+    {
+        result = NULL;
+    }
+    return result;
+}
+
+static void *
+xheap_alloc_aligned(size_t size, size_t alignment)
+{
+    void *result = heap_alloc_aligned(size, alignment);
+    if ( !result )
+    {
+        perror("MEM: Memory allocation failed");
+        pal_abort();
+    }
+    return result;
+}
+
+/* `realloc` only guarantees `MEM_MALLOC_ALIGNMENT`: past it
+   the buffer is moved explicitly. Upon failure the old buffer is left untouched */
+static void *
+heap_realloc_aligned(void *old_addr, size_t old_size, size_t new_size, size_t alignment)
+{
+    if (alignment <= MEM_MALLOC_ALIGNMENT)
+    {
+        return realloc(old_addr, new_size);
+    }
+
+    void *result = heap_alloc_aligned(new_size, alignment);
+    if (result && old_addr)
+    {
+        memcpy(result, old_addr, MIN(old_size, new_size));
+        free(old_addr);
+    }
+    return result;
+}
+
+
 void *
 xmalloc ( size_t size )
 {
@@ -86,39 +136,165 @@ mem_unmap(void *addr, size_t size)
     assert(result);
 }
 
+
+/* Over map by `alignment` so that an aligned region of `size` bytes
+   is guaranteed to fit, then trim the head and the tail.
+   `granularity` is the size of the pages backing the mapping:
+   `size` must be a multiple of it and `alignment` not smaller than it. */
+static void*
+mmap_aligned_aux(size_t size, size_t alignment, enum page_type_flags type, size_t granularity)
+{
+    assert(size % granularity == 0);
+    assert(IS_POW2(alignment) && alignment >= granularity);
+
+    const enum page_prot_flags prot = PAGE_PROT_READ | PAGE_PROT_WRITE;
+    const size_t mapped_size = size + alignment - granularity;
+    U8 *mapped_addr = (U8*) pal_mmap_memory(NULL, mapped_size, prot, type);
+    if (!mapped_addr)
+    {
+        return NULL;
+    }
+
+    U8 *result = (U8*) POW2_ALIGN(usize, mapped_addr, alignment);
+    const size_t head_size = (size_t) (result - mapped_addr);
+    const size_t tail_size = mapped_size - head_size - size;
+
+    if (head_size)
+    {
+        mem_unmap(mapped_addr, head_size);
+    }
+    if (tail_size)
+    {
+        mem_unmap(result + size, tail_size);
+    }
+
+    return result;
+}
+
+
+/* Same as `mmap_aligned_aux` for address space that is only reserved */
+static void*
+reserve_addr_space_aligned(size_t size, size_t alignment)
+{
+    assert(IS_POW2(alignment));
+    size = PAGE_ALIGN(size);
+
+    if (alignment <= G_pal.page_size)
+    {
+        return pal_reserve_addr_space(NULL, size);
+    }
+
+    const size_t reserved_size = size + alignment - G_pal.page_size;
+    U8 *reserved_addr = (U8*) pal_reserve_addr_space(NULL, reserved_size);
+    if (!reserved_addr)
+    {
+        return NULL;
+    }
+
+    U8 *result = (U8*) POW2_ALIGN(usize, reserved_addr, alignment);
+    const size_t head_size = (size_t) (result - reserved_addr);
+    const size_t tail_size = reserved_size - head_size - size;
+
+    if (head_size)
+    {
+        pal_release_addr_space(reserved_addr, head_size);
+    }
+    if (tail_size)
+    {
+        pal_release_addr_space(result + size, tail_size);
+    }
+
+    return result;
+}
+
+
+void*
+mem_mmap_aligned(size_t size, size_t alignment)
+{
+    assert(IS_POW2(alignment));
+    size = PAGE_ALIGN(size);
+
+    if (alignment <= G_pal.page_size)
+    {
+        return mem_mmap(size);
+    }
+
+    return mmap_aligned_aux(size, alignment, PAGE_PRIVATE | PAGE_ANONYMOUS, G_pal.page_size);
+}
+
+
+void*
+mem_mmap_huge(size_t size, size_t alignment)
+{
+    assert(IS_POW2(alignment));
+    size = MEM_HUGE_PAGE_ALIGN(size);
+    alignment = MAX(alignment, MEM_HUGE_PAGE_SIZE);
+
+    const enum page_type_flags type = PAGE_PRIVATE | PAGE_ANONYMOUS | PAGE_HUGETLB | PAGE_HUGE_2MB;
+    void *result = mmap_aligned_aux(size, alignment, type, MEM_HUGE_PAGE_SIZE);
+
+    if (!result)
+    {
+        /* No explicit huge page available (eg `vm.nr_hugepages` is 0):
+           fallback to regular pages and ask for transparent huge pages.
+           The mapping is huge page aligned so that the whole range is eligible. */
+        result = mem_mmap_aligned(size, alignment);
+        if (result)
+        {
+            pal_advise_huge_pages(result, size);
+        }
+    }
+
+    return result;
+}
+
 void*
 mem_alloc( enum AllocStrategy alloc_strategy, size_t size, size_t alignment)
 {
-    (void) alignment;
+    alignment = MAX(alignment, (size_t) 1);
+    assert(IS_POW2(alignment));
+
     switch (alloc_strategy)
     {
 
     default: { invalid_code_path(); } break;
 
     case AllocStrategy_Xmalloc: {
-        return xmalloc(size);
+        return xheap_alloc_aligned(size, alignment);
     } break;
 
-    case AllocStrategy_Malloc: {
-        return malloc(size);
+    case AllocStrategy_Malloc:
+    case AllocStrategy_AlignedAlloc: {
+        return heap_alloc_aligned(size, alignment);
     } break;
 
     case AllocStrategy_Xcalloc: {
-        return xcalloc(size);
+        if (alignment <= MEM_MALLOC_ALIGNMENT)
+        {
+            return xcalloc(size);
+        }
+        return memclr(xheap_alloc_aligned(size, alignment), size);
     } break;
 
     case AllocStrategy_Calloc: {
-        return calloc(1, size);
+        if (alignment <= MEM_MALLOC_ALIGNMENT)
+        {
+            return calloc(1, size);
+        }
+        void *result = heap_alloc_aligned(size, alignment);
+        return result ? memclr(result, size) : NULL;
     } break;
 
-#if 0
-    case AllocStrategy_AlignedAlloc: {
-        return aligned_alloc(alignment, size);
+    case AllocStrategy_Mmap: {
+        return mem_mmap_aligned(size, alignment);
     } break;
-#endif
 
-    case AllocStrategy_Mmap: {
-        return mem_mmap(size);
+    case AllocStrategy_ReserveAddrSpace: {
+        return reserve_addr_space_aligned(size, alignment);
+    } break;
+
+    case AllocStrategy_MmapHugePages: {
+        return mem_mmap_huge(size, alignment);
     } break;
 
     }
@@ -138,6 +314,57 @@ remap_keepAddr(void *old_addr, size_t old_size, size_t new_size)
     return pal_mremap( old_addr, old_size, new_addr, new_size, flags );
 }
 
+/* `mremap` only guarantees page alignment to a moved mapping: past it the
+   destination is an aligned mapping that `mremap` replaces in place */
+static inline void *
+remap_mayMove(void *old_addr, size_t old_size, size_t new_size, size_t alignment)
+{
+    new_size = PAGE_ALIGN(new_size);
+
+    if (alignment <= G_pal.page_size)
+    {
+        void *new_addr = 0; // No Fixed address, cleared to 0
+        const enum page_remap_flags flags = PAGE_REMAP_MAYMOVE;
+        return pal_mremap( old_addr, old_size, new_addr, new_size, flags );
+    }
+
+    if (((usize) old_addr % alignment == 0) && new_size <= PAGE_ALIGN(old_size))
+    {
+        /* Shrinking keeps the address */
+        return remap_keepAddr(old_addr, old_size, new_size);
+    }
+
+    void *new_addr = mem_mmap_aligned(new_size, alignment);
+    if (!new_addr)
+    {
+        return NULL;
+    }
+    const enum page_remap_flags flags = PAGE_REMAP_MAYMOVE | PAGE_REMAP_FIXED;
+    void *result = pal_mremap( old_addr, old_size, new_addr, new_size, flags );
+    if (!result)
+    {
+        /* The old mapping is left untouched, give back the destination */
+        mem_unmap(new_addr, new_size);
+    }
+    return result;
+}
+
+static inline void *
+commit_addr_space(void *addr, size_t old_size, size_t new_size)
+{
+    old_size = PAGE_ALIGN(old_size);
+    new_size = PAGE_ALIGN(new_size);
+    if (new_size > old_size)
+    {
+        if (!pal_commit_addr_space((U8*) addr + old_size, new_size - old_size,
+                                   PAGE_PROT_READ | PAGE_PROT_WRITE))
+        {
+            return NULL;
+        }
+    }
+    return addr;
+}
+
 void *
 mem_realloc__release ( enum ReallocStrategy realloc_strategy,
                        void  *old_addr,
@@ -145,7 +372,8 @@ mem_realloc__release ( enum ReallocStrategy realloc_strategy,
                        size_t new_size,
                        size_t alignment )
 {
-    UNUSED(alignment);
+    alignment = MAX(alignment, (size_t) 1);
+    assert(IS_POW2(alignment));
 
     switch (realloc_strategy)
     {
@@ -164,27 +392,37 @@ mem_realloc__release ( enum ReallocStrategy realloc_strategy,
     } break;
 
     case ReallocStrategy_Xrealloc: {
-        return xrealloc(old_addr, new_size);
+        if (alignment <= MEM_MALLOC_ALIGNMENT)
+        {
+            return xrealloc(old_addr, new_size);
+        }
+        void *result = heap_realloc_aligned(old_addr, old_size, new_size, alignment);
+        if (!result)
+        {
+            perror("MEM: Memory reallocation failed");
+            pal_abort();
+        }
+        return result;
     } break;
 
     case ReallocStrategy_Realloc: {
-        return realloc(old_addr, new_size);
+        return heap_realloc_aligned(old_addr, old_size, new_size, alignment);
     } break;
 
 
     case ReallocStrategy_MRemap_MayMove: {
-        alignment = PAGE_ALIGN(alignment);
-        void *new_addr = 0; // No Fixed address, cleared to 0
-        const enum page_remap_flags flags = PAGE_REMAP_MAYMOVE;
-        new_size = PAGE_ALIGN(new_size);
-        return pal_mremap( old_addr, old_size, new_addr, new_size, flags );
+        return remap_mayMove(old_addr, old_size, new_size, alignment);
     } break;
 
     case ReallocStrategy_MRemap_KeepAddr: {
-        alignment = PAGE_ALIGN(alignment);
+        /* The address never changes, neither does its alignment */
         return remap_keepAddr(old_addr, old_size, new_size);
     } break;
 
+    case ReallocStrategy_CommitAddrSpace: {
+        return commit_addr_space(old_addr, old_size, new_size);
+    } break;
+
     }
 
     return NULL;
@@ -204,6 +442,8 @@ mem_realloc__debug ( enum ReallocStrategy realloc_strategy,
                      size_t new_size,
                      size_t alignment )
 {
+    alignment = MAX(alignment, (size_t) 1);
+    assert(IS_POW2(alignment));
 
     switch (realloc_strategy)
     {
@@ -222,16 +462,19 @@ mem_realloc__debug ( enum ReallocStrategy realloc_strategy,
     } break;
 
     case ReallocStrategy_Xrealloc: {
-        void *new_addr = xmalloc(new_size);
-        memcpy(new_addr, old_addr, old_size);
+        void *new_addr = xheap_alloc_aligned(new_size, alignment);
+        memcpy(new_addr, old_addr, MIN(old_size, new_size));
         free(old_addr);
         return new_addr;
     } break;
 
     case ReallocStrategy_Realloc: {
-        void *new_addr = malloc(new_size);
-        memcpy(new_addr, old_addr, old_size);
-        free(old_addr);
+        void *new_addr = heap_alloc_aligned(new_size, alignment);
+        if (new_addr)
+        {
+            memcpy(new_addr, old_addr, MIN(old_size, new_size));
+            free(old_addr);
+        }
         return new_addr;
     } break;
 
@@ -239,10 +482,13 @@ mem_realloc__debug ( enum ReallocStrategy realloc_strategy,
     case ReallocStrategy_MRemap_MayMove: {
         // In this case we will try to always force a move
         // to a new memory region
-        alignment = PAGE_ALIGN(alignment);
         const enum AllocStrategy alloc_strategy = AllocStrategy_Mmap;
         void *new_addr = mem_alloc(alloc_strategy, new_size, alignment);
-        memcpy(new_addr, old_addr, old_size);
+        if (!new_addr)
+        {
+            return NULL;
+        }
+        memcpy(new_addr, old_addr, MIN(old_size, new_size));
 #if __DPCRT_MEM_LAYER__MREMAP_PROTECT_OLD_MMAPED_REGION
         const bool was_protected = pal_mprotect(old_addr, old_size, PAGE_PROT_NONE);
         assert(was_protected); // debug code we can simply assert here
@@ -254,10 +500,13 @@ mem_realloc__debug ( enum ReallocStrategy realloc_strategy,
     } break;
 
     case ReallocStrategy_MRemap_KeepAddr: {
-        alignment = PAGE_ALIGN(alignment);
         return remap_keepAddr(old_addr, old_size, new_size);
     } break;
 
+    case ReallocStrategy_CommitAddrSpace: {
+        return commit_addr_space(old_addr, old_size, new_size);
+    } break;
+
     }
 
     return NULL;
@@ -284,6 +533,12 @@ mem_dealloc (enum DeallocStrategy dealloc_strategy,
         mem_unmap(addr, size);
     } break;
 
+    case DeallocStrategy_ReleaseAddrSpace: {
+        bool released = pal_release_addr_space(addr, size);
+        (void) released;
+        assert(released);
+    } break;
+
     }
 }
 
@@ -35,12 +35,24 @@ enum AllocStrategy {
     AllocStrategy_Xcalloc       = 2,
     AllocStrategy_Calloc        = 3,
     AllocStrategy_Mmap          = 4,
-    //AllocStrategy_AlignedAlloc  = 5,
+    AllocStrategy_AlignedAlloc  = 5,    // `malloc` like buffer honoring any power of 2 alignment. Release it with `DeallocStrategy_Free`
+    AllocStrategy_ReserveAddrSpace = 6, // Only reserves the address space, nothing is committed.
+                                        // Pages must be committed with `ReallocStrategy_CommitAddrSpace`
+    AllocStrategy_MmapHugePages = 7,    // See `mem_mmap_huge`. The size of the buffer is rounded up
+                                        // to `MEM_HUGE_PAGE_SIZE`, the rounded size must be used when unmapping it.
+                                        // `ReallocStrategy_MRemap_*` is not supported on these buffers.
 
 };
 
 
 
+/* Every strategy honors the `alignment` (a power of 2, 0 for don't care) asked to `mem_alloc`
+   and `mem_realloc`. The heap based strategies fall back to `posix_memalign` only when
+   `alignment` is past `MEM_MALLOC_ALIGNMENT`, the mapping based strategies only when
+   it is past the page size. Reallocations keep the alignment they are asked for,
+   `ReallocStrategy_MRemap_MayMove` included. */
+#define MEM_MALLOC_ALIGNMENT (2 * sizeof(void*))
+
 enum ReallocStrategy {
     ReallocStrategy_None            = 0,
     ReallocStrategy_Xrealloc        = 1,
@@ -51,17 +63,38 @@ enum ReallocStrategy {
     ReallocStrategy_MRemap_KeepAddr = 4, // Try to keep the address the same. Pointers to the memory region
                                          // will not get invalidate. May fail more easily if the OS could not fit
                                          // the memory region in the same virtual address space
+    ReallocStrategy_CommitAddrSpace = 5, // Commits the pages following `old_size` inside an address space
+                                         // previously reserved with `AllocStrategy_ReserveAddrSpace`.
+                                         // The address never changes and no data is ever copied.
+                                         // @NOTE :: The caller is responsible to never grow past the reserved size
 };
 
 enum DeallocStrategy {
     DeallocStrategy_Free = 0,
     DeallocStrategy_Munmap = 1,
+    DeallocStrategy_ReleaseAddrSpace = 2, // `buffer_size` must be the entire reserved size
 };
 
 
 void* mem_mmap(size_t size);
 void  mem_unmap(void *addr, size_t size);
 
+/* Same as `mem_mmap` but the returned address is guaranteed to be a
+   multiple of `alignment` (which must be a power of 2). The slack needed
+   to realign the mapping is given back to the OS, so the returned region
+   can be released with a plain `mem_unmap(addr, size)`. */
+void* mem_mmap_aligned(size_t size, size_t alignment);
+
+#define MEM_HUGE_PAGE_SIZE ((size_t) MEGABYTES(2))
+#define MEM_HUGE_PAGE_ALIGN(size) POW2_ALIGN(size_t, (size), MEM_HUGE_PAGE_SIZE)
+
+/* Maps `size` bytes (rounded up to `MEM_HUGE_PAGE_SIZE`) at an address multiple of
+   `alignment` (at least `MEM_HUGE_PAGE_SIZE`), backed by explicit 2MB huge pages.
+   When the system has no huge page available it falls back to regular
+   pages advised for transparent huge pages (`pal_advise_huge_pages`).
+   Release it with `mem_unmap(addr, MEM_HUGE_PAGE_ALIGN(size))`. */
+void* mem_mmap_huge(size_t size, size_t alignment);
+
 void*
 mem_alloc( enum AllocStrategy alloc_strategy,
            size_t size,
@@ -274,6 +274,11 @@ bool   pal_commit_addr_space    (void *addr, size_t size, enum page_prot_flags p
 bool   pal_uncommit_addr_space  (void *addr, size_t size);
 bool   pal_release_addr_space   (void *addr, size_t size);
 
+/* Hints the OS to back the (already mapped) range with transparent huge pages.
+   Returns false if the hint is not supported. It is only a hint: the range
+   keeps working with regular pages when no huge page is available. */
+bool   pal_advise_huge_pages    (void *addr, size_t size);
+
 
 
 enum notify_event_flags {
@@ -21,6 +21,7 @@
 
 #include "dpcrt_streams.h"
 #include "dpcrt_pal.h"
+#include "dpcrt_hash.h"
 
 static void
 istream__reset_buffer(IStream *istream,
@@ -43,6 +44,9 @@ istream__refill_buffer(IStream *istream)
     if (size <= 0) {
         success = false;
     } else {
+        if (istream->crc32c_enabled) {
+            istream->crc32c = crc32c_update(istream->crc32c, istream->buffer, (size_t) size);
+        }
         istream__reset_buffer(istream, size);
         success = true;
     }
@@ -144,3 +148,28 @@ istream_read_next_byte(IStream *istream, byte_t *byte)
 }
 
 
+
+
+void
+istream_enable_crc32c(IStream *istream)
+{
+    /* Only the first buffer may have been read */
+    istream->crc32c_enabled = true;
+    istream->crc32c = crc32c_update(0, istream->buffer, istream->buffer_len);
+}
+
+
+U64
+istream_hash64(IStream *istream, U64 seed)
+{
+    Hash64State state;
+    hash64_init(&state, seed);
+    if (istream->buffer_it < istream->buffer_len) {
+        do {
+            hash64_update(&state, istream->buffer + istream->buffer_it,
+                          istream->buffer_len - istream->buffer_it);
+            istream->buffer_it = istream->buffer_len;
+        } while (istream__refill_buffer(istream));
+    }
+    return hash64_final(&state);
+}
@@ -34,6 +34,8 @@ typedef struct IStream {
     FileHandle   fh;
     U32          buffer_len;
     U32          buffer_it;
+    bool32       crc32c_enabled;
+    U32          crc32c;        // CRC32C of every byte read from `fh` so far, see `istream_enable_crc32c`
     byte_t       buffer[ISTREAM_CACHE_BUFFER_SIZE];
 } IStream;
 
@@ -77,6 +79,20 @@ static inline bool
 istream_read_next_char(IStream *istream, char *c) { return istream_read_next_byte(istream, (byte_t*) c); }
 
 
+/* Keeps a CRC32C of the content read from the file, updated at every refill of the
+   buffer with no additional pass over the data. Call it right after the stream initialization.
+   Once the stream is exhausted `istream_crc32c` is the CRC32C of the whole file. */
+void
+istream_enable_crc32c(IStream *istream);
+
+static inline U32
+istream_crc32c(const IStream *istream) { return istream->crc32c; }
+
+/* Consumes the rest of the stream returning its `hash64_seed`, eg to fingerprint a file content */
+U64
+istream_hash64(IStream *istream, U64 seed);
+
+
 __END_DECLS
 
 
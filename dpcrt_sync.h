@@ -22,11 +22,56 @@
 #define HGUARD_de2652fbd0924c229b59853e867a7a6d
 
 #include "dpcrt_utils.h"
+#include "dpcrt_atomics.h"
 
 
 __BEGIN_DECLS
 
 
+/* Minimal test-and-test-and-set spin lock. Meant to guard very short
+   critical sections (a handful of pointer updates) where parking the
+   thread in the kernel would cost far more than spinning.
+   A zero-initialized `SpinLock` is a valid unlocked lock. */
+typedef struct SpinLock
+{
+    I32 locked;
+} SpinLock;
+
+
+static inline void
+cpu_relax(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+    __builtin_ia32_pause();
+#endif
+}
+
+static inline bool
+spinlock_try_lock(SpinLock *lock)
+{
+    I32 expected = 0;
+    return atomic_compare_exchange(&lock->locked, &expected, 1);
+}
+
+static inline void
+spinlock_lock(SpinLock *lock)
+{
+    while (!spinlock_try_lock(lock))
+    {
+        /* Spin on a plain load to avoid bouncing the cache line
+           with continuous read-modify-write operations */
+        while (atomic_load(&lock->locked))
+        {
+            cpu_relax();
+        }
+    }
+}
+
+static inline void
+spinlock_unlock(SpinLock *lock)
+{
+    atomic_store(&lock->locked, 0);
+}
 
 
 __END_DECLS
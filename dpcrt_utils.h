@@ -62,6 +62,32 @@ __BEGIN_DECLS
 /* Returns true if `x` is a power of 2 */
 #define IS_POW2(x) (!((x) & ((x) - 1)))
 
+/* Returns the smallest power of 2 greater or equal than `x`.
+   @NOTE :: `next_pow2_u64(0)` returns 1 */
+static inline U64
+next_pow2_u64(U64 x)
+{
+    if (x <= 1)
+    {
+        return 1;
+    }
+    return (U64) 1 << (64 - __builtin_clzll(x - 1));
+}
+
+/* Index of the least significant set bit. `x` must be non zero */
+static inline U32
+bit_scan_forward_u32(U32 x)
+{
+    return (U32) __builtin_ctz(x);
+}
+
+/* Index of the most significant set bit. `x` must be non zero */
+static inline U32
+bit_scan_reverse_u32(U32 x)
+{
+    return (U32) (31 - __builtin_clz(x));
+}
+
 /* Align any generic value to any alignment */
 #define ALIGN(TYPE, N, S) ((TYPE)  ((((TYPE)(N) + (TYPE) ((TYPE)(S) - (TYPE) 1)) / (TYPE)(S)) * (TYPE)(S)))
 /* This macro is the same as ALIGN but only works when `S` is a POWER of 2.
@@ -81,6 +107,11 @@ __BEGIN_DECLS
 #define MEGABYTES(x) ((KILOBYTES(x)) << 10)
 #define GIGABYTES(x) ((MEGABYTES(x)) << 10)
 
+/* Size of a cache line of the target, the granularity at which cores share data */
+#ifndef CACHE_LINE_SIZE
+#  define CACHE_LINE_SIZE (64)
+#endif
+
 #define KILO(x) (((size_t) (x)) << 10)
 #define MEGA(x) ((KILOBYTES(x)) << 10)
 #define GIGA(x) ((MEGABYTES(x)) << 10)
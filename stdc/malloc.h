@@ -42,6 +42,10 @@ extern void *
 realloc (void *ptr, size_t size)
     ATTRIB_NOTHROW ATTRIB_NODISCARD;
 
+extern int
+posix_memalign ( void **memptr, size_t alignment, size_t size )
+    ATTRIB_NOTHROW;
+
 extern void
 free ( void *ptr )
     ATTRIB_NOTHROW;